@@ -0,0 +1,343 @@
+// Standalone benchmark of the native wrapper, without the N-API layer.
+//
+// Measures prefill throughput, time to first token and decode throughput of
+// generations (sequential, concurrent and grammar-constrained), and embedding
+// throughput by batch size and text length. Prints one JSON object to stdout.
+//
+// Usage: llama_binding_bench --model <gguf> [options], see print_usage().
+
+#include "llama-wrapper.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llama_wrapper;
+
+namespace {
+
+struct BenchOptions {
+  ModelParams model;
+  ContextParams context;
+  std::string embedding_model_path;
+  int prompt_words = 512;
+  int gen_tokens = 128;
+  int repetitions = 3;
+  std::vector<int> embed_batch_sizes = {1, 8, 32};
+  std::vector<int> embed_lengths = {32, 128, 512};
+};
+
+// Grammar for the constrained run: a JSON array of numbers
+const char *BENCH_GRAMMAR = "root ::= \"[\" num (\", \" num)* \"]\"\nnum ::= [1-9] [0-9]{0,5}";
+
+void print_usage() {
+  std::fprintf(stderr,
+               "Usage: llama_binding_bench --model <path> [options]\n"
+               "  --gpu-layers N         Layers to offload (default: 99)\n"
+               "  --split-mode MODE      none, layer or row (default: layer)\n"
+               "  --main-gpu N           GPU index for split mode none (default: 0)\n"
+               "  --tensor-split LIST    Proportion per device, e.g. 3,1\n"
+               "  --numa STRATEGY        distribute, isolate, numactl or mirror\n"
+               "  --ctx N                Context size per sequence (default: 4096)\n"
+               "  --batch N              Batch size (default: 512)\n"
+               "  --ubatch N             Physical batch size (default: llama.cpp default)\n"
+               "  --threads N            Generation threads (default: 4)\n"
+               "  --threads-batch N      Prompt processing threads (default: --threads)\n"
+               "  --parallel N           Concurrent sequences (default: 1)\n"
+               "  --cache-type-k TYPE    KV cache type of keys (default: f16)\n"
+               "  --cache-type-v TYPE    KV cache type of values (default: f16)\n"
+               "  --flash-attn MODE      auto, on or off (default: auto)\n"
+               "  --prompt-words N       Words per generation prompt (default: 512)\n"
+               "  --gen-tokens N         Tokens to generate per request (default: 128)\n"
+               "  --repetitions N        Runs per measurement (default: 3)\n"
+               "  --embedding-model P    Embedding model; skip embeddings if not set\n"
+               "  --embed-batch LIST     Texts per embed call, e.g. 1,8,32\n"
+               "  --embed-length LIST    Words per text, e.g. 32,128,512\n");
+}
+
+std::vector<int> parse_list(const char *text) {
+  std::vector<int> values;
+  std::stringstream stream(text);
+  std::string item;
+  while (std::getline(stream, item, ',')) {
+    if (!item.empty()) {
+      values.push_back(std::atoi(item.c_str()));
+    }
+  }
+  return values;
+}
+
+bool parse_args(int argc, char **argv, BenchOptions &options) {
+  options.context.n_ctx = 4096;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      return false;
+    }
+    const char *value = argv[++i];
+    if (arg == "--model") {
+      options.model.model_path = value;
+    } else if (arg == "--gpu-layers") {
+      options.model.n_gpu_layers = std::atoi(value);
+    } else if (arg == "--split-mode") {
+      options.model.split_mode = value;
+    } else if (arg == "--main-gpu") {
+      options.model.main_gpu = std::atoi(value);
+    } else if (arg == "--tensor-split") {
+      for (int share : parse_list(value)) {
+        options.model.tensor_split.push_back(static_cast<float>(share));
+      }
+    } else if (arg == "--numa") {
+      options.model.numa = value;
+    } else if (arg == "--ctx") {
+      options.context.n_ctx = std::atoi(value);
+    } else if (arg == "--batch") {
+      options.context.n_batch = std::atoi(value);
+    } else if (arg == "--ubatch") {
+      options.context.n_ubatch = std::atoi(value);
+    } else if (arg == "--threads") {
+      options.context.n_threads = std::atoi(value);
+    } else if (arg == "--threads-batch") {
+      options.context.n_threads_batch = std::atoi(value);
+    } else if (arg == "--parallel") {
+      options.context.n_seq_max = std::max(1, std::atoi(value));
+    } else if (arg == "--cache-type-k") {
+      options.context.type_k = value;
+    } else if (arg == "--cache-type-v") {
+      options.context.type_v = value;
+    } else if (arg == "--flash-attn") {
+      options.context.flash_attn = value;
+    } else if (arg == "--prompt-words") {
+      options.prompt_words = std::atoi(value);
+    } else if (arg == "--gen-tokens") {
+      options.gen_tokens = std::atoi(value);
+    } else if (arg == "--repetitions") {
+      options.repetitions = std::max(1, std::atoi(value));
+    } else if (arg == "--embedding-model") {
+      options.embedding_model_path = value;
+    } else if (arg == "--embed-batch") {
+      options.embed_batch_sizes = parse_list(value);
+    } else if (arg == "--embed-length") {
+      options.embed_lengths = parse_list(value);
+    } else {
+      return false;
+    }
+  }
+  return !options.model.model_path.empty();
+}
+
+// Text of roughly one token per word. The seed makes every prompt differ from
+// the first word on, so that no run reuses the KV cache of a previous one.
+std::string make_text(int n_words, int seed) {
+  static const char *words[] = {"time",  "year",  "people", "way",    "day",   "man",
+                                "thing", "woman", "life",   "child",  "world", "school",
+                                "state", "house", "group",  "family", "place", "hand"};
+  const int n = sizeof(words) / sizeof(words[0]);
+  std::string text = "Run " + std::to_string(seed) + ":";
+  for (int i = 0; i < n_words; i++) {
+    text += ' ';
+    text += words[(i * 7 + seed) % n];
+  }
+  return text;
+}
+
+// JSON string literal of a value
+std::string json_string(const std::string &value) {
+  std::string out = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+double per_second(double count, double ms) { return ms > 0 ? count * 1000 / ms : 0; }
+
+double median(std::vector<double> values) {
+  if (values.empty()) {
+    return 0;
+  }
+  std::sort(values.begin(), values.end());
+  const size_t mid = values.size() / 2;
+  return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2;
+}
+
+// Medians of the generation measurements over all runs
+struct GenerationStats {
+  std::vector<double> prompt_tokens, completion_tokens, ttft_ms, prefill_tokens_per_second,
+      decode_tokens_per_second, sample_ms_per_token;
+  double wall_ms = 0;
+  double total_completion_tokens = 0;
+
+  void add(const GenerationResult &result) {
+    const GenerationTimings &t = result.timings;
+    prompt_tokens.push_back(result.prompt_tokens);
+    completion_tokens.push_back(result.completion_tokens);
+    ttft_ms.push_back(t.ttft_ms);
+    prefill_tokens_per_second.push_back(
+        per_second(result.prompt_tokens - result.cached_tokens, t.prefill_ms));
+    decode_tokens_per_second.push_back(per_second(result.completion_tokens - 1, t.decode_ms));
+    sample_ms_per_token.push_back(
+        result.completion_tokens > 0 ? t.sample_ms / result.completion_tokens : 0);
+    total_completion_tokens += result.completion_tokens;
+  }
+
+  std::string to_json() const {
+    std::ostringstream out;
+    out << "{\"runs\":" << ttft_ms.size() << ",\"promptTokens\":" << median(prompt_tokens)
+        << ",\"completionTokens\":" << median(completion_tokens)
+        << ",\"timeToFirstTokenMs\":" << median(ttft_ms)
+        << ",\"prefillTokensPerSecond\":" << median(prefill_tokens_per_second)
+        << ",\"decodeTokensPerSecond\":" << median(decode_tokens_per_second)
+        << ",\"sampleMsPerToken\":" << median(sample_ms_per_token)
+        << ",\"aggregateTokensPerSecond\":" << per_second(total_completion_tokens, wall_ms)
+        << "}";
+    return out.str();
+  }
+};
+
+// Run `repetitions` rounds of n_parallel concurrent generations
+GenerationStats bench_generation(LlamaModel &model, const BenchOptions &options,
+                                 int n_parallel, const std::string &grammar) {
+  GenerationParams params;
+  params.max_tokens = options.gen_tokens;
+  params.temperature = 0.0f;
+  params.grammar = grammar;
+
+  GenerationStats stats;
+  int seed = grammar.empty() ? 0 : 1000;
+  for (int rep = 0; rep < options.repetitions; rep++) {
+    std::vector<GenerationResult> results(n_parallel);
+    std::vector<std::thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_parallel; i++) {
+      const std::vector<ChatMessage> messages = {
+          {"user", make_text(options.prompt_words, ++seed) +
+                       "\nContinue the list of numbers: 1, 2, 3, 4"}};
+      threads.emplace_back([&, i, messages]() { results[i] = model.generate(messages, params); });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    stats.wall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                start)
+                         .count();
+    for (const auto &result : results) {
+      stats.add(result);
+    }
+  }
+  return stats;
+}
+
+std::string bench_embeddings(const BenchOptions &options) {
+  LlamaModel model;
+  ModelParams model_params = options.model;
+  model_params.model_path = options.embedding_model_path;
+  ContextParams context = options.context;
+  context.embedding = true;
+  context.n_seq_max = *std::max_element(options.embed_batch_sizes.begin(),
+                                        options.embed_batch_sizes.end());
+  // Every text has to fit into a single batch, which has to fit into the context
+  const int max_length =
+      *std::max_element(options.embed_lengths.begin(), options.embed_lengths.end());
+  context.n_batch = std::max(context.n_batch, max_length * 2 + 16);
+  context.n_ctx = std::max(context.n_ctx, context.n_batch);
+  if (!model.load(model_params) || !model.create_context(context)) {
+    return "{\"error\":\"Failed to load embedding model\"}";
+  }
+
+  std::ostringstream out;
+  out << "[";
+  bool first = true;
+  for (int batch_size : options.embed_batch_sizes) {
+    for (int length : options.embed_lengths) {
+      std::vector<double> texts_per_second, tokens_per_second;
+      for (int rep = 0; rep < options.repetitions; rep++) {
+        std::vector<std::string> texts;
+        for (int i = 0; i < batch_size; i++) {
+          texts.push_back(make_text(length, rep * batch_size + i));
+        }
+        const EmbeddingResult result = model.embed(texts, EmbeddingEncoding::FLOAT32);
+        texts_per_second.push_back(per_second(batch_size, result.total_ms));
+        tokens_per_second.push_back(per_second(result.total_tokens, result.total_ms));
+      }
+      out << (first ? "" : ",") << "{\"batchSize\":" << batch_size << ",\"words\":" << length
+          << ",\"textsPerSecond\":" << median(texts_per_second)
+          << ",\"tokensPerSecond\":" << median(tokens_per_second) << "}";
+      first = false;
+    }
+  }
+  out << "]";
+  return out.str();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  BenchOptions options;
+  if (!parse_args(argc, argv, options)) {
+    print_usage();
+    return 1;
+  }
+
+  LlamaModel model;
+  std::string error;
+  if (!model.load(options.model, &error)) {
+    if (error.empty()) {
+      error = "Failed to load model from: " + options.model.model_path;
+    }
+    std::fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  if (!model.create_context(options.context, &error)) {
+    std::fprintf(stderr, "%s\n", error.empty() ? "Failed to create context" : error.c_str());
+    return 1;
+  }
+
+  // Warm up caches and backend kernels before measuring
+  BenchOptions warmup = options;
+  warmup.prompt_words = 16;
+  warmup.gen_tokens = 4;
+  warmup.repetitions = 1;
+  bench_generation(model, warmup, 1, "");
+
+  const GenerationStats sequential = bench_generation(model, options, 1, "");
+  const GenerationStats grammar = bench_generation(model, options, 1, BENCH_GRAMMAR);
+
+  std::printf("{\"model\":%s,\"context\":{\"contextSize\":%d,\"batchSize\":%d,"
+              "\"ubatchSize\":%d,\"threads\":%d,\"threadsBatch\":%d,\"parallelSequences\":%d,"
+              "\"cacheTypeK\":\"%s\",\"cacheTypeV\":\"%s\",\"flashAttention\":\"%s\"},",
+              json_string(options.model.model_path).c_str(), options.context.n_ctx,
+              options.context.n_batch, options.context.n_ubatch, options.context.n_threads,
+              options.context.n_threads_batch, options.context.n_seq_max,
+              options.context.type_k.c_str(), options.context.type_v.c_str(),
+              options.context.flash_attn.c_str());
+  std::printf("\"generation\":%s,\"grammar\":%s", sequential.to_json().c_str(),
+              grammar.to_json().c_str());
+  if (options.context.n_seq_max > 1) {
+    const GenerationStats parallel =
+        bench_generation(model, options, options.context.n_seq_max, "");
+    std::printf(",\"parallel\":%s", parallel.to_json().c_str());
+  }
+  model.unload();
+
+  if (!options.embedding_model_path.empty() && !options.embed_batch_sizes.empty() &&
+      !options.embed_lengths.empty()) {
+    std::printf(",\"embedding\":%s", bench_embeddings(options).c_str());
+  }
+  std::printf("}\n");
+  return 0;
+}
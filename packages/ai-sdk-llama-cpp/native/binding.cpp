@@ -1,49 +1,78 @@
+#include "byte-ring.h"
 #include "llama-wrapper.h"
+#include "utf8.h"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <napi.h>
 #include <unordered_map>
 
-// Global state for managing models
-static std::unordered_map<int, std::unique_ptr<llama_wrapper::LlamaModel>> g_models;
+// Global state for managing models. Calls hold their own reference while they
+// submit work; requests queued or running when a model is unloaded fail with an
+// error.
+static std::unordered_map<int, std::shared_ptr<llama_wrapper::LlamaModel>> g_models;
 static std::mutex g_models_mutex;
 static std::atomic<int> g_next_handle{1};
 
+// Look up a model by handle; returns null for unknown (or unloaded) handles
+static std::shared_ptr<llama_wrapper::LlamaModel> FindModel(int handle) {
+  std::lock_guard<std::mutex> lock(g_models_mutex);
+  auto it = g_models.find(handle);
+  return it != g_models.end() ? it->second : nullptr;
+}
+
 // ============================================================================
 // Async Workers
 // ============================================================================
 
-class LoadModelWorker : public Napi::AsyncWorker {
+// Loads a model (or shares the weights of an already loaded one) and creates
+// a context for it under a new handle. Load progress is sent to the optional
+// progress function on the JavaScript thread.
+class LoadModelWorker : public Napi::AsyncProgressWorker<float> {
 public:
-  LoadModelWorker(Napi::Function &callback, const std::string &model_path, int n_gpu_layers,
-                  int n_ctx, int n_threads, bool debug, const std::string &chat_template,
-                  bool embedding)
-      : Napi::AsyncWorker(callback), model_path_(model_path), n_gpu_layers_(n_gpu_layers),
-        n_ctx_(n_ctx), n_threads_(n_threads), debug_(debug), chat_template_(chat_template),
-        embedding_(embedding), handle_(-1), success_(false) {}
-
-  void Execute() override {
-    auto model = std::make_unique<llama_wrapper::LlamaModel>();
-
-    llama_wrapper::ModelParams model_params;
-    model_params.model_path = model_path_;
-    model_params.n_gpu_layers = n_gpu_layers_;
-    model_params.debug = debug_;
-    model_params.chat_template = chat_template_;
-
-    if (!model->load(model_params)) {
-      SetError("Failed to load model from: " + model_path_);
-      return;
+  LoadModelWorker(Napi::Function &callback, const llama_wrapper::ModelParams &model_params,
+                  const llama_wrapper::ContextParams &ctx_params,
+                  std::shared_ptr<llama_wrapper::LlamaModel> source = nullptr,
+                  Napi::Function progress = Napi::Function())
+      : Napi::AsyncProgressWorker<float>(callback), model_params_(model_params),
+        ctx_params_(ctx_params), source_(std::move(source)), handle_(-1), success_(false) {
+    if (!progress.IsEmpty()) {
+      progress_ = Napi::Persistent(progress);
     }
+  }
+
+  void Execute(const ExecutionProgress &progress) override {
+    auto model = std::make_shared<llama_wrapper::LlamaModel>();
 
-    llama_wrapper::ContextParams ctx_params;
-    ctx_params.n_ctx = n_ctx_;
-    ctx_params.n_threads = n_threads_;
-    ctx_params.embedding = embedding_;
+    if (!progress_.IsEmpty()) {
+      // Only the latest value is delivered if the JavaScript thread lags behind
+      model_params_.progress = [&progress](float value) { progress.Send(&value, 1); };
+    }
+
+    if (source_) {
+      const bool loaded = model->load_from(*source_);
+      // The source may have been unloaded meanwhile; its last reference must not
+      // be dropped on the JavaScript thread
+      source_.reset();
+      if (!loaded) {
+        SetError("Model is not loaded");
+        return;
+      }
+    } else {
+      std::string error;
+      if (!model->load(model_params_, &error)) {
+        SetError(error.empty() ? "Failed to load model from: " + model_params_.model_path
+                               : error);
+        return;
+      }
+    }
 
-    if (!model->create_context(ctx_params)) {
-      SetError("Failed to create context");
+    std::string error;
+    if (!model->create_context(ctx_params_, &error)) {
+      SetError(error.empty() ? "Failed to create context" : error);
       return;
     }
 
@@ -57,6 +86,14 @@ public:
     success_ = true;
   }
 
+  void OnProgress(const float *data, size_t count) override {
+    if (progress_.IsEmpty() || !data || count == 0) {
+      return;
+    }
+    Napi::HandleScope scope(Env());
+    progress_.Call({Napi::Number::New(Env(), data[count - 1])});
+  }
+
   void OnOK() override {
     Napi::HandleScope scope(Env());
     Callback().Call({Env().Null(), Napi::Number::New(Env(), handle_)});
@@ -68,187 +105,380 @@ public:
   }
 
 private:
-  std::string model_path_;
-  int n_gpu_layers_;
-  int n_ctx_;
-  int n_threads_;
-  bool debug_;
-  std::string chat_template_;
-  bool embedding_;
+  llama_wrapper::ModelParams model_params_;
+  llama_wrapper::ContextParams ctx_params_;
+  std::shared_ptr<llama_wrapper::LlamaModel> source_;
+  Napi::FunctionReference progress_;
   int handle_;
   bool success_;
 };
 
-class GenerateWorker : public Napi::AsyncWorker {
+// Drops a reference to an unloaded model off the JavaScript thread. Destroying
+// the model aborts its current decode step, joins its scheduler thread and
+// frees the context (and the weights if no other model shares them).
+class ReleaseModelWorker : public Napi::AsyncWorker {
 public:
-  GenerateWorker(Napi::Function &callback, int handle,
-                 const std::vector<llama_wrapper::ChatMessage> &messages,
-                 const llama_wrapper::GenerationParams &params)
-      : Napi::AsyncWorker(callback), handle_(handle), messages_(messages), params_(params) {}
+  ReleaseModelWorker(Napi::Env env, std::shared_ptr<llama_wrapper::LlamaModel> model)
+      : Napi::AsyncWorker(env, "ReleaseModel"), model_(std::move(model)) {}
 
-  void Execute() override {
-    llama_wrapper::LlamaModel *model = nullptr;
+  void Execute() override { model_.reset(); }
 
-    {
-      std::lock_guard<std::mutex> lock(g_models_mutex);
-      auto it = g_models.find(handle_);
-      if (it == g_models.end()) {
-        SetError("Invalid model handle");
-        return;
-      }
-      model = it->second.get();
-    }
+private:
+  std::shared_ptr<llama_wrapper::LlamaModel> model_;
+};
 
-    result_ = model->generate(messages_, params_);
-  }
+// Applies a memory budget on a worker thread, since evicting models joins
+// their scheduler threads and frees their weights
+class SetMemoryBudgetWorker : public Napi::AsyncWorker {
+public:
+  SetMemoryBudgetWorker(Napi::Function &callback, const llama_wrapper::MemoryBudget &budget)
+      : Napi::AsyncWorker(callback), budget_(budget) {}
+
+  void Execute() override { llama_wrapper::ModelRegistry::instance().set_budget(budget_); }
 
   void OnOK() override {
     Napi::HandleScope scope(Env());
-
-    Napi::Object result = Napi::Object::New(Env());
-    result.Set("text", Napi::String::New(Env(), result_.text));
-    result.Set("promptTokens", Napi::Number::New(Env(), result_.prompt_tokens));
-    result.Set("completionTokens", Napi::Number::New(Env(), result_.completion_tokens));
-    result.Set("finishReason", Napi::String::New(Env(), result_.finish_reason));
-
-    Callback().Call({Env().Null(), result});
+    Callback().Call({Env().Null()});
   }
 
 private:
-  int handle_;
-  std::vector<llama_wrapper::ChatMessage> messages_;
-  llama_wrapper::GenerationParams params_;
-  llama_wrapper::GenerationResult result_;
+  llama_wrapper::MemoryBudget budget_;
 };
 
-class StreamGenerateWorker : public Napi::AsyncWorker {
-public:
-  StreamGenerateWorker(Napi::Function &callback, int handle,
-                       const std::vector<llama_wrapper::ChatMessage> &messages,
-                       const llama_wrapper::GenerationParams &params, Napi::ThreadSafeFunction tsfn)
-      : Napi::AsyncWorker(callback), handle_(handle), messages_(messages), params_(params),
-        tsfn_(tsfn) {}
+// ============================================================================
+// Completions
+// ============================================================================
 
-  void Execute() override {
-    llama_wrapper::LlamaModel *model = nullptr;
+// Inference runs on each model's scheduler thread instead of the libuv
+// threadpool. Results hop to the JavaScript thread through a thread-safe
+// function over the request's callback, released after its single completion.
+
+// Converts a native result to the callback's value, or sets error to fail it
+template <typename Result>
+using ResultToJs = std::function<Napi::Value(Napi::Env env, Result &result, std::string &error)>;
+
+// Call a node-style (error, value) callback with a converted result
+template <typename Result>
+static void CallWithResult(Napi::Env env, Napi::Function callback, Result &result,
+                           const ResultToJs<Result> &to_js) {
+  std::string error;
+  Napi::Value value = to_js(env, result, error);
+  if (!error.empty()) {
+    callback.Call({Napi::String::New(env, error), env.Null()});
+  } else {
+    callback.Call({env.Null(), value});
+  }
+}
 
-    {
-      std::lock_guard<std::mutex> lock(g_models_mutex);
-      auto it = g_models.find(handle_);
-      if (it == g_models.end()) {
-        SetError("Invalid model handle");
-        return;
-      }
-      model = it->second.get();
+template <typename Result>
+static std::function<void(Result)> Completion(Napi::ThreadSafeFunction tsfn,
+                                              ResultToJs<Result> to_js) {
+  return [tsfn, to_js](Result result) {
+    tsfn.NonBlockingCall(new Result(std::move(result)),
+                         [to_js](Napi::Env env, Napi::Function callback, Result *data) {
+                           std::unique_ptr<Result> result(data);
+                           CallWithResult(env, callback, *result, to_js);
+                         });
+    tsfn.Release();
+  };
+}
+
+// Coalesces streamed tokens: the scheduler thread appends their text to a
+// lock-free ring and schedules a flush to JavaScript only once per interval or
+// token budget, so decoding never waits for the event loop.
+struct TokenStream {
+  TokenStream(Napi::Function on_token, int flush_interval_ms, int flush_tokens)
+      : on_token(Napi::Persistent(on_token)), flush_interval(flush_interval_ms),
+        flush_tokens(std::max(1, flush_tokens)) {}
+
+  // Scheduler thread: queue a token and flush when the budget is exhausted
+  bool push(std::string_view token, const Napi::ThreadSafeFunction &tsfn) {
+    // Bytes that do not fit stay staged until the next token or the end
+    staged.append(token.data(), token.size());
+    staged.erase(0, ring.write(staged.data(), staged.size()));
+    pending_tokens++;
+
+    // The first token is flushed right away (last_flush starts at the epoch)
+    const auto now = std::chrono::steady_clock::now();
+    if (pending_tokens < flush_tokens && now - last_flush < flush_interval) {
+      return true;
     }
+    pending_tokens = 0;
+    last_flush = now;
 
-    // Stream tokens during generation using thread-safe function
-    result_ = model->generate_streaming(messages_, params_, [this](const std::string &token) {
-      // Create a copy on the heap that will be deleted after the callback
-      std::string *tokenCopy = new std::string(token);
-      // Call JavaScript callback from worker thread via thread-safe function
-      napi_status status = tsfn_.BlockingCall(
-          tokenCopy, [](Napi::Env env, Napi::Function jsCallback, std::string *data) {
-            if (data != nullptr) {
-              jsCallback.Call({Napi::String::New(env, *data)});
-              delete data;
-            }
-          });
-      return status == napi_ok;
+    // At most one flush in flight; it drains everything written before it runs
+    if (flush_scheduled.exchange(true)) {
+      return true;
+    }
+    napi_status status = tsfn.NonBlockingCall([this](Napi::Env env, Napi::Function) {
+      flush_scheduled = false;
+      drain(env, std::string(), false);
     });
+    return status == napi_ok;
   }
 
-  void OnOK() override {
-    Napi::HandleScope scope(Env());
+  // JavaScript thread: deliver buffered text (plus tail) as a single chunk.
+  // Unless final, an incomplete trailing UTF-8 sequence waits for the next chunk.
+  void drain(Napi::Env env, const std::string &tail, bool final) {
+    std::string text = std::move(carry);
+    carry.clear();
+    ring.read_all(text);
+    text += tail;
+    if (!final) {
+      const size_t complete = llama_wrapper::utf8_complete_length(text.data(), text.size());
+      carry = text.substr(complete);
+      text.resize(complete);
+    }
+    if (!text.empty()) {
+      on_token.Call({Napi::String::New(env, text)});
+    }
+  }
 
-    // Release the thread-safe function
-    tsfn_.Release();
+  Napi::FunctionReference on_token;
+  llama_wrapper::ByteRing ring{64 * 1024};
+  const std::chrono::milliseconds flush_interval;
+  const int flush_tokens;
+  std::atomic<bool> flush_scheduled{false};
 
-    // Final callback with result
-    Napi::Object result = Napi::Object::New(Env());
-    result.Set("text", Napi::String::New(Env(), result_.text));
-    result.Set("promptTokens", Napi::Number::New(Env(), result_.prompt_tokens));
-    result.Set("completionTokens", Napi::Number::New(Env(), result_.completion_tokens));
-    result.Set("finishReason", Napi::String::New(Env(), result_.finish_reason));
+  // Scheduler thread only
+  std::string staged;
+  int pending_tokens = 0;
+  std::chrono::steady_clock::time_point last_flush{};
 
-    Callback().Call({Env().Null(), result});
-  }
+  // JavaScript thread only
+  std::string carry;
+};
 
-  void OnError(const Napi::Error &e) override {
-    Napi::HandleScope scope(Env());
+// Final result of a stream together with the text that never reached the ring
+struct StreamDone {
+  llama_wrapper::GenerationResult result;
+  std::string tail;
+};
 
-    // Release the thread-safe function
-    tsfn_.Release();
+static Napi::Object TimingsToJs(Napi::Env env, const llama_wrapper::GenerationTimings &timings) {
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("queueMs", Napi::Number::New(env, timings.queue_ms));
+  result.Set("templateMs", Napi::Number::New(env, timings.template_ms));
+  result.Set("tokenizeMs", Napi::Number::New(env, timings.tokenize_ms));
+  result.Set("prefillMs", Napi::Number::New(env, timings.prefill_ms));
+  result.Set("decodeMs", Napi::Number::New(env, timings.decode_ms));
+  result.Set("evalMs", Napi::Number::New(env, timings.eval_ms));
+  result.Set("sampleMs", Napi::Number::New(env, timings.sample_ms));
+  result.Set("callbackMs", Napi::Number::New(env, timings.callback_ms));
+  result.Set("timeToFirstTokenMs", Napi::Number::New(env, timings.ttft_ms));
+  result.Set("totalMs", Napi::Number::New(env, timings.total_ms));
+  return result;
+}
 
-    // Call the callback with error
-    Callback().Call({Napi::String::New(Env(), e.Message()), Env().Null()});
-  }
+// Copy of token ids as an Int32Array
+static Napi::Int32Array TokensToJs(Napi::Env env, const std::vector<int32_t> &tokens) {
+  Napi::Int32Array array = Napi::Int32Array::New(env, tokens.size());
+  std::copy(tokens.begin(), tokens.end(), array.Data());
+  return array;
+}
 
-private:
-  int handle_;
-  std::vector<llama_wrapper::ChatMessage> messages_;
-  llama_wrapper::GenerationParams params_;
-  llama_wrapper::GenerationResult result_;
-  Napi::ThreadSafeFunction tsfn_;
-};
+// Token ids of an Int32Array
+static std::vector<int32_t> TokensFromJs(Napi::Value value) {
+  Napi::Int32Array array = value.As<Napi::Int32Array>();
+  return std::vector<int32_t>(array.Data(), array.Data() + array.ElementLength());
+}
 
-class EmbedWorker : public Napi::AsyncWorker {
-public:
-  EmbedWorker(Napi::Function &callback, int handle, const std::vector<std::string> &texts)
-      : Napi::AsyncWorker(callback), handle_(handle), texts_(texts) {}
+static bool IsTokenArray(Napi::Value value) {
+  return value.IsTypedArray() &&
+         value.As<Napi::TypedArray>().TypedArrayType() == napi_int32_array;
+}
 
-  void Execute() override {
-    llama_wrapper::LlamaModel *model = nullptr;
+// with_tokens adds the generated token ids of requests with return_tokens
+static Napi::Value GenerationResultToJs(Napi::Env env, llama_wrapper::GenerationResult &result_,
+                                        std::string &error, bool with_tokens) {
+  if (!result_.error.empty()) {
+    error = result_.error;
+    return env.Null();
+  }
 
-    {
-      std::lock_guard<std::mutex> lock(g_models_mutex);
-      auto it = g_models.find(handle_);
-      if (it == g_models.end()) {
-        SetError("Invalid model handle");
-        return;
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("text", Napi::String::New(env, result_.text));
+  result.Set("promptTokens", Napi::Number::New(env, result_.prompt_tokens));
+  result.Set("completionTokens", Napi::Number::New(env, result_.completion_tokens));
+  result.Set("cachedPromptTokens", Napi::Number::New(env, result_.cached_tokens));
+  result.Set("draftTokens", Napi::Number::New(env, result_.draft_tokens));
+  result.Set("acceptedDraftTokens", Napi::Number::New(env, result_.accepted_tokens));
+  result.Set("discardedTokens", Napi::Number::New(env, result_.discarded_tokens));
+  result.Set("finishReason", Napi::String::New(env, result_.finish_reason));
+  result.Set("timings", TimingsToJs(env, result_.timings));
+  if (with_tokens) {
+    result.Set("tokens", TokensToJs(env, result_.tokens));
+  }
+  if (!result_.choices.empty()) {
+    Napi::Array choices = Napi::Array::New(env, result_.choices.size());
+    for (size_t i = 0; i < result_.choices.size(); i++) {
+      const llama_wrapper::GenerationChoice &choice_ = result_.choices[i];
+      Napi::Object choice = Napi::Object::New(env);
+      choice.Set("text", Napi::String::New(env, choice_.text));
+      choice.Set("completionTokens", Napi::Number::New(env, choice_.completion_tokens));
+      choice.Set("finishReason", Napi::String::New(env, choice_.finish_reason));
+      if (with_tokens) {
+        choice.Set("tokens", TokensToJs(env, choice_.tokens));
       }
-      model = it->second.get();
+      choices.Set(static_cast<uint32_t>(i), choice);
     }
+    result.Set("choices", choices);
+  }
+  return result;
+}
 
-    result_ = model->embed(texts_);
+static const char *EncodingName(llama_wrapper::EmbeddingEncoding encoding) {
+  switch (encoding) {
+  case llama_wrapper::EmbeddingEncoding::FLOAT16:
+    return "float16";
+  case llama_wrapper::EmbeddingEncoding::INT8:
+    return "int8";
+  case llama_wrapper::EmbeddingEncoding::BINARY:
+    return "binary";
+  case llama_wrapper::EmbeddingEncoding::FLOAT32:
+  default:
+    return "float32";
+  }
+}
 
-    if (result_.embeddings.empty() && !texts_.empty()) {
-      SetError("Failed to generate embeddings");
-      return;
-    }
+// Typed array matching the encoding over [offset, offset + bytes) of buffer
+static Napi::Value EmbeddingView(Napi::Env env, llama_wrapper::EmbeddingEncoding encoding,
+                                 Napi::ArrayBuffer &buffer, size_t offset, size_t bytes) {
+  switch (encoding) {
+  case llama_wrapper::EmbeddingEncoding::FLOAT16:
+    return Napi::Uint16Array::New(env, bytes / sizeof(uint16_t), buffer, offset);
+  case llama_wrapper::EmbeddingEncoding::INT8:
+    return Napi::Int8Array::New(env, bytes, buffer, offset);
+  case llama_wrapper::EmbeddingEncoding::BINARY:
+    return Napi::Uint8Array::New(env, bytes, buffer, offset);
+  case llama_wrapper::EmbeddingEncoding::FLOAT32:
+  default:
+    return Napi::Float32Array::New(env, bytes / sizeof(float), buffer, offset);
   }
+}
 
-  void OnOK() override {
-    Napi::HandleScope scope(Env());
+static Napi::Value EmbeddingResultToJs(Napi::Env env, llama_wrapper::EmbeddingResult &result_) {
+  const size_t n_embd = result_.n_embd;
+  const size_t row_bytes = result_.row_bytes;
+  const size_t n_rows = row_bytes > 0 ? result_.data.size() / row_bytes : 0;
+
+  // Hand the native buffer to JavaScript without copying: the ArrayBuffer
+  // owns the vector and frees it when garbage collected
+  Napi::ArrayBuffer buffer;
+  if (result_.data.empty()) {
+    buffer = Napi::ArrayBuffer::New(env, 0);
+  } else {
+    auto *data = new std::vector<uint8_t>(std::move(result_.data));
+    buffer = Napi::ArrayBuffer::New(env, data->data(), data->size(),
+                                    [](Napi::Env, void *, std::vector<uint8_t> *hint) {
+                                      delete hint;
+                                    },
+                                    data);
+  }
 
-    // Create embeddings array
-    Napi::Array embeddings_arr = Napi::Array::New(Env(), result_.embeddings.size());
-    for (size_t i = 0; i < result_.embeddings.size(); i++) {
-      const auto &emb = result_.embeddings[i];
-      Napi::Float32Array embedding = Napi::Float32Array::New(Env(), emb.size());
-      for (size_t j = 0; j < emb.size(); j++) {
-        embedding[j] = emb[j];
-      }
-      embeddings_arr.Set(i, embedding);
-    }
+  // One view per embedding into the shared buffer
+  Napi::Array embeddings_arr = Napi::Array::New(env, n_rows);
+  for (size_t i = 0; i < n_rows; i++) {
+    embeddings_arr.Set(i, EmbeddingView(env, result_.encoding, buffer, i * row_bytes, row_bytes));
+  }
 
-    Napi::Object result = Napi::Object::New(Env());
-    result.Set("embeddings", embeddings_arr);
-    result.Set("totalTokens", Napi::Number::New(Env(), result_.total_tokens));
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("embeddings", embeddings_arr);
+  result.Set("data", EmbeddingView(env, result_.encoding, buffer, 0, n_rows * row_bytes));
+  result.Set("encoding", Napi::String::New(env, EncodingName(result_.encoding)));
+  result.Set("dimensions", Napi::Number::New(env, n_embd));
+  if (result_.encoding == llama_wrapper::EmbeddingEncoding::INT8) {
+    Napi::Float32Array scales = Napi::Float32Array::New(env, result_.scales.size());
+    std::copy(result_.scales.begin(), result_.scales.end(), scales.Data());
+    result.Set("scales", scales);
+  }
+  result.Set("totalTokens", Napi::Number::New(env, result_.total_tokens));
+  Napi::Object timings = Napi::Object::New(env);
+  timings.Set("tokenizeMs", Napi::Number::New(env, result_.tokenize_ms));
+  timings.Set("evalMs", Napi::Number::New(env, result_.eval_ms));
+  timings.Set("totalMs", Napi::Number::New(env, result_.total_ms));
+  result.Set("timings", timings);
+  return result;
+}
 
-    Callback().Call({Env().Null(), result});
+static Napi::Value SessionResultToJs(Napi::Env env, llama_wrapper::SessionResult &result_,
+                                     std::string &error, const std::string &failure) {
+  if (!result_.error.empty() || !result_.success) {
+    error = !result_.error.empty() ? result_.error : failure;
+    return env.Null();
   }
 
-private:
-  int handle_;
-  std::vector<std::string> texts_;
-  llama_wrapper::EmbeddingResult result_;
-};
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("tokens", Napi::Number::New(env, result_.n_tokens));
+  return result;
+}
+
+// Fail a request whose model handle is unknown
+static Napi::Value InvalidHandle(Napi::Env env, Napi::Function callback) {
+  callback.Call({Napi::String::New(env, "Invalid model handle"), env.Null()});
+  return env.Undefined();
+}
 
 // ============================================================================
 // N-API Functions
 // ============================================================================
 
+// Helper function to parse context options shared by loadModel and createContext
+static llama_wrapper::ContextParams ParseContextParams(Napi::Object options) {
+  llama_wrapper::ContextParams ctx_params;
+  if (options.Has("contextSize") && options.Get("contextSize").IsNumber()) {
+    ctx_params.n_ctx = options.Get("contextSize").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("batchSize") && options.Get("batchSize").IsNumber()) {
+    ctx_params.n_batch = options.Get("batchSize").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("ubatchSize") && options.Get("ubatchSize").IsNumber()) {
+    ctx_params.n_ubatch = options.Get("ubatchSize").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("threads") && options.Get("threads").IsNumber()) {
+    ctx_params.n_threads = options.Get("threads").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("threadsBatch") && options.Get("threadsBatch").IsNumber()) {
+    ctx_params.n_threads_batch = options.Get("threadsBatch").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("cacheTypeK") && options.Get("cacheTypeK").IsString()) {
+    ctx_params.type_k = options.Get("cacheTypeK").As<Napi::String>().Utf8Value();
+  }
+  if (options.Has("cacheTypeV") && options.Get("cacheTypeV").IsString()) {
+    ctx_params.type_v = options.Get("cacheTypeV").As<Napi::String>().Utf8Value();
+  }
+  if (options.Has("flashAttention") && options.Get("flashAttention").IsString()) {
+    ctx_params.flash_attn = options.Get("flashAttention").As<Napi::String>().Utf8Value();
+  }
+  if (options.Has("parallelSequences") && options.Get("parallelSequences").IsNumber()) {
+    ctx_params.n_seq_max = options.Get("parallelSequences").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("maxQueueSize") && options.Get("maxQueueSize").IsNumber()) {
+    ctx_params.max_queue = options.Get("maxQueueSize").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("draftTokens") && options.Get("draftTokens").IsNumber()) {
+    ctx_params.n_draft = options.Get("draftTokens").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("lookupNgramSize") && options.Get("lookupNgramSize").IsNumber()) {
+    ctx_params.n_lookup = options.Get("lookupNgramSize").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("embedding") && options.Get("embedding").IsBoolean()) {
+    ctx_params.embedding = options.Get("embedding").As<Napi::Boolean>().Value();
+  }
+  if (options.Has("warmup") && options.Get("warmup").IsBoolean()) {
+    ctx_params.warmup = options.Get("warmup").As<Napi::Boolean>().Value();
+  }
+  if (options.Has("loraAdapters") && options.Get("loraAdapters").IsArray()) {
+    Napi::Array adapters_arr = options.Get("loraAdapters").As<Napi::Array>();
+    for (uint32_t i = 0; i < adapters_arr.Length(); i++) {
+      Napi::Object adapter = adapters_arr.Get(i).As<Napi::Object>();
+      ctx_params.lora_adapters.emplace_back(adapter.Get("name").As<Napi::String>().Utf8Value(),
+                                            adapter.Get("path").As<Napi::String>().Utf8Value());
+    }
+  }
+  return ctx_params;
+}
+
 Napi::Value LoadModel(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
@@ -260,23 +490,76 @@ Napi::Value LoadModel(const Napi::CallbackInfo &info) {
   Napi::Object options = info[0].As<Napi::Object>();
   Napi::Function callback = info[1].As<Napi::Function>();
 
-  std::string model_path = options.Get("modelPath").As<Napi::String>().Utf8Value();
-  int n_gpu_layers =
+  llama_wrapper::ModelParams model_params;
+  model_params.model_path = options.Get("modelPath").As<Napi::String>().Utf8Value();
+  model_params.n_gpu_layers =
       options.Has("gpuLayers") ? options.Get("gpuLayers").As<Napi::Number>().Int32Value() : 99;
-  int n_ctx = options.Has("contextSize")
-                  ? options.Get("contextSize").As<Napi::Number>().Int32Value()
-                  : 2048;
-  int n_threads =
-      options.Has("threads") ? options.Get("threads").As<Napi::Number>().Int32Value() : 4;
-  bool debug = options.Has("debug") ? options.Get("debug").As<Napi::Boolean>().Value() : false;
-  std::string chat_template = options.Has("chatTemplate")
-                                  ? options.Get("chatTemplate").As<Napi::String>().Utf8Value()
-                                  : "auto";
-  bool embedding =
-      options.Has("embedding") ? options.Get("embedding").As<Napi::Boolean>().Value() : false;
-
-  auto worker = new LoadModelWorker(callback, model_path, n_gpu_layers, n_ctx, n_threads, debug,
-                                    chat_template, embedding);
+  model_params.debug =
+      options.Has("debug") ? options.Get("debug").As<Napi::Boolean>().Value() : false;
+  model_params.chat_template = options.Has("chatTemplate")
+                                   ? options.Get("chatTemplate").As<Napi::String>().Utf8Value()
+                                   : "auto";
+  if (options.Has("draftModelPath") && options.Get("draftModelPath").IsString()) {
+    model_params.draft_model_path = options.Get("draftModelPath").As<Napi::String>().Utf8Value();
+  }
+  if (options.Has("prefetch") && options.Get("prefetch").IsBoolean()) {
+    model_params.prefetch = options.Get("prefetch").As<Napi::Boolean>().Value();
+  }
+  if (options.Has("useMmap") && options.Get("useMmap").IsBoolean()) {
+    model_params.use_mmap = options.Get("useMmap").As<Napi::Boolean>().Value();
+  }
+  if (options.Has("useMlock") && options.Get("useMlock").IsBoolean()) {
+    model_params.use_mlock = options.Get("useMlock").As<Napi::Boolean>().Value();
+  }
+  if (options.Has("splitMode") && options.Get("splitMode").IsString()) {
+    model_params.split_mode = options.Get("splitMode").As<Napi::String>().Utf8Value();
+  }
+  if (options.Has("mainGpu") && options.Get("mainGpu").IsNumber()) {
+    model_params.main_gpu = options.Get("mainGpu").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("tensorSplit") && options.Get("tensorSplit").IsArray()) {
+    Napi::Array split = options.Get("tensorSplit").As<Napi::Array>();
+    for (uint32_t i = 0; i < split.Length(); i++) {
+      model_params.tensor_split.push_back(split.Get(i).As<Napi::Number>().FloatValue());
+    }
+  }
+  if (options.Has("devices") && options.Get("devices").IsArray()) {
+    Napi::Array devices = options.Get("devices").As<Napi::Array>();
+    for (uint32_t i = 0; i < devices.Length(); i++) {
+      model_params.devices.push_back(devices.Get(i).As<Napi::String>().Utf8Value());
+    }
+  }
+  if (options.Has("numa") && options.Get("numa").IsString()) {
+    model_params.numa = options.Get("numa").As<Napi::String>().Utf8Value();
+  }
+  Napi::Function progress;
+  if (options.Has("onProgress") && options.Get("onProgress").IsFunction()) {
+    progress = options.Get("onProgress").As<Napi::Function>();
+  }
+
+  auto worker = new LoadModelWorker(callback, model_params, ParseContextParams(options), nullptr,
+                                    progress);
+  worker->Queue();
+
+  return env.Undefined();
+}
+
+Napi::Value CreateContext(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsObject() || !info[2].IsFunction()) {
+    Napi::TypeError::New(env, "Expected (handle, options, callback)").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Function callback = info[2].As<Napi::Function>();
+  auto model = FindModel(info[0].As<Napi::Number>().Int32Value());
+  if (!model) {
+    return InvalidHandle(env, callback);
+  }
+
+  auto worker = new LoadModelWorker(callback, llama_wrapper::ModelParams(),
+                                    ParseContextParams(info[1].As<Napi::Object>()), model);
   worker->Queue();
 
   return env.Undefined();
@@ -292,13 +575,20 @@ Napi::Value UnloadModel(const Napi::CallbackInfo &info) {
 
   int handle = info[0].As<Napi::Number>().Int32Value();
 
+  // Queued and running requests fail with "Model was unloaded" once the last
+  // reference is dropped
+  std::shared_ptr<llama_wrapper::LlamaModel> model;
   {
     std::lock_guard<std::mutex> lock(g_models_mutex);
     auto it = g_models.find(handle);
     if (it != g_models.end()) {
+      model = std::move(it->second);
       g_models.erase(it);
     }
   }
+  if (model) {
+    (new ReleaseModelWorker(env, std::move(model)))->Queue();
+  }
 
   return Napi::Boolean::New(env, true);
 }
@@ -316,26 +606,43 @@ std::vector<llama_wrapper::ChatMessage> ParseMessages(Napi::Array messages_arr)
   return messages;
 }
 
-Napi::Value Generate(const Napi::CallbackInfo &info) {
-  Napi::Env env = info.Env();
+// The prompt of generate and generateStream: chat messages, or the tokens of
+// an already rendered prompt
+struct Prompt {
+  std::vector<llama_wrapper::ChatMessage> messages;
+  std::vector<int32_t> tokens;
+  bool tokenized = false;
+};
 
-  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsObject() || !info[2].IsFunction()) {
-    Napi::TypeError::New(env, "Expected (handle, options, callback)").ThrowAsJavaScriptException();
-    return env.Null();
+// Parse the prompt, throwing a TypeError if there is none
+static bool ParsePrompt(Napi::Env env, Napi::Object options, Prompt &prompt) {
+  if (options.Has("promptTokens") && IsTokenArray(options.Get("promptTokens"))) {
+    prompt.tokens = TokensFromJs(options.Get("promptTokens"));
+    prompt.tokenized = true;
+    return true;
   }
-
-  int handle = info[0].As<Napi::Number>().Int32Value();
-  Napi::Object options = info[1].As<Napi::Object>();
-  Napi::Function callback = info[2].As<Napi::Function>();
-
-  // Parse messages array
   if (!options.Has("messages") || !options.Get("messages").IsArray()) {
-    Napi::TypeError::New(env, "Expected messages array in options").ThrowAsJavaScriptException();
-    return env.Null();
+    Napi::TypeError::New(env, "Expected messages array or promptTokens Int32Array in options")
+        .ThrowAsJavaScriptException();
+    return false;
   }
-  std::vector<llama_wrapper::ChatMessage> messages =
-      ParseMessages(options.Get("messages").As<Napi::Array>());
+  prompt.messages = ParseMessages(options.Get("messages").As<Napi::Array>());
+  return true;
+}
+
+static llama_wrapper::RequestId SubmitGeneration(llama_wrapper::LlamaModel &model, Prompt &prompt,
+                                                 const llama_wrapper::GenerationParams &params,
+                                                 llama_wrapper::TokenCallback callback,
+                                                 llama_wrapper::GenerationDoneCallback on_done) {
+  if (prompt.tokenized) {
+    return model.generate_tokens_async(std::move(prompt.tokens), params, std::move(callback),
+                                       std::move(on_done));
+  }
+  return model.generate_async(prompt.messages, params, std::move(callback), std::move(on_done));
+}
 
+// Helper function to parse generation options shared by generate and generateStream
+llama_wrapper::GenerationParams ParseGenerationParams(Napi::Object options) {
   llama_wrapper::GenerationParams params;
   params.max_tokens =
       options.Has("maxTokens") ? options.Get("maxTokens").As<Napi::Number>().Int32Value() : 256;
@@ -345,6 +652,29 @@ Napi::Value Generate(const Napi::CallbackInfo &info) {
   params.top_p = options.Has("topP") ? options.Get("topP").As<Napi::Number>().FloatValue() : 0.9f;
   params.top_k = options.Has("topK") ? options.Get("topK").As<Napi::Number>().Int32Value() : 40;
 
+  // Optional sampling stages, disabled unless set
+  if (options.Has("minP") && options.Get("minP").IsNumber()) {
+    params.min_p = options.Get("minP").As<Napi::Number>().FloatValue();
+  }
+  if (options.Has("typicalP") && options.Get("typicalP").IsNumber()) {
+    params.typical_p = options.Get("typicalP").As<Napi::Number>().FloatValue();
+  }
+  if (options.Has("repeatPenalty") && options.Get("repeatPenalty").IsNumber()) {
+    params.repeat_penalty = options.Get("repeatPenalty").As<Napi::Number>().FloatValue();
+  }
+  if (options.Has("frequencyPenalty") && options.Get("frequencyPenalty").IsNumber()) {
+    params.frequency_penalty = options.Get("frequencyPenalty").As<Napi::Number>().FloatValue();
+  }
+  if (options.Has("presencePenalty") && options.Get("presencePenalty").IsNumber()) {
+    params.presence_penalty = options.Get("presencePenalty").As<Napi::Number>().FloatValue();
+  }
+  if (options.Has("penaltyLastN") && options.Get("penaltyLastN").IsNumber()) {
+    params.penalty_last_n = options.Get("penaltyLastN").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("seed") && options.Get("seed").IsNumber()) {
+    params.seed = options.Get("seed").As<Napi::Number>().Int64Value();
+  }
+
   if (options.Has("stopSequences") && options.Get("stopSequences").IsArray()) {
     Napi::Array stop_arr = options.Get("stopSequences").As<Napi::Array>();
     for (uint32_t i = 0; i < stop_arr.Length(); i++) {
@@ -356,10 +686,82 @@ Napi::Value Generate(const Napi::CallbackInfo &info) {
     params.grammar = options.Get("grammar").As<Napi::String>().Utf8Value();
   }
 
-  auto worker = new GenerateWorker(callback, handle, messages, params);
-  worker->Queue();
+  if (options.Has("priority") && options.Get("priority").IsNumber()) {
+    params.priority = options.Get("priority").As<Napi::Number>().Int32Value();
+  }
 
-  return env.Undefined();
+  if (options.Has("timeoutMs") && options.Get("timeoutMs").IsNumber()) {
+    params.timeout_ms = options.Get("timeoutMs").As<Napi::Number>().Int32Value();
+  }
+
+  if (options.Has("n") && options.Get("n").IsNumber()) {
+    params.n = options.Get("n").As<Napi::Number>().Int32Value();
+  }
+
+  if (options.Has("returnTokens") && options.Get("returnTokens").IsBoolean()) {
+    params.return_tokens = options.Get("returnTokens").As<Napi::Boolean>().Value();
+  }
+
+  // LoRA adapters by name, each with a scale (default: 1)
+  if (options.Has("lora") && options.Get("lora").IsArray()) {
+    Napi::Array lora_arr = options.Get("lora").As<Napi::Array>();
+    for (uint32_t i = 0; i < lora_arr.Length(); i++) {
+      Napi::Object adapter = lora_arr.Get(i).As<Napi::Object>();
+      float scale = 1.0f;
+      if (adapter.Has("scale") && adapter.Get("scale").IsNumber()) {
+        scale = adapter.Get("scale").As<Napi::Number>().FloatValue();
+      }
+      params.lora.emplace_back(adapter.Get("name").As<Napi::String>().Utf8Value(), scale);
+    }
+  }
+
+  if (options.Has("contextOverflow") && options.Get("contextOverflow").IsString()) {
+    std::string overflow = options.Get("contextOverflow").As<Napi::String>().Utf8Value();
+    if (overflow == "shift") {
+      params.overflow = llama_wrapper::ContextOverflow::SHIFT;
+    } else if (overflow == "truncate-middle") {
+      params.overflow = llama_wrapper::ContextOverflow::TRUNCATE_MIDDLE;
+    }
+  }
+
+  return params;
+}
+
+Napi::Value Generate(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsObject() || !info[2].IsFunction()) {
+    Napi::TypeError::New(env, "Expected (handle, options, callback)").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  int handle = info[0].As<Napi::Number>().Int32Value();
+  Napi::Object options = info[1].As<Napi::Object>();
+  Napi::Function callback = info[2].As<Napi::Function>();
+
+  Prompt prompt;
+  if (!ParsePrompt(env, options, prompt)) {
+    return env.Null();
+  }
+
+  llama_wrapper::GenerationParams params = ParseGenerationParams(options);
+  const bool with_tokens = params.return_tokens;
+  auto to_js = [with_tokens](Napi::Env env, llama_wrapper::GenerationResult &result,
+                             std::string &error) {
+    return GenerationResultToJs(env, result, error, with_tokens);
+  };
+
+  auto model = FindModel(handle);
+  if (!model) {
+    return InvalidHandle(env, callback);
+  }
+
+  auto tsfn = Napi::ThreadSafeFunction::New(env, callback, "Generate", 0, 1);
+  llama_wrapper::RequestId id = SubmitGeneration(
+      *model, prompt, params, nullptr, Completion<llama_wrapper::GenerationResult>(tsfn, to_js));
+
+  // Request id for cancel()
+  return Napi::Number::New(env, static_cast<double>(id));
 }
 
 Napi::Value GenerateStream(const Napi::CallbackInfo &info) {
@@ -377,43 +779,170 @@ Napi::Value GenerateStream(const Napi::CallbackInfo &info) {
   Napi::Function token_callback = info[2].As<Napi::Function>();
   Napi::Function done_callback = info[3].As<Napi::Function>();
 
-  // Parse messages array
+  Prompt prompt;
+  if (!ParsePrompt(env, options, prompt)) {
+    return env.Null();
+  }
+
+  llama_wrapper::GenerationParams params = ParseGenerationParams(options);
+  const bool with_tokens = params.return_tokens;
+  auto to_js = [with_tokens](Napi::Env env, llama_wrapper::GenerationResult &result,
+                             std::string &error) {
+    return GenerationResultToJs(env, result, error, with_tokens);
+  };
+
+  auto model = FindModel(handle);
+  if (!model) {
+    return InvalidHandle(env, done_callback);
+  }
+
+  // Token flush budget: every flushIntervalMs or flushTokens tokens, whichever comes first
+  int flush_interval_ms = 16;
+  int flush_tokens = 32;
+  if (options.Has("flushIntervalMs") && options.Get("flushIntervalMs").IsNumber()) {
+    flush_interval_ms = options.Get("flushIntervalMs").As<Napi::Number>().Int32Value();
+  }
+  if (options.Has("flushTokens") && options.Get("flushTokens").IsNumber()) {
+    flush_tokens = options.Get("flushTokens").As<Napi::Number>().Int32Value();
+  }
+
+  // Token flushes and the final result share one thread-safe function so that
+  // the done callback always runs after the last token callback
+  auto *stream = new TokenStream(token_callback, flush_interval_ms, flush_tokens);
+  Napi::ThreadSafeFunction tsfn = Napi::ThreadSafeFunction::New(
+      env, done_callback, "GenerateStream",
+      0, // Unlimited queue size
+      1, // Initial thread count
+      stream, [](Napi::Env, TokenStream *stream) { delete stream; });
+
+  llama_wrapper::RequestId id = SubmitGeneration(
+      *model, prompt, params,
+      [tsfn, stream](std::string_view token) { return stream->push(token, tsfn); },
+      [tsfn, stream, to_js](llama_wrapper::GenerationResult result) {
+        auto *done = new StreamDone{std::move(result), std::move(stream->staged)};
+        tsfn.NonBlockingCall(done, [stream, to_js](Napi::Env env, Napi::Function callback,
+                                                   StreamDone *data) {
+          std::unique_ptr<StreamDone> done(data);
+          stream->drain(env, done->tail, true);
+          CallWithResult<llama_wrapper::GenerationResult>(env, callback, done->result, to_js);
+        });
+        tsfn.Release();
+      });
+
+  // Request id for cancel()
+  return Napi::Number::New(env, static_cast<double>(id));
+}
+
+Napi::Value SaveSession(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsObject() || !info[2].IsFunction()) {
+    Napi::TypeError::New(env, "Expected (handle, options, callback)").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  int handle = info[0].As<Napi::Number>().Int32Value();
+  Napi::Object options = info[1].As<Napi::Object>();
+  Napi::Function callback = info[2].As<Napi::Function>();
+
+  if (!options.Has("path") || !options.Get("path").IsString()) {
+    Napi::TypeError::New(env, "Expected path string in options").ThrowAsJavaScriptException();
+    return env.Null();
+  }
   if (!options.Has("messages") || !options.Get("messages").IsArray()) {
     Napi::TypeError::New(env, "Expected messages array in options").ThrowAsJavaScriptException();
     return env.Null();
   }
+
+  std::string path = options.Get("path").As<Napi::String>().Utf8Value();
   std::vector<llama_wrapper::ChatMessage> messages =
       ParseMessages(options.Get("messages").As<Napi::Array>());
 
-  llama_wrapper::GenerationParams params;
-  params.max_tokens =
-      options.Has("maxTokens") ? options.Get("maxTokens").As<Napi::Number>().Int32Value() : 256;
-  params.temperature = options.Has("temperature")
-                           ? options.Get("temperature").As<Napi::Number>().FloatValue()
-                           : 0.7f;
-  params.top_p = options.Has("topP") ? options.Get("topP").As<Napi::Number>().FloatValue() : 0.9f;
-  params.top_k = options.Has("topK") ? options.Get("topK").As<Napi::Number>().Int32Value() : 40;
+  auto model = FindModel(handle);
+  if (!model) {
+    return InvalidHandle(env, callback);
+  }
 
-  if (options.Has("stopSequences") && options.Get("stopSequences").IsArray()) {
-    Napi::Array stop_arr = options.Get("stopSequences").As<Napi::Array>();
-    for (uint32_t i = 0; i < stop_arr.Length(); i++) {
-      params.stop_sequences.push_back(stop_arr.Get(i).As<Napi::String>().Utf8Value());
-    }
+  auto to_js = [path](Napi::Env env, llama_wrapper::SessionResult &result, std::string &error) {
+    return SessionResultToJs(env, result, error, "Failed to save session to: " + path);
+  };
+  auto tsfn = Napi::ThreadSafeFunction::New(env, callback, "SaveSession", 0, 1);
+  model->save_session_async(path, messages,
+                            Completion<llama_wrapper::SessionResult>(tsfn, to_js));
+
+  return env.Undefined();
+}
+
+Napi::Value LoadSession(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsObject() || !info[2].IsFunction()) {
+    Napi::TypeError::New(env, "Expected (handle, options, callback)").ThrowAsJavaScriptException();
+    return env.Null();
   }
 
-  if (options.Has("grammar") && options.Get("grammar").IsString()) {
-    params.grammar = options.Get("grammar").As<Napi::String>().Utf8Value();
+  int handle = info[0].As<Napi::Number>().Int32Value();
+  Napi::Object options = info[1].As<Napi::Object>();
+  Napi::Function callback = info[2].As<Napi::Function>();
+
+  if (!options.Has("path") || !options.Get("path").IsString()) {
+    Napi::TypeError::New(env, "Expected path string in options").ThrowAsJavaScriptException();
+    return env.Null();
   }
 
-  // Create thread-safe function for streaming tokens to JavaScript
-  Napi::ThreadSafeFunction tsfn =
-      Napi::ThreadSafeFunction::New(env, token_callback, "TokenCallback",
-                                    0, // Unlimited queue size
-                                    1  // Initial thread count
-      );
+  std::string path = options.Get("path").As<Napi::String>().Utf8Value();
 
-  auto worker = new StreamGenerateWorker(done_callback, handle, messages, params, tsfn);
-  worker->Queue();
+  auto model = FindModel(handle);
+  if (!model) {
+    return InvalidHandle(env, callback);
+  }
+
+  auto to_js = [path](Napi::Env env, llama_wrapper::SessionResult &result, std::string &error) {
+    return SessionResultToJs(env, result, error, "Failed to load session from: " + path);
+  };
+  auto tsfn = Napi::ThreadSafeFunction::New(env, callback, "LoadSession", 0, 1);
+  model->load_session_async(path, Completion<llama_wrapper::SessionResult>(tsfn, to_js));
+
+  return env.Undefined();
+}
+
+Napi::Value LoadLoraAdapter(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsObject() || !info[2].IsFunction()) {
+    Napi::TypeError::New(env, "Expected (handle, options, callback)").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  int handle = info[0].As<Napi::Number>().Int32Value();
+  Napi::Object options = info[1].As<Napi::Object>();
+  Napi::Function callback = info[2].As<Napi::Function>();
+
+  if (!options.Has("name") || !options.Get("name").IsString() || !options.Has("path") ||
+      !options.Get("path").IsString()) {
+    Napi::TypeError::New(env, "Expected name and path strings in options")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  std::string name = options.Get("name").As<Napi::String>().Utf8Value();
+  std::string path = options.Get("path").As<Napi::String>().Utf8Value();
+
+  auto model = FindModel(handle);
+  if (!model) {
+    return InvalidHandle(env, callback);
+  }
+
+  auto to_js = [](Napi::Env env, llama_wrapper::LoraAdapterResult &result,
+                  std::string &error) -> Napi::Value {
+    if (!result.success) {
+      error = result.error.empty() ? "Failed to load LoRA adapter" : result.error;
+      return env.Null();
+    }
+    return Napi::Boolean::New(env, true);
+  };
+  auto tsfn = Napi::ThreadSafeFunction::New(env, callback, "LoadLoraAdapter", 0, 1);
+  model->load_lora_adapter_async(std::move(name), std::move(path),
+                                 Completion<llama_wrapper::LoraAdapterResult>(tsfn, to_js));
 
   return env.Undefined();
 }
@@ -435,6 +964,173 @@ Napi::Value IsModelLoaded(const Napi::CallbackInfo &info) {
   return Napi::Boolean::New(env, loaded);
 }
 
+Napi::Value Cancel(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[0].IsNumber() || !info[1].IsNumber()) {
+    Napi::TypeError::New(env, "Expected (handle, requestId)").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  auto model = FindModel(info[0].As<Napi::Number>().Int32Value());
+  auto id = static_cast<llama_wrapper::RequestId>(info[1].As<Napi::Number>().Int64Value());
+
+  // False if the request already completed (or the model is gone)
+  return Napi::Boolean::New(env, model && model->cancel(id));
+}
+
+Napi::Value GetQueueLength(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Expected model handle").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  auto model = FindModel(info[0].As<Napi::Number>().Int32Value());
+  if (!model) {
+    Napi::Error::New(env, "Invalid model handle").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  llama_wrapper::QueueStats stats = model->queue_stats();
+
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("pending", Napi::Number::New(env, stats.pending));
+  result.Set("active", Napi::Number::New(env, stats.active));
+  return result;
+}
+
+static Napi::Object HistogramToJs(Napi::Env env,
+                                  const llama_wrapper::HistogramSnapshot &histogram) {
+  Napi::Array buckets = Napi::Array::New(env, histogram.bounds.size());
+  for (size_t i = 0; i < histogram.bounds.size(); i++) {
+    Napi::Object bucket = Napi::Object::New(env);
+    bucket.Set("le", Napi::Number::New(env, histogram.bounds[i]));
+    bucket.Set("count", Napi::Number::New(env, histogram.counts[i]));
+    buckets.Set(i, bucket);
+  }
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("buckets", buckets);
+  result.Set("count", Napi::Number::New(env, histogram.count));
+  result.Set("sum", Napi::Number::New(env, histogram.sum));
+  return result;
+}
+
+Napi::Value GetMetrics(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::TypeError::New(env, "Expected model handle").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  auto model = FindModel(info[0].As<Napi::Number>().Int32Value());
+  if (!model) {
+    Napi::Error::New(env, "Invalid model handle").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  const llama_wrapper::MetricsSnapshot metrics = model->get_metrics();
+
+  Napi::Object requests = Napi::Object::New(env);
+  for (const auto &entry : metrics.requests) {
+    requests.Set(entry.first, Napi::Number::New(env, entry.second));
+  }
+
+  Napi::Object seconds = Napi::Object::New(env);
+  seconds.Set("template", Napi::Number::New(env, metrics.template_seconds));
+  seconds.Set("tokenize", Napi::Number::New(env, metrics.tokenize_seconds));
+  seconds.Set("eval", Napi::Number::New(env, metrics.eval_seconds));
+  seconds.Set("draft", Napi::Number::New(env, metrics.draft_seconds));
+  seconds.Set("sample", Napi::Number::New(env, metrics.sample_seconds));
+  seconds.Set("callback", Napi::Number::New(env, metrics.callback_seconds));
+
+  Napi::Object histograms = Napi::Object::New(env);
+  histograms.Set("queueWait", HistogramToJs(env, metrics.queue_wait));
+  histograms.Set("timeToFirstToken", HistogramToJs(env, metrics.time_to_first_token));
+  histograms.Set("timePerOutputToken", HistogramToJs(env, metrics.time_per_output_token));
+  histograms.Set("requestDuration", HistogramToJs(env, metrics.request_duration));
+  histograms.Set("embeddingDuration", HistogramToJs(env, metrics.embedding_duration));
+
+  Napi::Object result = Napi::Object::New(env);
+  result.Set("requests", requests);
+  result.Set("promptTokens", Napi::Number::New(env, metrics.prompt_tokens));
+  result.Set("cachedPromptTokens", Napi::Number::New(env, metrics.cached_prompt_tokens));
+  result.Set("completionTokens", Napi::Number::New(env, metrics.completion_tokens));
+  result.Set("draftTokens", Napi::Number::New(env, metrics.draft_tokens));
+  result.Set("acceptedDraftTokens", Napi::Number::New(env, metrics.accepted_draft_tokens));
+  result.Set("discardedTokens", Napi::Number::New(env, metrics.discarded_tokens));
+  result.Set("embeddingRequests", Napi::Number::New(env, metrics.embedding_requests));
+  result.Set("embeddingTexts", Napi::Number::New(env, metrics.embedding_texts));
+  result.Set("embeddingTokens", Napi::Number::New(env, metrics.embedding_tokens));
+  result.Set("decodeSteps", Napi::Number::New(env, metrics.decode_steps));
+  result.Set("decodeTokens", Napi::Number::New(env, metrics.decode_tokens));
+  result.Set("seconds", seconds);
+  result.Set("histograms", histograms);
+  return result;
+}
+
+// Limit the memory of loaded weights across all models; idle models over the
+// budget are unloaded, least recently used first
+Napi::Value SetMemoryBudget(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 2 || !info[0].IsObject() || !info[1].IsFunction()) {
+    Napi::TypeError::New(env, "Expected (budget, callback)").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  Napi::Object options = info[0].As<Napi::Object>();
+  Napi::Function callback = info[1].As<Napi::Function>();
+  llama_wrapper::MemoryBudget budget;
+  if (options.Has("ramBytes") && options.Get("ramBytes").IsNumber()) {
+    budget.ram_bytes = static_cast<size_t>(
+        std::max(0.0, options.Get("ramBytes").As<Napi::Number>().DoubleValue()));
+  }
+  if (options.Has("vramBytes") && options.Get("vramBytes").IsNumber()) {
+    budget.vram_bytes = static_cast<size_t>(
+        std::max(0.0, options.Get("vramBytes").As<Napi::Number>().DoubleValue()));
+  }
+  (new SetMemoryBudgetWorker(callback, budget))->Queue();
+  return env.Undefined();
+}
+
+Napi::Value GetDevices(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  const std::vector<llama_wrapper::DeviceInfo> devices = llama_wrapper::list_devices();
+  Napi::Array result = Napi::Array::New(env, devices.size());
+  for (size_t i = 0; i < devices.size(); i++) {
+    Napi::Object device = Napi::Object::New(env);
+    device.Set("name", Napi::String::New(env, devices[i].name));
+    device.Set("description", Napi::String::New(env, devices[i].description));
+    device.Set("type", Napi::String::New(env, devices[i].type));
+    device.Set("freeBytes", Napi::Number::New(env, devices[i].free_bytes));
+    device.Set("totalBytes", Napi::Number::New(env, devices[i].total_bytes));
+    result.Set(i, device);
+  }
+  return result;
+}
+
+Napi::Value GetResidentModels(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  const std::vector<llama_wrapper::ResidentModel> models =
+      llama_wrapper::ModelRegistry::instance().resident();
+  Napi::Array result = Napi::Array::New(env, models.size());
+  for (size_t i = 0; i < models.size(); i++) {
+    Napi::Object model = Napi::Object::New(env);
+    model.Set("modelPath", Napi::String::New(env, models[i].model_path));
+    model.Set("ramBytes", Napi::Number::New(env, models[i].ram_bytes));
+    model.Set("vramBytes", Napi::Number::New(env, models[i].vram_bytes));
+    model.Set("contexts", Napi::Number::New(env, models[i].contexts));
+    model.Set("idleMs", Napi::Number::New(env, models[i].idle_ms));
+    result.Set(i, model);
+  }
+  return result;
+}
+
 Napi::Value Embed(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
@@ -447,20 +1143,179 @@ Napi::Value Embed(const Napi::CallbackInfo &info) {
   Napi::Object options = info[1].As<Napi::Object>();
   Napi::Function callback = info[2].As<Napi::Function>();
 
-  // Parse texts array
+  // Parse texts array, or the token arrays of already tokenized texts
+  std::vector<std::string> texts;
+  std::vector<std::vector<int32_t>> tokens;
+  const bool tokenized = options.Has("tokens") && options.Get("tokens").IsArray();
+  if (tokenized) {
+    Napi::Array tokens_arr = options.Get("tokens").As<Napi::Array>();
+    for (uint32_t i = 0; i < tokens_arr.Length(); i++) {
+      if (!IsTokenArray(tokens_arr.Get(i))) {
+        Napi::TypeError::New(env, "Expected tokens to be an array of Int32Array")
+            .ThrowAsJavaScriptException();
+        return env.Null();
+      }
+      tokens.push_back(TokensFromJs(tokens_arr.Get(i)));
+    }
+  } else if (!options.Has("texts") || !options.Get("texts").IsArray()) {
+    Napi::TypeError::New(env, "Expected texts or tokens array in options")
+        .ThrowAsJavaScriptException();
+    return env.Null();
+  } else {
+    Napi::Array texts_arr = options.Get("texts").As<Napi::Array>();
+    for (uint32_t i = 0; i < texts_arr.Length(); i++) {
+      texts.push_back(texts_arr.Get(i).As<Napi::String>().Utf8Value());
+    }
+  }
+
+  // Parse output encoding
+  auto encoding = llama_wrapper::EmbeddingEncoding::FLOAT32;
+  if (options.Has("encoding") && options.Get("encoding").IsString()) {
+    std::string name = options.Get("encoding").As<Napi::String>().Utf8Value();
+    if (name == "float16") {
+      encoding = llama_wrapper::EmbeddingEncoding::FLOAT16;
+    } else if (name == "int8") {
+      encoding = llama_wrapper::EmbeddingEncoding::INT8;
+    } else if (name == "binary") {
+      encoding = llama_wrapper::EmbeddingEncoding::BINARY;
+    } else if (name != "float32") {
+      Napi::TypeError::New(env, "Unknown embedding encoding: " + name)
+          .ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+
+  auto model = FindModel(handle);
+  if (!model) {
+    return InvalidHandle(env, callback);
+  }
+
+  const bool expect_data = !texts.empty() || !tokens.empty();
+  auto to_js = [expect_data](Napi::Env env, llama_wrapper::EmbeddingResult &result,
+                             std::string &error) -> Napi::Value {
+    if (expect_data && result.data.empty()) {
+      error = "Failed to generate embeddings";
+      return env.Null();
+    }
+    return EmbeddingResultToJs(env, result);
+  };
+  auto tsfn = Napi::ThreadSafeFunction::New(env, callback, "Embed", 0, 1);
+  if (tokenized) {
+    model->embed_tokens_async(std::move(tokens), encoding,
+                              Completion<llama_wrapper::EmbeddingResult>(tsfn, to_js));
+  } else {
+    model->embed_async(texts, encoding, Completion<llama_wrapper::EmbeddingResult>(tsfn, to_js));
+  }
+
+  return env.Undefined();
+}
+
+Napi::Value Tokenize(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsObject() || !info[2].IsFunction()) {
+    Napi::TypeError::New(env, "Expected (handle, options, callback)").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  int handle = info[0].As<Napi::Number>().Int32Value();
+  Napi::Object options = info[1].As<Napi::Object>();
+  Napi::Function callback = info[2].As<Napi::Function>();
+
   if (!options.Has("texts") || !options.Get("texts").IsArray()) {
     Napi::TypeError::New(env, "Expected texts array in options").ThrowAsJavaScriptException();
     return env.Null();
   }
-
   Napi::Array texts_arr = options.Get("texts").As<Napi::Array>();
   std::vector<std::string> texts;
   for (uint32_t i = 0; i < texts_arr.Length(); i++) {
     texts.push_back(texts_arr.Get(i).As<Napi::String>().Utf8Value());
   }
+  bool add_special = true;
+  if (options.Has("addSpecial") && options.Get("addSpecial").IsBoolean()) {
+    add_special = options.Get("addSpecial").As<Napi::Boolean>().Value();
+  }
 
-  auto worker = new EmbedWorker(callback, handle, texts);
-  worker->Queue();
+  auto model = FindModel(handle);
+  if (!model) {
+    return InvalidHandle(env, callback);
+  }
+
+  auto to_js = [](Napi::Env env, llama_wrapper::TokenizeResult &result,
+                  std::string &error) -> Napi::Value {
+    if (!result.success) {
+      error = "Failed to tokenize";
+      return env.Null();
+    }
+    // One view per text into a single buffer of all tokens
+    Napi::Int32Array all = TokensToJs(env, result.tokens);
+    Napi::ArrayBuffer buffer = all.ArrayBuffer();
+    const size_t n_texts = result.offsets.size() - 1;
+    Napi::Array tokens_arr = Napi::Array::New(env, n_texts);
+    for (size_t i = 0; i < n_texts; i++) {
+      tokens_arr.Set(i, Napi::Int32Array::New(env, result.offsets[i + 1] - result.offsets[i],
+                                              buffer, result.offsets[i] * sizeof(int32_t)));
+    }
+    return tokens_arr;
+  };
+  auto tsfn = Napi::ThreadSafeFunction::New(env, callback, "Tokenize", 0, 1);
+  model->tokenize_async(std::move(texts), add_special,
+                        Completion<llama_wrapper::TokenizeResult>(tsfn, to_js));
+
+  return env.Undefined();
+}
+
+Napi::Value Detokenize(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  if (info.Length() < 3 || !info[0].IsNumber() || !info[1].IsObject() || !info[2].IsFunction()) {
+    Napi::TypeError::New(env, "Expected (handle, options, callback)").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+
+  int handle = info[0].As<Napi::Number>().Int32Value();
+  Napi::Object options = info[1].As<Napi::Object>();
+  Napi::Function callback = info[2].As<Napi::Function>();
+
+  if (!options.Has("tokens") || !options.Get("tokens").IsArray()) {
+    Napi::TypeError::New(env, "Expected tokens array in options").ThrowAsJavaScriptException();
+    return env.Null();
+  }
+  Napi::Array tokens_arr = options.Get("tokens").As<Napi::Array>();
+  std::vector<std::vector<int32_t>> tokens;
+  for (uint32_t i = 0; i < tokens_arr.Length(); i++) {
+    if (!IsTokenArray(tokens_arr.Get(i))) {
+      Napi::TypeError::New(env, "Expected tokens to be an array of Int32Array")
+          .ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    tokens.push_back(TokensFromJs(tokens_arr.Get(i)));
+  }
+  bool special = false;
+  if (options.Has("special") && options.Get("special").IsBoolean()) {
+    special = options.Get("special").As<Napi::Boolean>().Value();
+  }
+
+  auto model = FindModel(handle);
+  if (!model) {
+    return InvalidHandle(env, callback);
+  }
+
+  auto to_js = [](Napi::Env env, llama_wrapper::DetokenizeResult &result,
+                  std::string &error) -> Napi::Value {
+    if (!result.success) {
+      error = "Failed to detokenize: token outside the vocabulary";
+      return env.Null();
+    }
+    Napi::Array texts_arr = Napi::Array::New(env, result.texts.size());
+    for (size_t i = 0; i < result.texts.size(); i++) {
+      texts_arr.Set(i, Napi::String::New(env, result.texts[i]));
+    }
+    return texts_arr;
+  };
+  auto tsfn = Napi::ThreadSafeFunction::New(env, callback, "Detokenize", 0, 1);
+  model->detokenize_async(std::move(tokens), special,
+                          Completion<llama_wrapper::DetokenizeResult>(tsfn, to_js));
 
   return env.Undefined();
 }
@@ -471,11 +1326,23 @@ Napi::Value Embed(const Napi::CallbackInfo &info) {
 
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
   exports.Set("loadModel", Napi::Function::New(env, LoadModel));
+  exports.Set("createContext", Napi::Function::New(env, CreateContext));
   exports.Set("unloadModel", Napi::Function::New(env, UnloadModel));
   exports.Set("generate", Napi::Function::New(env, Generate));
   exports.Set("generateStream", Napi::Function::New(env, GenerateStream));
   exports.Set("isModelLoaded", Napi::Function::New(env, IsModelLoaded));
+  exports.Set("getQueueLength", Napi::Function::New(env, GetQueueLength));
+  exports.Set("getMetrics", Napi::Function::New(env, GetMetrics));
+  exports.Set("setMemoryBudget", Napi::Function::New(env, SetMemoryBudget));
+  exports.Set("getResidentModels", Napi::Function::New(env, GetResidentModels));
+  exports.Set("getDevices", Napi::Function::New(env, GetDevices));
+  exports.Set("cancel", Napi::Function::New(env, Cancel));
+  exports.Set("saveSession", Napi::Function::New(env, SaveSession));
+  exports.Set("loadSession", Napi::Function::New(env, LoadSession));
+  exports.Set("loadLoraAdapter", Napi::Function::New(env, LoadLoraAdapter));
   exports.Set("embed", Napi::Function::New(env, Embed));
+  exports.Set("tokenize", Napi::Function::New(env, Tokenize));
+  exports.Set("detokenize", Napi::Function::New(env, Detokenize));
   return exports;
 }
 
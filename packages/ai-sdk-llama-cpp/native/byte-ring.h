@@ -0,0 +1,69 @@
+#ifndef BYTE_RING_H
+#define BYTE_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace llama_wrapper {
+
+// Lock-free single-producer single-consumer byte ring buffer. One thread
+// writes while another reads; neither ever waits for the other.
+class ByteRing {
+public:
+  // The capacity is rounded up to a power of two
+  explicit ByteRing(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    buffer_.resize(size);
+    mask_ = size - 1;
+  }
+
+  ByteRing(const ByteRing &) = delete;
+  ByteRing &operator=(const ByteRing &) = delete;
+
+  // Producer: append up to n bytes and return how many fit
+  size_t write(const char *data, size_t n) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    n = std::min(n, buffer_.size() - (head - tail));
+
+    const size_t offset = head & mask_;
+    const size_t first = std::min(n, buffer_.size() - offset);
+    std::memcpy(buffer_.data() + offset, data, first);
+    std::memcpy(buffer_.data(), data + first, n - first);
+
+    head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  // Consumer: append every readable byte to out
+  void read_all(std::string &out) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t head = head_.load(std::memory_order_acquire);
+    const size_t n = head - tail;
+
+    const size_t offset = tail & mask_;
+    const size_t first = std::min(n, buffer_.size() - offset);
+    out.append(buffer_.data() + offset, first);
+    out.append(buffer_.data(), n - first);
+
+    tail_.store(tail + n, std::memory_order_release);
+  }
+
+private:
+  std::vector<char> buffer_;
+  size_t mask_ = 0;
+  // Monotonic positions; kept on separate cache lines to avoid false sharing
+  alignas(64) std::atomic<size_t> head_{0}; // Written by the producer
+  alignas(64) std::atomic<size_t> tail_{0}; // Written by the consumer
+};
+
+} // namespace llama_wrapper
+
+#endif // BYTE_RING_H
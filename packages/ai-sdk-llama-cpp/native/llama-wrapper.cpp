@@ -1,13 +1,141 @@
 #include "llama-wrapper.h"
 #include "llama.h"
+#include "stop-matcher.h"
+#include "utf8.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <cstdio>
 #include <cstring>
+#include <future>
 #include <stdexcept>
 
 namespace llama_wrapper {
 
+enum class RequestType {
+  GENERATE,     // Regular generation
+  SAVE_SESSION, // Prefill only, then save the sequence state
+  LOAD_SESSION, // Restore a saved sequence state into an idle slot
+};
+
+// A queued generation request, completed by the scheduler thread
+struct GenerationRequest {
+  RequestType type = RequestType::GENERATE;
+  std::string session_path;
+  std::vector<ChatMessage> messages;
+  GenerationParams params;
+  TokenCallback callback; // Empty for non-streaming requests
+  std::vector<int32_t> prompt_tokens;
+  bool tokenized = false; // prompt_tokens were given instead of messages
+  int n_keep = 0;         // Leading prompt tokens that context shifts never discard
+  int n_discarded = 0;    // Tokens dropped from the conversation to fit the context
+  GenerationDoneCallback on_done;
+  RequestId id = 0;
+  std::atomic<bool> cancelled{false};
+  std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+  GenerationTimings timings;             // Queueing, templating and tokenization
+  std::vector<GenerationResult> choices; // Results of the finished choices (n > 1)
+  size_t n_finished = 0;
+};
+
+// Milliseconds between two time points
+static double elapsed_ms(std::chrono::steady_clock::time_point from,
+                         std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+// Finish reason for a request that has to stop early, or null to keep going
+static const char *stop_reason(const GenerationRequest &request,
+                               std::chrono::steady_clock::time_point now) {
+  if (request.cancelled.load(std::memory_order_relaxed)) {
+    return "cancelled";
+  }
+  if (now >= request.deadline) {
+    return "timeout";
+  }
+  return nullptr;
+}
+
+enum class SlotState {
+  IDLE,     // No request assigned
+  PREFILL,  // Prompt tokens are being decoded
+  FORK,     // Waiting for the prompt of another choice of the same request
+  GENERATE, // Sampling and decoding completion tokens
+};
+
+// One sequence of the shared context
+struct Slot {
+  llama_seq_id seq_id = 0;
+  SlotState state = SlotState::IDLE;
+  std::shared_ptr<GenerationRequest> request;
+  llama_sampler *sampler = nullptr;
+  llama_sampler *grammar = nullptr; // Checked separately from the sampler chain
+  std::vector<int32_t> prompt_tokens;
+  std::vector<int32_t> cache_tokens; // Tokens currently stored in this sequence's KV cache
+  LoraAdapters cache_lora;           // Adapters the cached tokens were decoded with
+  uint64_t last_used = 0;            // Admission counter for least-recently-used selection
+  size_t n_prefilled = 0;            // Prompt tokens already added to a batch
+  int n_past = 0;                    // Position of the next token in this sequence
+  int n_keep = 0;                    // Leading tokens kept when the context is shifted
+  int32_t next_token = 0;            // Sampled token waiting to be decoded
+  int32_t i_batch = -1;              // Index of this slot's logits in the current batch
+  bool in_batch = false;             // Whether the slot contributed tokens to the current batch
+  std::string generated_text;
+  GenerationResult result;
+  StopMatcher stop_matcher;
+  size_t n_streamed = 0; // Bytes of generated_text passed to the token callback
+  std::chrono::steady_clock::time_point admitted_at;
+  std::chrono::steady_clock::time_point first_token_at;
+  SamplerConfig sampler_config; // Settings the sampler was built for, to return it to the pool
+  bool greedy = false;          // Argmax of the logits, without the sampler chain
+  size_t choice = 0;            // Which of the request's n completions this slot samples
+  std::vector<Slot *> forks;    // Slots waiting to copy this slot's prompt
+
+  // Speculative decoding
+  std::vector<int32_t> draft;              // Draft tokens decoded after next_token this step
+  std::vector<int32_t> draft_cache_tokens; // Tokens stored in the draft model's KV cache
+  size_t n_draft_max = 0;                  // Draft tokens wanted this step
+  int32_t i_draft = -1;                    // Index of this slot's logits in the draft batch
+};
+
+// Length of the common prefix of two token sequences
+static size_t common_prefix_length(const std::vector<int32_t> &a, const std::vector<int32_t> &b) {
+  const size_t n = std::min(a.size(), b.size());
+  size_t i = 0;
+  while (i < n && a[i] == b[i]) {
+    i++;
+  }
+  return i;
+}
+
+// Append a single-sequence token to a batch
+static void batch_add(llama_batch &batch, int32_t token, int pos, llama_seq_id seq_id,
+                      bool logits) {
+  const int i = batch.n_tokens;
+  batch.token[i] = token;
+  batch.pos[i] = pos;
+  batch.n_seq_id[i] = 1;
+  batch.seq_id[i][0] = seq_id;
+  batch.logits[i] = logits;
+  batch.n_tokens++;
+}
+
+// Number of parsed grammars kept per model
+static const size_t GRAMMAR_CACHE_SIZE = 32;
+
+// Number of idle sampler chains kept per model
+static const size_t SAMPLER_POOL_SIZE = 16;
+
+// Number of tokenized prompts kept per model
+static const size_t PROMPT_CACHE_SIZE = 8;
+
 // Global debug flag for log callback
 static bool g_debug_mode = false;
 
@@ -26,32 +154,7 @@ LlamaModel::~LlamaModel() {
   unload();
 }
 
-LlamaModel::LlamaModel(LlamaModel &&other) noexcept
-    : model_(other.model_), ctx_(other.ctx_), sampler_(other.sampler_),
-      model_path_(std::move(other.model_path_)), chat_template_(std::move(other.chat_template_)),
-      n_batch_(other.n_batch_) {
-  other.model_ = nullptr;
-  other.ctx_ = nullptr;
-  other.sampler_ = nullptr;
-}
-
-LlamaModel &LlamaModel::operator=(LlamaModel &&other) noexcept {
-  if (this != &other) {
-    unload();
-    model_ = other.model_;
-    ctx_ = other.ctx_;
-    sampler_ = other.sampler_;
-    model_path_ = std::move(other.model_path_);
-    chat_template_ = std::move(other.chat_template_);
-    n_batch_ = other.n_batch_;
-    other.model_ = nullptr;
-    other.ctx_ = nullptr;
-    other.sampler_ = nullptr;
-  }
-  return *this;
-}
-
-bool LlamaModel::load(const ModelParams &params) {
+bool LlamaModel::load(const ModelParams &params, std::string *error) {
   if (model_) {
     unload();
   }
@@ -60,111 +163,512 @@ bool LlamaModel::load(const ModelParams &params) {
   g_debug_mode = params.debug;
   llama_log_set(llama_log_callback, nullptr);
 
-  // Initialize llama backend
-  llama_backend_init();
+  std::shared_ptr<ModelWeights> weights = ModelRegistry::instance().acquire(params, error);
+  if (!weights) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(weights_mutex_);
+    weights_ = std::move(weights);
+    model_ = weights_->model();
+  }
 
-  // Set up model parameters
-  llama_model_params model_params = llama_model_default_params();
-  model_params.n_gpu_layers = params.n_gpu_layers;
-  model_params.use_mmap = params.use_mmap;
-  model_params.use_mlock = params.use_mlock;
+  if (!params.draft_model_path.empty()) {
+    ModelParams draft_params = params;
+    draft_params.model_path = params.draft_model_path;
+    draft_params.progress = nullptr; // Progress covers the main model
+    std::string draft_error;
+    std::shared_ptr<ModelWeights> draft_weights =
+        ModelRegistry::instance().acquire(draft_params, &draft_error);
+    {
+      std::lock_guard<std::mutex> lock(weights_mutex_);
+      draft_weights_ = std::move(draft_weights);
+      draft_model_ = draft_weights_ ? draft_weights_->model() : nullptr;
+    }
+    if (!draft_model_) {
+      unload();
+      if (error) {
+        *error = draft_error.empty() ? "Failed to load draft model from: " + params.draft_model_path
+                                     : draft_error;
+      }
+      return false;
+    }
 
-  // Load the model
-  model_ = llama_model_load_from_file(params.model_path.c_str(), model_params);
-  if (!model_) {
-    return false;
+    // Draft tokens are verified by id, so both models must share a vocabulary
+    const llama_vocab *vocab = llama_model_get_vocab(model_);
+    const llama_vocab *draft_vocab = llama_model_get_vocab(draft_model_);
+    if (llama_vocab_type(vocab) != llama_vocab_type(draft_vocab) ||
+        llama_vocab_bos(vocab) != llama_vocab_bos(draft_vocab) ||
+        llama_vocab_eos(vocab) != llama_vocab_eos(draft_vocab)) {
+      unload();
+      if (error) {
+        *error = "Draft model does not share the vocabulary of the model";
+      }
+      return false;
+    }
   }
 
+  std::lock_guard<std::mutex> lock(weights_mutex_);
   model_path_ = params.model_path;
+  draft_model_path_ = params.draft_model_path;
   chat_template_ = params.chat_template;
   return true;
 }
 
+bool LlamaModel::load_from(const LlamaModel &other) {
+  if (model_) {
+    unload();
+  }
+
+  // The other model may be evicted on another thread at any time
+  std::scoped_lock lock(weights_mutex_, other.weights_mutex_);
+  if (!other.weights_) {
+    return false;
+  }
+  weights_ = other.weights_;
+  draft_weights_ = other.draft_weights_;
+  model_ = other.model_;
+  draft_model_ = other.draft_model_;
+  model_path_ = other.model_path_;
+  draft_model_path_ = other.draft_model_path_;
+  chat_template_ = other.chat_template_;
+  return true;
+}
+
 bool LlamaModel::is_loaded() const {
+  std::lock_guard<std::mutex> lock(weights_mutex_);
   return model_ != nullptr;
 }
 
 void LlamaModel::unload() {
-  if (sampler_) {
-    llama_sampler_free(sampler_);
-    sampler_ = nullptr;
+  // Waits for an eviction in progress, so the two never release at once
+  ModelRegistry::instance().detach(this);
+  release();
+}
+
+void LlamaModel::release() {
+  stop_scheduler();
+  clear_grammar_cache();
+  clear_sampler_pool();
+  prompt_cache_.clear();
+  if (draft_ctx_) {
+    llama_free(draft_ctx_);
+    draft_ctx_ = nullptr;
   }
   if (ctx_) {
     llama_free(ctx_);
     ctx_ = nullptr;
   }
-  if (model_) {
-    llama_model_free(model_);
+  clear_lora_adapters();
+
+  // The weights are freed once no other instance shares them, outside the lock
+  std::shared_ptr<ModelWeights> weights;
+  std::shared_ptr<ModelWeights> draft_weights;
+  {
+    std::lock_guard<std::mutex> lock(weights_mutex_);
+    draft_model_ = nullptr;
     model_ = nullptr;
-    llama_backend_free();
+    weights.swap(weights_);
+    draft_weights.swap(draft_weights_);
+    model_path_.clear();
+    draft_model_path_.clear();
   }
-  model_path_.clear();
 }
 
-bool LlamaModel::create_context(const ContextParams &params) {
-  if (!model_) {
+// Map a KV cache type name to its ggml type
+static bool parse_cache_type(const std::string &name, ggml_type *type) {
+  static const std::pair<const char *, ggml_type> types[] = {
+      {"f32", GGML_TYPE_F32},   {"f16", GGML_TYPE_F16},   {"bf16", GGML_TYPE_BF16},
+      {"q8_0", GGML_TYPE_Q8_0}, {"q4_0", GGML_TYPE_Q4_0}, {"q4_1", GGML_TYPE_Q4_1},
+      {"q5_0", GGML_TYPE_Q5_0}, {"q5_1", GGML_TYPE_Q5_1}, {"iq4_nl", GGML_TYPE_IQ4_NL},
+  };
+  for (const auto &entry : types) {
+    if (name == entry.first) {
+      *type = entry.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool is_quantized(ggml_type type) {
+  return type != GGML_TYPE_F32 && type != GGML_TYPE_F16 && type != GGML_TYPE_BF16;
+}
+
+// Decode a throwaway batch and a single token on a new context, which faults in
+// the weights and builds the backend's kernels for both batch shapes
+static void warmup_context(llama_context *ctx, bool embedding) {
+  const llama_model *model = llama_get_model(ctx);
+  const llama_vocab *vocab = llama_model_get_vocab(model);
+  llama_token token = llama_vocab_bos(vocab);
+  if (token == LLAMA_TOKEN_NULL) {
+    token = llama_vocab_eos(vocab);
+  }
+  if (token == LLAMA_TOKEN_NULL) {
+    token = 0;
+  }
+
+  // Warm-up mode runs every expert of mixture-of-experts models, so all
+  // weights are touched and not only those a short prompt happens to route to
+  llama_set_warmup(ctx, true);
+  // Large enough for the batched matrix kernels of prompt processing
+  const int n_tokens =
+      std::min({32, static_cast<int>(llama_n_ubatch(ctx)), static_cast<int>(llama_n_ctx(ctx)) - 1});
+  llama_batch batch = llama_batch_init(n_tokens, 0, 1);
+  for (int i = 0; i < n_tokens; i++) {
+    batch_add(batch, token, i, 0, embedding || i == n_tokens - 1);
+  }
+  llama_decode(ctx, batch);
+  if (!embedding) {
+    // Token generation decodes one token at a time
+    batch.n_tokens = 0;
+    batch_add(batch, token, n_tokens, 0, true);
+    llama_decode(ctx, batch);
+  }
+  llama_batch_free(batch);
+  llama_synchronize(ctx);
+  llama_set_warmup(ctx, false);
+
+  llama_memory_t mem = llama_get_memory(ctx);
+  if (mem) {
+    llama_memory_clear(mem, true);
+  }
+}
+
+bool LlamaModel::create_context(const ContextParams &params, std::string *error) {
+  auto fail = [error](std::string reason) {
+    if (error) {
+      *error = std::move(reason);
+    }
     return false;
+  };
+  if (!model_) {
+    return fail("Model is not loaded");
+  }
+
+  // Validate the attention settings before tearing down the current context
+  ggml_type type_k, type_v;
+  if (!parse_cache_type(params.type_k, &type_k)) {
+    return fail("Unsupported KV cache type: " + params.type_k);
+  }
+  if (!parse_cache_type(params.type_v, &type_v)) {
+    return fail("Unsupported KV cache type: " + params.type_v);
+  }
+  llama_flash_attn_type flash_attn;
+  if (params.flash_attn == "auto") {
+    flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+  } else if (params.flash_attn == "on") {
+    flash_attn = LLAMA_FLASH_ATTN_TYPE_ENABLED;
+  } else if (params.flash_attn == "off") {
+    flash_attn = LLAMA_FLASH_ATTN_TYPE_DISABLED;
+  } else {
+    return fail("Flash attention must be \"auto\", \"on\" or \"off\"");
+  }
+  // The non-flash attention path transposes V, which quantized types do not support
+  if (is_quantized(type_v) && flash_attn == LLAMA_FLASH_ATTN_TYPE_DISABLED) {
+    return fail("Quantized V cache type " + params.type_v + " requires flash attention");
   }
 
+  ModelRegistry::instance().detach(this);
+  stop_scheduler();
+  if (draft_ctx_) {
+    llama_free(draft_ctx_);
+    draft_ctx_ = nullptr;
+  }
   if (ctx_) {
     llama_free(ctx_);
     ctx_ = nullptr;
   }
+  lora_group_.clear();
+  lora_applied_.clear();
+
+  const int n_seq_max = std::max(1, params.n_seq_max);
+  // Rejected draft tokens are removed from the KV cache again, which recurrent
+  // models cannot do
+  n_lookup_ = std::max(0, params.n_lookup);
+  const bool speculative = (draft_model_ || n_lookup_ > 0) && !params.embedding &&
+                           !llama_model_is_recurrent(model_);
+  n_draft_ = speculative ? std::max(0, params.n_draft) : 0;
 
   llama_context_params ctx_params = llama_context_default_params();
-  ctx_params.n_ctx = params.n_ctx;
-  ctx_params.n_batch = params.n_batch;
+  // The KV cache is split evenly across generation sequences, so scale it to
+  // give each sequence the requested context size
+  ctx_params.n_ctx = params.embedding ? params.n_ctx : params.n_ctx * n_seq_max;
+  // Every active sequence contributes at least one token per decode step, plus
+  // its draft tokens with speculative decoding
+  ctx_params.n_batch = std::max(params.n_batch, n_seq_max * (n_draft_ + 1));
+  ctx_params.n_seq_max = n_seq_max;
+  if (params.n_ubatch > 0) {
+    ctx_params.n_ubatch = std::min<uint32_t>(params.n_ubatch, ctx_params.n_batch);
+  }
   ctx_params.n_threads = params.n_threads;
-  ctx_params.n_threads_batch = params.n_threads;
+  ctx_params.n_threads_batch =
+      params.n_threads_batch > 0 ? params.n_threads_batch : params.n_threads;
+  ctx_params.type_k = type_k;
+  ctx_params.type_v = type_v;
+  ctx_params.flash_attn_type = flash_attn;
 
   if (params.embedding) {
     ctx_params.embeddings = true;
     ctx_params.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+    // Non-causal models need every sequence of a batch in a single ubatch, and
+    // packed texts share one KV pool instead of per-sequence slices
+    ctx_params.n_ubatch = ctx_params.n_batch;
+    ctx_params.kv_unified = true;
   }
 
   ctx_ = llama_init_from_model(model_, ctx_params);
+  if (!ctx_ && is_quantized(type_v) && flash_attn == LLAMA_FLASH_ATTN_TYPE_AUTO) {
+    // llama.cpp turns flash attention off where the backend lacks it (e.g.
+    // layers on an unsupported device) and then rejects the quantized V cache
+    fail("Quantized V cache type " + params.type_v +
+         " requires flash attention, which is not available on this backend");
+  }
+  if (ctx_ && draft_model_ && n_draft_ > 0) {
+    // The draft context holds the same sequences as the target context
+    draft_ctx_ = llama_init_from_model(draft_model_, ctx_params);
+    if (!draft_ctx_) {
+      fail("Failed to create draft context for: " + draft_model_path_);
+      llama_free(ctx_);
+      ctx_ = nullptr;
+    }
+  }
+  if (ctx_ && !params.embedding) {
+    for (const auto &[name, path] : params.lora_adapters) {
+      std::string lora_error;
+      if (!load_lora_adapter(name, path, &lora_error)) {
+        fail(std::move(lora_error));
+        clear_lora_adapters();
+        if (draft_ctx_) {
+          llama_free(draft_ctx_);
+          draft_ctx_ = nullptr;
+        }
+        llama_free(ctx_);
+        ctx_ = nullptr;
+        break;
+      }
+    }
+  }
+  if (ctx_) {
+    n_batch_ = ctx_params.n_batch; // Store batch size for chunked prefill
+    max_queue_ = std::max(0, params.max_queue);
+    if (params.warmup) {
+      warmup_context(ctx_, params.embedding);
+      if (draft_ctx_) {
+        warmup_context(draft_ctx_, false);
+      }
+    }
+    llama_set_abort_callback(ctx_, &LlamaModel::abort_callback, this);
+    // Embedding contexts only run posted embed tasks on the scheduler thread
+    start_scheduler(params.embedding ? 0 : n_seq_max);
+  }
   if (ctx_) {
-    n_batch_ = params.n_batch; // Store batch size for chunked prefill
+    ModelRegistry::instance().attach(this, weights_.get(), draft_weights_.get(),
+                                     [this]() { return release_if_idle(); });
   }
   return ctx_ != nullptr;
 }
 
-void LlamaModel::normalize_embedding(float *embedding, int n_embd) {
+bool LlamaModel::release_if_idle() {
+  // Synchronous embed() calls hold this lock while they run
+  std::unique_lock<std::mutex> embed_lock(embed_mutex_, std::try_to_lock);
+  if (!embed_lock.owns_lock()) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(scheduler_mutex_);
+    if (n_active_ > 0 || running_tasks_ || !pending_.empty() || !tasks_.empty()) {
+      return false;
+    }
+    // Requests submitted from now on fail instead of queueing
+    scheduler_stop_ = true;
+  }
+  release();
+  return true;
+}
+
+// Sum of squares of a vector, vectorized where the target supports it
+static float sum_of_squares(const float *x, int n) {
+  int i = 0;
   float sum = 0.0f;
-  for (int i = 0; i < n_embd; i++) {
-    sum += embedding[i] * embedding[i];
+#if defined(__AVX512F__)
+  __m512 acc = _mm512_setzero_ps();
+  for (; i + 16 <= n; i += 16) {
+    __m512 v = _mm512_loadu_ps(x + i);
+    acc = _mm512_fmadd_ps(v, v, acc);
+  }
+  sum = _mm512_reduce_add_ps(acc);
+#elif defined(__AVX2__) && defined(__FMA__)
+  __m256 acc = _mm256_setzero_ps();
+  for (; i + 8 <= n; i += 8) {
+    __m256 v = _mm256_loadu_ps(x + i);
+    acc = _mm256_fmadd_ps(v, v, acc);
+  }
+  __m128 lo = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+  lo = _mm_add_ss(lo, _mm_movehdup_ps(lo));
+  sum = _mm_cvtss_f32(lo);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  float32x4_t acc = vdupq_n_f32(0.0f);
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t v = vld1q_f32(x + i);
+    acc = vfmaq_f32(acc, v, v);
+  }
+  sum = vaddvq_f32(acc);
+#endif
+  for (; i < n; i++) {
+    sum += x[i] * x[i];
+  }
+  return sum;
+}
+
+// dst = src * s, vectorized where the target supports it
+static void scale_copy(const float *src, float *dst, int n, float s) {
+  int i = 0;
+#if defined(__AVX512F__)
+  const __m512 vs = _mm512_set1_ps(s);
+  for (; i + 16 <= n; i += 16) {
+    _mm512_storeu_ps(dst + i, _mm512_mul_ps(_mm512_loadu_ps(src + i), vs));
+  }
+#elif defined(__AVX2__)
+  const __m256 vs = _mm256_set1_ps(s);
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_loadu_ps(src + i), vs));
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const float32x4_t vs = vdupq_n_f32(s);
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32(dst + i, vmulq_f32(vld1q_f32(src + i), vs));
+  }
+#endif
+  for (; i < n; i++) {
+    dst[i] = src[i] * s;
+  }
+}
+
+void LlamaModel::normalize_embedding(const float *src, float *dst, int n_embd) {
+  const float norm = std::sqrt(sum_of_squares(src, n_embd));
+  scale_copy(src, dst, n_embd, norm > 0.0f ? 1.0f / norm : 1.0f);
+}
+
+void LlamaModel::encode_embedding(const float *embedding, int n_embd, EmbeddingEncoding encoding,
+                                  uint8_t *row, float *scale) {
+  switch (encoding) {
+  case EmbeddingEncoding::FLOAT32:
+    std::memcpy(row, embedding, n_embd * sizeof(float));
+    break;
+  case EmbeddingEncoding::FLOAT16:
+    ggml_fp32_to_fp16_row(embedding, reinterpret_cast<ggml_fp16_t *>(row), n_embd);
+    break;
+  case EmbeddingEncoding::INT8: {
+    // Symmetric per-row quantization: value = q * scale
+    float max_abs = 0.0f;
+    for (int i = 0; i < n_embd; i++) {
+      max_abs = std::max(max_abs, std::fabs(embedding[i]));
+    }
+    const float s = max_abs / 127.0f;
+    const float inv = s > 0.0f ? 1.0f / s : 0.0f;
+    int8_t *q = reinterpret_cast<int8_t *>(row);
+    for (int i = 0; i < n_embd; i++) {
+      q[i] = static_cast<int8_t>(std::lround(embedding[i] * inv));
+    }
+    *scale = s;
+    break;
   }
-  float norm = std::sqrt(sum);
-  if (norm > 0.0f) {
+  case EmbeddingEncoding::BINARY:
+    std::memset(row, 0, (n_embd + 7) / 8);
     for (int i = 0; i < n_embd; i++) {
-      embedding[i] /= norm;
+      if (embedding[i] > 0.0f) {
+        row[i / 8] |= static_cast<uint8_t>(0x80 >> (i % 8));
+      }
     }
+    break;
   }
 }
 
-EmbeddingResult LlamaModel::embed(const std::vector<std::string> &texts) {
+EmbeddingResult LlamaModel::embed(const std::vector<std::string> &texts,
+                                  EmbeddingEncoding encoding) {
+  return embed_batch(&texts, {}, encoding);
+}
+
+EmbeddingResult LlamaModel::embed_tokens(std::vector<std::vector<int32_t>> tokens,
+                                         EmbeddingEncoding encoding) {
+  return embed_batch(nullptr, std::move(tokens), encoding);
+}
+
+EmbeddingResult LlamaModel::embed_batch(const std::vector<std::string> *texts,
+                                        std::vector<std::vector<int32_t>> tokens,
+                                        EmbeddingEncoding encoding) {
+  std::lock_guard<std::mutex> embed_lock(embed_mutex_);
+  const auto start = std::chrono::steady_clock::now();
+
   EmbeddingResult result;
-  result.total_tokens = 0;
+  result.encoding = encoding;
 
   if (!ctx_ || !model_) {
     return result;
   }
+  weights_->touch();
 
   const int n_embd = llama_model_n_embd(model_);
   const enum llama_pooling_type pooling_type = llama_pooling_type(ctx_);
+  const size_t n_seq_max = llama_n_seq_max(ctx_);
+  const size_t n_batch = n_batch_;
+
+  // Tokenize all texts up front; texts that don't fit a batch get a zero embedding
+  const size_t n_texts = texts ? texts->size() : tokens.size();
+  if (texts) {
+    tokens.resize(n_texts);
+    for (size_t i = 0; i < n_texts; i++) {
+      tokens[i] = tokenize((*texts)[i], true);
+    }
+    result.tokenize_ms = elapsed_ms(start, std::chrono::steady_clock::now());
+  }
+  for (auto &text_tokens : tokens) {
+    // Given token lists with ids outside the vocabulary get a zero embedding too
+    if (!texts && !valid_tokens(text_tokens)) {
+      text_tokens.clear();
+    }
+    result.total_tokens += text_tokens.size();
+  }
 
-  // Process each text
-  for (size_t seq_id = 0; seq_id < texts.size(); seq_id++) {
-    const std::string &text = texts[seq_id];
+  // Rows of texts without an embedding stay zero
+  result.n_embd = n_embd;
+  switch (encoding) {
+  case EmbeddingEncoding::FLOAT32:
+    result.row_bytes = n_embd * sizeof(float);
+    break;
+  case EmbeddingEncoding::FLOAT16:
+    result.row_bytes = n_embd * sizeof(ggml_fp16_t);
+    break;
+  case EmbeddingEncoding::INT8:
+    result.row_bytes = n_embd;
+    result.scales.assign(n_texts, 0.0f);
+    break;
+  case EmbeddingEncoding::BINARY:
+    result.row_bytes = (n_embd + 7) / 8;
+    break;
+  }
+  result.data.assign(n_texts * result.row_bytes, 0);
 
-    // Tokenize the text
-    std::vector<int32_t> tokens = tokenize(text, true);
-    result.total_tokens += tokens.size();
+  // Normalized vector before encoding; float32 output is normalized in place
+  std::vector<float> normalized(encoding == EmbeddingEncoding::FLOAT32 ? 0 : n_embd);
 
-    if (tokens.empty()) {
-      // Return zero embedding for empty text
-      result.embeddings.push_back(std::vector<float>(n_embd, 0.0f));
-      continue;
+  llama_batch batch = llama_batch_init(n_batch, 0, 1);
+  std::vector<size_t> batch_texts;     // Text index for each sequence in the batch
+  std::vector<int32_t> batch_last_ids; // Batch index of each sequence's last token
+
+  // Decode the packed batch and copy out one embedding per sequence. Once the
+  // model is being unloaded, the remaining batches are skipped.
+  auto flush = [&]() {
+    if (batch.n_tokens == 0) {
+      return;
+    }
+    if (scheduler_stop_) {
+      batch.n_tokens = 0;
+      batch_texts.clear();
+      batch_last_ids.clear();
+      return;
     }
 
     // Clear the memory/KV cache
@@ -173,51 +677,75 @@ EmbeddingResult LlamaModel::embed(const std::vector<std::string> &texts) {
       llama_memory_clear(mem, true);
     }
 
-    // Create batch with sequence ID
-    llama_batch batch = llama_batch_init(tokens.size(), 0, 1);
-    for (size_t i = 0; i < tokens.size(); i++) {
-      batch.token[i] = tokens[i];
-      batch.pos[i] = i;
-      batch.n_seq_id[i] = 1;
-      batch.seq_id[i][0] = seq_id;
-      batch.logits[i] = true; // We want embeddings for all tokens
+    const auto eval_start = std::chrono::steady_clock::now();
+    const int status = llama_decode(ctx_, batch);
+    result.eval_ms += elapsed_ms(eval_start, std::chrono::steady_clock::now());
+    if (status == 0) {
+      for (size_t s = 0; s < batch_texts.size(); s++) {
+        // Extract embedding based on pooling type
+        const float *embd = nullptr;
+        if (pooling_type == LLAMA_POOLING_TYPE_NONE) {
+          // Get embedding for last token
+          embd = llama_get_embeddings_ith(ctx_, batch_last_ids[s]);
+        } else {
+          // Get pooled embedding for the sequence
+          embd = llama_get_embeddings_seq(ctx_, s);
+        }
+
+        if (embd) {
+          const size_t row = batch_texts[s];
+          uint8_t *out = result.data.data() + row * result.row_bytes;
+          if (encoding == EmbeddingEncoding::FLOAT32) {
+            // Normalize (L2) while copying straight into the output row
+            normalize_embedding(embd, reinterpret_cast<float *>(out), n_embd);
+          } else {
+            normalize_embedding(embd, normalized.data(), n_embd);
+            encode_embedding(normalized.data(), n_embd, encoding, out,
+                             encoding == EmbeddingEncoding::INT8 ? &result.scales[row] : nullptr);
+          }
+        }
+      }
     }
-    batch.n_tokens = tokens.size();
 
-    // Decode to get embeddings
-    if (llama_decode(ctx_, batch) != 0) {
-      llama_batch_free(batch);
-      result.embeddings.push_back(std::vector<float>(n_embd, 0.0f));
+    batch.n_tokens = 0;
+    batch_texts.clear();
+    batch_last_ids.clear();
+  };
+
+  // Pack as many texts as fit into one batch, each on its own sequence id
+  for (size_t i = 0; i < n_texts; i++) {
+    const std::vector<int32_t> &text_tokens = tokens[i];
+    if (text_tokens.empty() || text_tokens.size() > n_batch) {
       continue;
     }
 
-    // Extract embedding based on pooling type
-    const float *embd = nullptr;
-    if (pooling_type == LLAMA_POOLING_TYPE_NONE) {
-      // Get embedding for last token
-      embd = llama_get_embeddings_ith(ctx_, tokens.size() - 1);
-    } else {
-      // Get pooled embedding for the sequence
-      embd = llama_get_embeddings_seq(ctx_, seq_id);
+    if (batch.n_tokens + text_tokens.size() > n_batch || batch_texts.size() >= n_seq_max) {
+      flush();
     }
 
-    if (embd) {
-      std::vector<float> embedding(n_embd);
-      std::copy(embd, embd + n_embd, embedding.begin());
-      // Normalize the embedding (L2 normalization)
-      normalize_embedding(embedding.data(), n_embd);
-      result.embeddings.push_back(std::move(embedding));
-    } else {
-      result.embeddings.push_back(std::vector<float>(n_embd, 0.0f));
+    const llama_seq_id seq_id = batch_texts.size();
+    for (size_t j = 0; j < text_tokens.size(); j++) {
+      batch_add(batch, text_tokens[j], j, seq_id, true); // We want embeddings for all tokens
     }
+    batch_texts.push_back(i);
+    batch_last_ids.push_back(batch.n_tokens - 1);
+  }
+  flush();
 
-    llama_batch_free(batch);
+  llama_batch_free(batch);
+  if (scheduler_stop_) {
+    // Batches were skipped or aborted; callers report an empty result as a failure
+    result.data.clear();
+    return result;
   }
 
+  result.total_ms = elapsed_ms(start, std::chrono::steady_clock::now());
+  metrics_.record_embedding(result, n_texts);
   return result;
 }
 
-std::string LlamaModel::apply_chat_template(const std::vector<ChatMessage> &messages) {
+std::string LlamaModel::apply_chat_template(const std::vector<ChatMessage> &messages,
+                                            bool add_assistant) {
   if (!model_) {
     return "";
   }
@@ -242,70 +770,300 @@ std::string LlamaModel::apply_chat_template(const std::vector<ChatMessage> &mess
     chat_messages.push_back(chat_msg);
   }
 
-  // First call to get required buffer size
+  // Render into a buffer sized for the messages plus some markup per message,
+  // so that only templates that add more than that need a second pass
+  size_t estimate = 256;
+  for (const auto &msg : messages) {
+    estimate += msg.role.size() + msg.content.size() + 64;
+  }
+  std::string prompt(estimate, '\0');
   int32_t result_size = llama_chat_apply_template(tmpl, chat_messages.data(), chat_messages.size(),
-                                                  true, // add_ass: add assistant prompt
-                                                  nullptr, 0);
+                                                  add_assistant, // add_ass: add assistant prompt
+                                                  prompt.data(), prompt.size());
 
   if (result_size < 0) {
     // Template not supported, return empty string
     return "";
   }
 
-  // Allocate buffer and apply template
-  std::vector<char> buffer(result_size + 1);
-  llama_chat_apply_template(tmpl, chat_messages.data(), chat_messages.size(), true, buffer.data(),
-                            buffer.size());
+  if (static_cast<size_t>(result_size) > prompt.size()) {
+    prompt.resize(result_size);
+    llama_chat_apply_template(tmpl, chat_messages.data(), chat_messages.size(), add_assistant,
+                              prompt.data(), prompt.size());
+  }
+  prompt.resize(result_size);
+  return prompt;
+}
+
+bool SamplerConfig::operator==(const SamplerConfig &other) const {
+  return temperature == other.temperature && top_k == other.top_k && top_p == other.top_p &&
+         min_p == other.min_p && typical_p == other.typical_p &&
+         repeat_penalty == other.repeat_penalty && frequency_penalty == other.frequency_penalty &&
+         presence_penalty == other.presence_penalty && penalty_last_n == other.penalty_last_n &&
+         seed == other.seed;
+}
 
-  return std::string(buffer.data(), result_size);
+bool SamplerConfig::penalized() const {
+  return penalty_last_n != 0 &&
+         (repeat_penalty != 1.0f || frequency_penalty != 0.0f || presence_penalty != 0.0f);
 }
 
-void LlamaModel::create_sampler(const GenerationParams &params) {
-  if (sampler_) {
-    llama_sampler_free(sampler_);
+bool SamplerConfig::plain_greedy() const { return temperature <= 0.0f && !penalized(); }
+
+SamplerConfig LlamaModel::sampler_config(const GenerationParams &params, size_t choice) const {
+  SamplerConfig config;
+  config.temperature = params.temperature;
+  config.repeat_penalty = params.repeat_penalty;
+  config.frequency_penalty = params.frequency_penalty;
+  config.presence_penalty = params.presence_penalty;
+  config.penalty_last_n = params.penalty_last_n < 0 ? n_ctx_seq() : params.penalty_last_n;
+  if (!config.penalized()) {
+    config.repeat_penalty = 1.0f;
+    config.frequency_penalty = 0.0f;
+    config.presence_penalty = 0.0f;
+    config.penalty_last_n = 0;
+  }
+  // Greedy sampling ignores the truncation stages and the seed, so leave them
+  // at their defaults to share pooled chains across such requests
+  if (params.temperature > 0.0f) {
+    config.top_k = std::max(params.top_k, 0);
+    config.top_p = params.top_p;
+    config.min_p = params.min_p;
+    config.typical_p = params.typical_p;
+    // Every choice samples with its own seed
+    config.seed =
+        params.seed < 0 ? LLAMA_DEFAULT_SEED : static_cast<uint32_t>(params.seed + choice);
   }
+  return config;
+}
 
-  // Create a sampler chain
-  sampler_ = llama_sampler_chain_init(llama_sampler_chain_default_params());
+llama_sampler *LlamaModel::create_sampler(const SamplerConfig &config) {
+  llama_sampler *sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
 
-  // Add grammar sampler first if grammar is provided (constrains token generation)
-  if (!params.grammar.empty()) {
-    const llama_vocab *vocab = llama_model_get_vocab(model_);
-    llama_sampler *grammar_sampler =
-        llama_sampler_init_grammar(vocab, params.grammar.c_str(), "root");
-    if (grammar_sampler) {
-      llama_sampler_chain_add(sampler_, grammar_sampler);
+  if (config.penalized()) {
+    llama_sampler_chain_add(sampler,
+                            llama_sampler_init_penalties(config.penalty_last_n,
+                                                         config.repeat_penalty,
+                                                         config.frequency_penalty,
+                                                         config.presence_penalty));
+  }
+  if (config.temperature <= 0.0f) {
+    llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+    return sampler;
+  }
+  if (config.top_k > 0) {
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_k(config.top_k));
+  }
+  if (config.typical_p < 1.0f) {
+    llama_sampler_chain_add(sampler, llama_sampler_init_typical(config.typical_p, 1));
+  }
+  if (config.top_p < 1.0f) {
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_p(config.top_p, 1));
+  }
+  if (config.min_p > 0.0f) {
+    llama_sampler_chain_add(sampler, llama_sampler_init_min_p(config.min_p, 1));
+  }
+  llama_sampler_chain_add(sampler, llama_sampler_init_temp(config.temperature));
+  llama_sampler_chain_add(sampler, llama_sampler_init_dist(config.seed));
+  return sampler;
+}
+
+llama_sampler *LlamaModel::acquire_sampler(const SamplerConfig &config) {
+  // The most recently returned chain is the most likely to be warm in cache
+  for (auto it = sampler_pool_.rbegin(); it != sampler_pool_.rend(); ++it) {
+    if (it->first == config) {
+      llama_sampler *sampler = it->second;
+      sampler_pool_.erase(std::next(it).base());
+      // Clears penalty history and reseeds the random sampler from its seed
+      llama_sampler_reset(sampler);
+      return sampler;
     }
   }
+  return create_sampler(config);
+}
+
+void LlamaModel::release_sampler(const SamplerConfig &config, llama_sampler *sampler) {
+  if (sampler_pool_.size() >= SAMPLER_POOL_SIZE) {
+    llama_sampler_free(sampler_pool_.front().second);
+    sampler_pool_.erase(sampler_pool_.begin());
+  }
+  sampler_pool_.emplace_back(config, sampler);
+}
 
-  // Add samplers to the chain
-  llama_sampler_chain_add(sampler_, llama_sampler_init_top_k(params.top_k));
-  llama_sampler_chain_add(sampler_, llama_sampler_init_top_p(params.top_p, 1));
-  llama_sampler_chain_add(sampler_, llama_sampler_init_temp(params.temperature));
-  llama_sampler_chain_add(sampler_, llama_sampler_init_dist(42)); // Random seed
+void LlamaModel::clear_sampler_pool() {
+  for (auto &entry : sampler_pool_) {
+    llama_sampler_free(entry.second);
+  }
+  sampler_pool_.clear();
 }
 
-std::vector<int32_t> LlamaModel::tokenize(const std::string &text, bool add_bos) {
+bool LlamaModel::load_lora_adapter(const std::string &name, const std::string &path,
+                                   std::string *error) {
+  auto it = std::find_if(lora_adapters_.begin(), lora_adapters_.end(),
+                         [&](const LoadedLoraAdapter &loaded) { return loaded.name == name; });
+  if (it != lora_adapters_.end()) {
+    if (it->path == path) {
+      return true;
+    }
+    if (error) {
+      *error = "LoRA adapter " + name + " is already loaded from: " + it->path;
+    }
+    return false;
+  }
+
+  llama_adapter_lora *adapter = llama_adapter_lora_init(model_, path.c_str());
+  if (!adapter) {
+    if (error) {
+      *error = "Failed to load LoRA adapter from: " + path;
+    }
+    return false;
+  }
+  lora_adapters_.push_back({name, path, adapter});
+  return true;
+}
+
+void LlamaModel::apply_lora(const LoraAdapters &lora) {
+  if (lora == lora_applied_) {
+    return;
+  }
+  llama_clear_adapter_lora(ctx_);
+  for (const auto &entry : lora) {
+    const std::string &name = entry.first;
+    auto it = std::find_if(lora_adapters_.begin(), lora_adapters_.end(),
+                           [&](const LoadedLoraAdapter &loaded) { return loaded.name == name; });
+    // Requests naming unknown adapters were rejected by prepare_prompt()
+    if (it != lora_adapters_.end()) {
+      llama_set_adapter_lora(ctx_, it->adapter, entry.second);
+    }
+  }
+  lora_applied_ = lora;
+}
+
+void LlamaModel::clear_lora_adapters() {
+  for (const LoadedLoraAdapter &loaded : lora_adapters_) {
+    llama_adapter_lora_free(loaded.adapter);
+  }
+  lora_adapters_.clear();
+  lora_group_.clear();
+  lora_applied_.clear();
+}
+
+// Show the end of the prompt to the penalties stage, so that the completion
+// does not repeat the prompt either
+static void accept_prompt(const Slot &slot) {
+  if (!slot.sampler_config.penalized()) {
+    return;
+  }
+  const size_t n = std::min<size_t>(slot.prompt_tokens.size(), slot.sampler_config.penalty_last_n);
+  for (size_t i = slot.prompt_tokens.size() - n; i < slot.prompt_tokens.size(); i++) {
+    llama_sampler_accept(slot.sampler, slot.prompt_tokens[i]);
+  }
+}
+
+int32_t LlamaModel::sample(Slot &slot, int32_t idx) {
+  // Greedy sampling needs neither a candidate array nor the chain
+  if (slot.greedy && !slot.grammar) {
+    const float *logits = llama_get_logits_ith(ctx_, idx);
+    const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model_));
+    return std::max_element(logits, logits + n_vocab) - logits;
+  }
+  if (!slot.grammar) {
+    return llama_sampler_sample(slot.sampler, ctx_, idx);
+  }
+
+  const float *logits = llama_get_logits_ith(ctx_, idx);
+  const int n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model_));
+  auto reset_candidates = [&]() {
+    candidates_.resize(n_vocab);
+    for (int i = 0; i < n_vocab; i++) {
+      candidates_[i] = llama_token_data{i, logits[i], 0.0f};
+    }
+    return llama_token_data_array{candidates_.data(), candidates_.size(), -1, false};
+  };
+
+  // Checking the grammar against the whole vocabulary is expensive, so sample
+  // from the chain first and only check the chosen token
+  llama_token_data_array cur = reset_candidates();
+  llama_sampler_apply(slot.sampler, &cur);
+  int32_t token = cur.data[cur.selected].id;
+
+  llama_token_data single = {token, 1.0f, 0.0f};
+  llama_token_data_array single_cur = {&single, 1, -1, false};
+  llama_sampler_apply(slot.grammar, &single_cur);
+
+  if (std::isinf(single.logit)) {
+    // Rejected by the grammar: constrain the full vocabulary and sample again
+    cur = reset_candidates();
+    llama_sampler_apply(slot.grammar, &cur);
+    llama_sampler_apply(slot.sampler, &cur);
+    token = cur.data[cur.selected].id;
+  }
+
+  llama_sampler_accept(slot.grammar, token);
+  llama_sampler_accept(slot.sampler, token);
+  return token;
+}
+
+llama_sampler *LlamaModel::grammar_sampler(const std::string &grammar) {
+  const size_t hash = std::hash<std::string>()(grammar);
+  auto it = grammar_index_.find(hash);
+  if (it != grammar_index_.end() && it->second->first == grammar) {
+    grammar_cache_.splice(grammar_cache_.begin(), grammar_cache_, it->second);
+    // The cached sampler never samples, so its clone starts in the initial state
+    llama_sampler *cached = it->second->second;
+    return cached ? llama_sampler_clone(cached) : nullptr;
+  }
+
+  // Parse once; grammars that fail to parse are cached too
   const llama_vocab *vocab = llama_model_get_vocab(model_);
+  llama_sampler *parsed = llama_sampler_init_grammar(vocab, grammar.c_str(), "root");
+
+  if (it != grammar_index_.end()) {
+    // Hash collision: the new grammar replaces the cached one
+    if (it->second->second) {
+      llama_sampler_free(it->second->second);
+    }
+    grammar_cache_.erase(it->second);
+  } else if (grammar_cache_.size() >= GRAMMAR_CACHE_SIZE) {
+    const GrammarCacheEntry &oldest = grammar_cache_.back();
+    grammar_index_.erase(std::hash<std::string>()(oldest.first));
+    if (oldest.second) {
+      llama_sampler_free(oldest.second);
+    }
+    grammar_cache_.pop_back();
+  }
+  grammar_cache_.emplace_front(grammar, parsed);
+  grammar_index_[hash] = grammar_cache_.begin();
 
-  // First, get the number of tokens needed
-  // When passing 0 for n_tokens_max, llama_tokenize returns negative of required size
-  int n_tokens = llama_tokenize(vocab, text.c_str(), text.length(), nullptr, 0, add_bos, true);
+  return parsed ? llama_sampler_clone(parsed) : nullptr;
+}
 
-  if (n_tokens < 0) {
-    n_tokens = -n_tokens; // Convert to positive size
+void LlamaModel::clear_grammar_cache() {
+  for (auto &entry : grammar_cache_) {
+    if (entry.second) {
+      llama_sampler_free(entry.second);
+    }
   }
+  grammar_cache_.clear();
+  grammar_index_.clear();
+}
 
-  if (n_tokens == 0) {
+std::vector<int32_t> LlamaModel::tokenize(const std::string &text, bool add_bos) {
+  const llama_vocab *vocab = llama_model_get_vocab(model_);
+
+  if (text.empty() && !add_bos) {
     return {}; // Empty input
   }
 
-  std::vector<int32_t> tokens(n_tokens);
+  // Nearly every token covers at least one byte of the text, so a buffer of
+  // that size (plus BOS/EOS and a space prefix) is enough in a single pass.
+  // llama_tokenize returns the negative of the required size otherwise.
+  std::vector<int32_t> tokens(text.size() + 4);
   int actual_tokens = llama_tokenize(vocab, text.c_str(), text.length(), tokens.data(),
                                      tokens.size(), add_bos, true);
 
   if (actual_tokens < 0) {
-    // Buffer still too small, resize and try again
+    // Buffer too small, resize and try again
     tokens.resize(-actual_tokens);
     actual_tokens = llama_tokenize(vocab, text.c_str(), text.length(), tokens.data(), tokens.size(),
                                    add_bos, true);
@@ -320,15 +1078,96 @@ std::vector<int32_t> LlamaModel::tokenize(const std::string &text, bool add_bos)
   return tokens;
 }
 
-std::string LlamaModel::detokenize(int32_t token) {
+std::vector<int32_t> LlamaModel::tokenize_prompt(const std::string &prompt) {
   const llama_vocab *vocab = llama_model_get_vocab(model_);
+  // An appended end-of-sequence token would end up in the middle of a longer prompt
+  if (llama_vocab_get_add_eos(vocab)) {
+    return tokenize(prompt, true);
+  }
 
-  char buf[256];
-  int n = llama_token_to_piece(vocab, token, buf, sizeof(buf), 0, true);
-  if (n < 0) {
-    return "";
+  // Find the cached prompt whose tokens cover the longest prefix of this one
+  auto best = prompt_cache_.end();
+  std::pair<size_t, size_t> resume = {0, 0};
+  for (auto it = prompt_cache_.begin(); it != prompt_cache_.end(); ++it) {
+    const size_t n = std::min(it->text.size(), prompt.size());
+    const size_t n_common =
+        std::mismatch(prompt.begin(), prompt.begin() + n, it->text.begin()).first - prompt.begin();
+    if (n_common == prompt.size() && n_common == it->text.size()) {
+      prompt_cache_.splice(prompt_cache_.begin(), prompt_cache_, it);
+      return it->tokens;
+    }
+    // The last resume point within the common prefix
+    auto point = std::upper_bound(it->boundaries.begin(), it->boundaries.end(),
+                                  std::make_pair(n_common, SIZE_MAX));
+    if (point != it->boundaries.begin() && std::prev(point)->first > resume.first) {
+      best = it;
+      resume = *std::prev(point);
+    }
+  }
+
+  PromptCacheEntry entry;
+  entry.text = prompt;
+  if (best != prompt_cache_.end()) {
+    entry.tokens.assign(best->tokens.begin(), best->tokens.begin() + resume.second);
+    for (const auto &point : best->boundaries) {
+      if (point.first > resume.first) {
+        break;
+      }
+      entry.boundaries.push_back(point);
+    }
+    const std::vector<int32_t> tail = tokenize(prompt.substr(resume.first), false);
+    entry.tokens.insert(entry.tokens.end(), tail.begin(), tail.end());
+    find_boundaries(entry, resume.second, resume.first);
+    // A conversation that grew replaces its previous prompt
+    if (prompt.compare(0, best->text.size(), best->text) == 0) {
+      prompt_cache_.erase(best);
+    }
+  } else {
+    entry.tokens = tokenize(prompt, true);
+    // A BOS token added by the tokenizer has no text
+    find_boundaries(entry, llama_vocab_get_add_bos(vocab) ? 1 : 0, 0);
+  }
+
+  if (entry.tokens.empty()) {
+    return {};
+  }
+  std::vector<int32_t> tokens = entry.tokens;
+  prompt_cache_.push_front(std::move(entry));
+  if (prompt_cache_.size() > PROMPT_CACHE_SIZE) {
+    prompt_cache_.pop_back();
+  }
+  return tokens;
+}
+
+void LlamaModel::find_boundaries(PromptCacheEntry &entry, size_t first, size_t pos) const {
+  const llama_vocab *vocab = llama_model_get_vocab(model_);
+  for (size_t i = first; i < entry.tokens.size(); i++) {
+    const llama_token_attr attr = llama_vocab_get_attr(vocab, entry.tokens[i]);
+    if (!(attr & LLAMA_TOKEN_ATTR_CONTROL)) {
+      continue;
+    }
+    // Control tokens appear in the text in the same order as in the tokens
+    const std::string_view piece = detokenize(entry.tokens[i]);
+    const size_t found = piece.empty() ? std::string::npos : entry.text.find(piece, pos);
+    if (found == std::string::npos) {
+      return;
+    }
+    pos = found + piece.size();
+    // Tokens that strip the whitespace after them affect the following text
+    if (!(attr & LLAMA_TOKEN_ATTR_RSTRIP)) {
+      entry.boundaries.emplace_back(pos, i + 1);
+    }
   }
-  return std::string(buf, n);
+}
+
+bool LlamaModel::valid_tokens(const std::vector<int32_t> &tokens) const {
+  const int32_t n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(model_));
+  return std::all_of(tokens.begin(), tokens.end(),
+                     [n_vocab](int32_t token) { return token >= 0 && token < n_vocab; });
+}
+
+std::string_view LlamaModel::detokenize(int32_t token) const {
+  return weights_->piece(token);
 }
 
 bool LlamaModel::is_eos_token(int32_t token) {
@@ -338,201 +1177,1237 @@ bool LlamaModel::is_eos_token(int32_t token) {
 
 GenerationResult LlamaModel::generate(const std::vector<ChatMessage> &messages,
                                       const GenerationParams &params) {
-  GenerationResult result;
-  result.finish_reason = "error";
+  return generate_streaming(messages, params, nullptr);
+}
 
-  if (!ctx_ || !model_) {
-    return result;
-  }
+GenerationResult LlamaModel::generate_streaming(const std::vector<ChatMessage> &messages,
+                                                const GenerationParams &params,
+                                                TokenCallback callback) {
+  std::promise<GenerationResult> promise;
+  std::future<GenerationResult> future = promise.get_future();
+  generate_async(messages, params, std::move(callback),
+                 [&promise](GenerationResult result) { promise.set_value(std::move(result)); });
+  return future.get();
+}
 
-  // Apply chat template to get the prompt
-  std::string prompt = apply_chat_template(messages);
-  if (prompt.empty()) {
-    return result;
+RequestId LlamaModel::generate_async(const std::vector<ChatMessage> &messages,
+                                     const GenerationParams &params, TokenCallback callback,
+                                     GenerationDoneCallback on_done) {
+  auto request = std::make_shared<GenerationRequest>();
+  request->messages = messages;
+  request->params = params;
+  request->callback = std::move(callback);
+  request->on_done = std::move(on_done);
+  if (params.timeout_ms > 0) {
+    request->deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(params.timeout_ms);
   }
+  enqueue(request);
+  return request->id;
+}
 
-  // Tokenize the prompt
-  std::vector<int32_t> prompt_tokens = tokenize(prompt, true);
-  result.prompt_tokens = prompt_tokens.size();
-  result.completion_tokens = 0;
-
-  // Clear the memory/KV cache
-  llama_memory_t mem = llama_get_memory(ctx_);
-  if (mem) {
-    llama_memory_clear(mem, true);
+RequestId LlamaModel::generate_tokens_async(std::vector<int32_t> prompt_tokens,
+                                            const GenerationParams &params, TokenCallback callback,
+                                            GenerationDoneCallback on_done) {
+  auto request = std::make_shared<GenerationRequest>();
+  request->prompt_tokens = std::move(prompt_tokens);
+  request->tokenized = true;
+  request->params = params;
+  request->callback = std::move(callback);
+  request->on_done = std::move(on_done);
+  if (params.timeout_ms > 0) {
+    request->deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(params.timeout_ms);
   }
+  enqueue(request);
+  return request->id;
+}
 
-  // Create sampler
-  create_sampler(params);
-
-  // Process prompt in chunks if it exceeds batch size (chunked prefill)
-  size_t n_tokens = prompt_tokens.size();
-  size_t n_processed = 0;
+bool LlamaModel::cancel(RequestId id) {
+  {
+    std::lock_guard<std::mutex> lock(scheduler_mutex_);
+    auto it = requests_.find(id);
+    if (it == requests_.end()) {
+      return false;
+    }
+    it->second->cancelled = true;
+  }
+  // Wake the scheduler so that a queued request completes right away
+  scheduler_cv_.notify_one();
+  return true;
+}
 
-  while (n_processed < n_tokens) {
-    size_t n_chunk = std::min(static_cast<size_t>(n_batch_), n_tokens - n_processed);
-    llama_batch batch = llama_batch_get_one(prompt_tokens.data() + n_processed, n_chunk);
+void LlamaModel::complete(GenerationRequest &request, GenerationResult result) {
+  {
+    std::lock_guard<std::mutex> lock(scheduler_mutex_);
+    requests_.erase(request.id);
+  }
+  if (request.type == RequestType::GENERATE) {
+    result.timings.total_ms = elapsed_ms(request.submitted, std::chrono::steady_clock::now());
+    metrics_.record_generation(result);
+  }
+  request.on_done(std::move(result));
+}
 
-    if (llama_decode(ctx_, batch) != 0) {
-      return result;
+bool LlamaModel::abort_callback(void *data) {
+  const auto *self = static_cast<const LlamaModel *>(data);
+  // Shutdown does not wait for the step (or an embedding batch) to finish
+  if (self->scheduler_stop_) {
+    return true;
+  }
+  if (self->batch_requests_.empty()) {
+    return false;
+  }
+  // Only abort when no sequence of the step still needs its result
+  const auto now = std::chrono::steady_clock::now();
+  for (const GenerationRequest *request : self->batch_requests_) {
+    if (!stop_reason(*request, now)) {
+      return false;
     }
-
-    n_processed += n_chunk;
   }
+  return true;
+}
 
-  // Generate tokens
-  std::string generated_text;
-  int n_cur = prompt_tokens.size();
+// Map the scheduler's result of a session request to a SessionResult
+static GenerationDoneCallback session_done(SessionDoneCallback on_done) {
+  return [on_done = std::move(on_done)](GenerationResult result) {
+    SessionResult session;
+    session.success = result.finish_reason == "stop";
+    session.n_tokens = result.prompt_tokens;
+    session.error = std::move(result.error);
+    on_done(std::move(session));
+  };
+}
 
-  for (int i = 0; i < params.max_tokens; i++) {
-    // Sample the next token
-    int32_t new_token = llama_sampler_sample(sampler_, ctx_, -1);
+SessionResult LlamaModel::save_session(const std::string &path,
+                                       const std::vector<ChatMessage> &messages) {
+  std::promise<SessionResult> promise;
+  std::future<SessionResult> future = promise.get_future();
+  save_session_async(path, messages,
+                     [&promise](SessionResult result) { promise.set_value(std::move(result)); });
+  return future.get();
+}
 
-    // Check for end of sequence
-    if (is_eos_token(new_token)) {
-      result.finish_reason = "stop";
-      break;
+SessionResult LlamaModel::load_session(const std::string &path) {
+  std::promise<SessionResult> promise;
+  std::future<SessionResult> future = promise.get_future();
+  load_session_async(path,
+                     [&promise](SessionResult result) { promise.set_value(std::move(result)); });
+  return future.get();
+}
+
+void LlamaModel::save_session_async(const std::string &path,
+                                    const std::vector<ChatMessage> &messages,
+                                    SessionDoneCallback on_done) {
+  auto request = std::make_shared<GenerationRequest>();
+  request->type = RequestType::SAVE_SESSION;
+  request->session_path = path;
+  request->messages = messages;
+  request->params.max_tokens = 0; // Prefill only
+  request->on_done = session_done(std::move(on_done));
+  enqueue(std::move(request));
+}
+
+void LlamaModel::load_session_async(const std::string &path, SessionDoneCallback on_done) {
+  auto request = std::make_shared<GenerationRequest>();
+  request->type = RequestType::LOAD_SESSION;
+  request->session_path = path;
+  request->on_done = session_done(std::move(on_done));
+  enqueue(std::move(request));
+}
+
+void LlamaModel::embed_async(const std::vector<std::string> &texts, EmbeddingEncoding encoding,
+                             EmbeddingDoneCallback on_done) {
+  post([this, texts, encoding, on_done = std::move(on_done)](bool run) {
+    // A task dropped on shutdown completes with an empty result
+    on_done(run ? embed(texts, encoding) : EmbeddingResult());
+  });
+}
+
+void LlamaModel::embed_tokens_async(std::vector<std::vector<int32_t>> tokens,
+                                    EmbeddingEncoding encoding, EmbeddingDoneCallback on_done) {
+  post([this, tokens = std::move(tokens), encoding,
+        on_done = std::move(on_done)](bool run) mutable {
+    on_done(run ? embed_tokens(std::move(tokens), encoding) : EmbeddingResult());
+  });
+}
+
+void LlamaModel::tokenize_async(std::vector<std::string> texts, bool add_special,
+                                TokenizeDoneCallback on_done) {
+  post([this, texts = std::move(texts), add_special, on_done = std::move(on_done)](bool run) {
+    TokenizeResult result;
+    if (run && model_) {
+      result.offsets.reserve(texts.size() + 1);
+      for (const std::string &text : texts) {
+        result.offsets.push_back(result.tokens.size());
+        const std::vector<int32_t> tokens = tokenize(text, add_special);
+        result.tokens.insert(result.tokens.end(), tokens.begin(), tokens.end());
+      }
+      result.offsets.push_back(result.tokens.size());
+      result.success = true;
     }
+    on_done(std::move(result));
+  });
+}
 
-    // Convert token to string
-    std::string token_str = detokenize(new_token);
-    generated_text += token_str;
-    result.completion_tokens++;
-
-    // Check for stop sequences
-    bool should_stop = false;
-    for (const auto &stop_seq : params.stop_sequences) {
-      if (generated_text.length() >= stop_seq.length()) {
-        if (generated_text.substr(generated_text.length() - stop_seq.length()) == stop_seq) {
-          // Remove the stop sequence from output
-          generated_text = generated_text.substr(0, generated_text.length() - stop_seq.length());
-          should_stop = true;
-          result.finish_reason = "stop";
+void LlamaModel::detokenize_async(std::vector<std::vector<int32_t>> tokens, bool special,
+                                  DetokenizeDoneCallback on_done) {
+  post([this, tokens = std::move(tokens), special, on_done = std::move(on_done)](bool run) {
+    DetokenizeResult result;
+    if (run && model_) {
+      const llama_vocab *vocab = llama_model_get_vocab(model_);
+      result.success = true;
+      result.texts.reserve(tokens.size());
+      for (const std::vector<int32_t> &text_tokens : tokens) {
+        if (!valid_tokens(text_tokens)) {
+          result.success = false;
           break;
         }
+        // Most pieces are short, so one pass usually suffices
+        std::string text(text_tokens.size() * 8, '\0');
+        int32_t n = llama_detokenize(vocab, text_tokens.data(), text_tokens.size(), text.data(),
+                                     text.size(), false, special);
+        if (n < 0) {
+          text.resize(-n);
+          n = llama_detokenize(vocab, text_tokens.data(), text_tokens.size(), text.data(),
+                               text.size(), false, special);
+        }
+        text.resize(std::max(n, 0));
+        result.texts.push_back(std::move(text));
+      }
+      if (!result.success) {
+        result.texts.clear();
       }
     }
-    if (should_stop)
-      break;
+    on_done(std::move(result));
+  });
+}
 
-    // Prepare for next iteration
-    llama_batch token_batch = llama_batch_get_one(&new_token, 1);
-    if (llama_decode(ctx_, token_batch) != 0) {
-      break;
+void LlamaModel::load_lora_adapter_async(std::string name, std::string path,
+                                         LoraAdapterDoneCallback on_done) {
+  post([this, name = std::move(name), path = std::move(path),
+        on_done = std::move(on_done)](bool run) {
+    LoraAdapterResult result;
+    if (!run || !ctx_) {
+      result.error = "Model was unloaded";
+    } else {
+      result.success = load_lora_adapter(name, path, &result.error);
+    }
+    on_done(std::move(result));
+  });
+}
+
+QueueStats LlamaModel::queue_stats() {
+  std::lock_guard<std::mutex> lock(scheduler_mutex_);
+  QueueStats stats;
+  stats.pending = pending_.size();
+  stats.active = n_active_;
+  return stats;
+}
+
+void LlamaModel::enqueue(std::shared_ptr<GenerationRequest> request) {
+  // Adapter sets are compared as a whole, so give them a canonical order
+  std::sort(request->params.lora.begin(), request->params.lora.end());
+  {
+    std::unique_lock<std::mutex> lock(scheduler_mutex_);
+    const char *error = nullptr;
+    if (!scheduler_thread_.joinable() || scheduler_stop_ || slots_.empty()) {
+      error = "No generation context";
+    } else if (max_queue_ > 0 && pending_.size() >= max_queue_) {
+      error = "Request queue is full";
+    } else if (request->params.n < 1 || static_cast<size_t>(request->params.n) > slots_.size()) {
+      error = "n must be between 1 and the number of parallel sequences";
     }
-    n_cur++;
+    if (error) {
+      GenerationResult result;
+      result.finish_reason = "error";
+      result.error = error;
+      lock.unlock();
+      if (request->type == RequestType::GENERATE) {
+        metrics_.record_generation(result);
+      }
+      request->on_done(std::move(result));
+      return;
+    }
+
+    request->id = next_request_id_++;
+    requests_[request->id] = request;
+    weights_->touch();
+
+    // Insert behind every request of the same or a higher priority
+    const int priority = request->params.priority;
+    auto it = std::find_if(pending_.begin(), pending_.end(), [priority](const auto &queued) {
+      return queued->params.priority < priority;
+    });
+    pending_.insert(it, std::move(request));
   }
+  scheduler_cv_.notify_one();
+}
 
-  if (result.finish_reason == "error" && result.completion_tokens >= params.max_tokens) {
-    result.finish_reason = "length";
-  } else if (result.finish_reason == "error") {
-    result.finish_reason = "stop";
+void LlamaModel::post(std::function<void(bool run)> task) {
+  {
+    std::unique_lock<std::mutex> lock(scheduler_mutex_);
+    if (!scheduler_thread_.joinable() || scheduler_stop_) {
+      lock.unlock();
+      task(false);
+      return;
+    }
+    tasks_.push_back(std::move(task));
   }
+  scheduler_cv_.notify_one();
+}
 
-  result.text = generated_text;
-  return result;
+void LlamaModel::start_scheduler(int n_seq_max) {
+  slots_.clear();
+  for (int i = 0; i < n_seq_max; i++) {
+    auto slot = std::make_unique<Slot>();
+    slot->seq_id = i;
+    slots_.push_back(std::move(slot));
+  }
+
+  scheduler_stop_ = false;
+  scheduler_thread_ = std::thread(&LlamaModel::scheduler_loop, this);
 }
 
-GenerationResult LlamaModel::generate_streaming(const std::vector<ChatMessage> &messages,
-                                                const GenerationParams &params,
-                                                TokenCallback callback) {
-  GenerationResult result;
-  result.finish_reason = "error";
+void LlamaModel::stop_scheduler() {
+  if (!scheduler_thread_.joinable()) {
+    return;
+  }
 
-  if (!ctx_ || !model_) {
-    return result;
+  {
+    std::lock_guard<std::mutex> lock(scheduler_mutex_);
+    scheduler_stop_ = true;
   }
+  scheduler_cv_.notify_all();
+  scheduler_thread_.join();
+  slots_.clear();
+}
 
-  // Apply chat template to get the prompt
-  std::string prompt = apply_chat_template(messages);
-  if (prompt.empty()) {
-    return result;
+void LlamaModel::scheduler_loop() {
+  llama_batch batch = llama_batch_init(n_batch_, 0, 1);
+
+  while (true) {
+    std::vector<std::shared_ptr<GenerationRequest>> admitted;
+    std::vector<std::shared_ptr<GenerationRequest>> dropped;
+    std::deque<std::function<void(bool run)>> tasks;
+    auto now = std::chrono::steady_clock::now();
+
+    {
+      std::unique_lock<std::mutex> lock(scheduler_mutex_);
+      // Slots retired during the previous step no longer count as active
+      n_active_ = std::count_if(slots_.begin(), slots_.end(), [](const auto &slot) {
+        return slot->state != SlotState::IDLE;
+      });
+      running_tasks_ = false;
+      scheduler_cv_.wait(lock, [this] {
+        if (scheduler_stop_ || !pending_.empty() || !tasks_.empty()) {
+          return true;
+        }
+        for (const auto &slot : slots_) {
+          if (slot->state != SlotState::IDLE) {
+            return true;
+          }
+        }
+        return false;
+      });
+
+      if (scheduler_stop_) {
+        break;
+      }
+
+      // Drop queued requests that were cancelled or timed out while waiting
+      now = std::chrono::steady_clock::now();
+      for (auto it = pending_.begin(); it != pending_.end();) {
+        if (stop_reason(**it, now)) {
+          dropped.push_back(std::move(*it));
+          it = pending_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+
+      // Take queued requests in queue order for as long as the idle slots can
+      // hold all of their choices. Adapters apply to the whole context, so
+      // only requests for the adapters of the running ones join them; the
+      // next adapter set takes over once those have finished. Requests for
+      // the running set may overtake older ones for another set, but only
+      // for as many admissions as there are slots, so that set is not starved.
+      size_t n_idle = 0;
+      for (const auto &slot : slots_) {
+        if (slot->state == SlotState::IDLE) {
+          n_idle++;
+        }
+      }
+      if (n_idle == slots_.size() && !pending_.empty()) {
+        lora_group_ = pending_.front()->params.lora;
+        lora_overtaken_ = 0;
+      }
+      size_t n_taken = 0;
+      bool overtaking = false;
+      for (auto it = pending_.begin(); it != pending_.end();) {
+        if ((*it)->params.lora != lora_group_) {
+          overtaking = true;
+          ++it;
+          continue;
+        }
+        if (n_taken + (*it)->params.n > n_idle ||
+            (overtaking && lora_overtaken_ >= slots_.size())) {
+          break;
+        }
+        if (overtaking) {
+          lora_overtaken_++;
+        }
+        n_taken += (*it)->params.n;
+        admitted.push_back(std::move(*it));
+        it = pending_.erase(it);
+      }
+      n_active_ = slots_.size() - n_idle + n_taken;
+      tasks.swap(tasks_);
+      running_tasks_ = !tasks.empty();
+    }
+
+    // Posted tasks run between decode steps, so they briefly pause generation
+    for (auto &task : tasks) {
+      task(true);
+    }
+
+    // Embedding contexts only run posted tasks
+    if (slots_.empty()) {
+      continue;
+    }
+
+    for (auto &request : dropped) {
+      GenerationResult result;
+      result.finish_reason = stop_reason(*request, now);
+      result.timings.queue_ms = elapsed_ms(request->submitted, now);
+      complete(*request, std::move(result));
+    }
+
+    // Stop running sequences that were cancelled or ran past their deadline
+    for (auto &slot : slots_) {
+      if (slot->state == SlotState::IDLE) {
+        continue;
+      }
+      if (const char *reason = stop_reason(*slot->request, now)) {
+        slot->result.finish_reason = reason;
+        retire(*slot);
+      }
+    }
+
+    // Tokenize outside the lock so new requests can still be queued
+    for (auto &request : admitted) {
+      if (request->type == RequestType::LOAD_SESSION) {
+        restore_session(*select_slot({}), *request);
+        continue;
+      }
+      request->timings.queue_ms = elapsed_ms(request->submitted, now);
+      std::string error;
+      if (!prepare_prompt(*request, &error)) {
+        GenerationResult result;
+        result.finish_reason = "error";
+        result.error = std::move(error);
+        result.timings = request->timings;
+        result.prompt_tokens = request->prompt_tokens.size();
+        complete(*request, std::move(result));
+        continue;
+      }
+      Slot &slot = *select_slot(request->prompt_tokens, request->params.lora);
+      admit(slot, request);
+      // The other choices take the least recently used slots
+      for (int i = 1; i < request->params.n; i++) {
+        Slot &fork = *select_slot({});
+        admit(fork, request, i);
+        slot.forks.push_back(&fork);
+      }
+    }
+
+    // Sequences that filled their context either make room or stop
+    const int n_ctx = n_ctx_seq();
+    for (auto &slot : slots_) {
+      if (slot->state == SlotState::GENERATE && slot->n_past >= n_ctx &&
+          (slot->request->params.overflow != ContextOverflow::SHIFT || !shift_context(*slot))) {
+        slot->result.finish_reason = "length";
+        retire(*slot);
+      }
+    }
+
+    if (n_draft_ > 0) {
+      const auto draft_start = std::chrono::steady_clock::now();
+      speculate(batch);
+      metrics_.record_draft(elapsed_ms(draft_start, std::chrono::steady_clock::now()));
+    }
+
+    // Build one mixed batch: one decode token (and the draft tokens to verify)
+    // for every generating sequence, then prompt chunks for prefilling
+    // sequences from the remaining budget
+    apply_lora(lora_group_);
+    batch.n_tokens = 0;
+    for (auto &slot : slots_) {
+      slot->i_batch = -1;
+      slot->in_batch = false;
+      if (slot->state == SlotState::GENERATE) {
+        slot->i_batch = batch.n_tokens;
+        slot->in_batch = true;
+        slot->cache_tokens.push_back(slot->next_token);
+        batch_add(batch, slot->next_token, slot->n_past++, slot->seq_id, true);
+        for (int32_t token : slot->draft) {
+          slot->cache_tokens.push_back(token);
+          batch_add(batch, token, slot->n_past++, slot->seq_id, true);
+        }
+      }
+    }
+    for (auto &slot : slots_) {
+      if (slot->state != SlotState::PREFILL) {
+        continue;
+      }
+      while (slot->n_prefilled < slot->prompt_tokens.size() && batch.n_tokens < n_batch_) {
+        // Only the last prompt token needs logits
+        const bool is_last = slot->n_prefilled + 1 == slot->prompt_tokens.size();
+        if (is_last) {
+          slot->i_batch = batch.n_tokens;
+        }
+        slot->in_batch = true;
+        slot->cache_tokens.push_back(slot->prompt_tokens[slot->n_prefilled]);
+        batch_add(batch, slot->prompt_tokens[slot->n_prefilled++], slot->n_past++, slot->seq_id,
+                  is_last);
+      }
+    }
+
+    if (batch.n_tokens == 0) {
+      continue;
+    }
+
+    batch_requests_.clear();
+    for (auto &slot : slots_) {
+      if (slot->in_batch) {
+        batch_requests_.push_back(slot->request.get());
+      }
+    }
+    const auto eval_start = std::chrono::steady_clock::now();
+    const int status = llama_decode(ctx_, batch);
+    now = std::chrono::steady_clock::now();
+    batch_requests_.clear();
+
+    // The step's time counts for every sequence that took part in it
+    const double eval_ms = elapsed_ms(eval_start, now);
+    metrics_.record_step(batch.n_tokens, eval_ms);
+    for (auto &slot : slots_) {
+      if (slot->in_batch) {
+        slot->result.timings.eval_ms += eval_ms;
+      }
+    }
+
+    if (status != 0) {
+      // Fail every sequence that took part in this step (or stop them if the
+      // step was aborted); their KV contents are unknown now, so they cannot
+      // be reused either
+      llama_memory_t mem = llama_get_memory(ctx_);
+      for (auto &slot : slots_) {
+        if (slot->in_batch) {
+          if (mem) {
+            llama_memory_seq_rm(mem, slot->seq_id, -1, -1);
+          }
+          slot->cache_tokens.clear();
+          if (scheduler_stop_) {
+            slot->result.error = "Model was unloaded";
+          } else if (const char *reason = stop_reason(*slot->request, now)) {
+            slot->result.finish_reason = reason;
+          }
+          retire(*slot);
+        }
+      }
+      continue;
+    }
+
+    // Choices of a request share its prefill: copy the prompt into their
+    // sequences and sample them from the same logits
+    for (auto &slot : slots_) {
+      if (slot->state == SlotState::PREFILL && slot->i_batch >= 0 && !slot->forks.empty()) {
+        fork(*slot);
+      }
+    }
+
+    // Sample the next token for every sequence that produced logits. With
+    // draft tokens, keep sampling at the following positions for as long as
+    // the samples match the draft; every emitted token is still a sample of
+    // the target model.
+    for (auto &slot : slots_) {
+      if (slot->i_batch < 0) {
+        continue;
+      }
+
+      if (slot->state == SlotState::PREFILL) {
+        slot->first_token_at = now;
+        slot->result.timings.prefill_ms = elapsed_ms(slot->admitted_at, now);
+        slot->result.timings.ttft_ms = elapsed_ms(slot->request->submitted, now);
+      }
+      slot->state = SlotState::GENERATE;
+      if (slot->result.completion_tokens >= slot->request->params.max_tokens) {
+        retire(*slot);
+        continue;
+      }
+
+      const size_t n_drafted = slot->draft.size();
+      size_t n_accepted = 0;
+      bool done = false;
+      for (size_t i = 0; i <= n_drafted; i++) {
+        const auto sample_start = std::chrono::steady_clock::now();
+        const int32_t new_token = sample(*slot, slot->i_batch + i);
+        slot->result.timings.sample_ms +=
+            elapsed_ms(sample_start, std::chrono::steady_clock::now());
+        if (!process_token(*slot, new_token)) {
+          done = true;
+          break;
+        }
+        if (i == n_drafted || new_token != slot->draft[i]) {
+          break;
+        }
+        n_accepted++;
+      }
+      slot->result.draft_tokens += n_drafted;
+      slot->result.accepted_tokens += n_accepted;
+      slot->draft.clear();
+
+      // Drop the rejected draft tokens from this sequence's KV cache
+      const size_t n_rejected = n_drafted - n_accepted;
+      if (n_rejected > 0) {
+        slot->n_past -= n_rejected;
+        slot->cache_tokens.resize(slot->cache_tokens.size() - n_rejected);
+        llama_memory_seq_rm(llama_get_memory(ctx_), slot->seq_id, slot->n_past, -1);
+      }
+
+      if (done) {
+        retire(*slot);
+      }
+    }
   }
 
-  // Tokenize the prompt
-  std::vector<int32_t> prompt_tokens = tokenize(prompt, true);
-  result.prompt_tokens = prompt_tokens.size();
-  result.completion_tokens = 0;
+  llama_batch_free(batch);
 
-  // Clear the memory/KV cache
-  llama_memory_t mem = llama_get_memory(ctx_);
-  if (mem) {
-    llama_memory_clear(mem, true);
+  // Fail in-flight and queued requests on shutdown
+  for (auto &slot : slots_) {
+    if (slot->state != SlotState::IDLE) {
+      slot->result.finish_reason = "error";
+      slot->result.error = "Model was unloaded";
+      retire(*slot);
+    }
+  }
+
+  std::deque<std::shared_ptr<GenerationRequest>> pending;
+  std::deque<std::function<void(bool run)>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(scheduler_mutex_);
+    pending.swap(pending_);
+    tasks.swap(tasks_);
+  }
+  for (auto &request : pending) {
+    GenerationResult result;
+    result.finish_reason = "error";
+    result.error = "Model was unloaded";
+    complete(*request, std::move(result));
+  }
+  for (auto &task : tasks) {
+    task(false);
+  }
+}
+
+// Prompt lookup: propose the tokens that followed the most recent earlier
+// occurrence of the last n tokens of a sequence
+static void lookup_draft(const std::vector<int32_t> &tokens, size_t n, size_t n_max,
+                         std::vector<int32_t> &draft) {
+  const size_t len = tokens.size();
+  if (len <= n) {
+    return;
+  }
+  const auto key = tokens.end() - n;
+  for (size_t start = len - n; start-- > 0;) {
+    if (std::equal(key, tokens.end(), tokens.begin() + start)) {
+      const size_t from = start + n;
+      const size_t count = std::min(n_max, len - from);
+      draft.assign(tokens.begin() + from, tokens.begin() + from + count);
+      return;
+    }
   }
+}
+
+void LlamaModel::speculate(llama_batch &batch) {
+  const int n_ctx = n_ctx_seq();
+  llama_memory_t mem = draft_ctx_ ? llama_get_memory(draft_ctx_) : nullptr;
 
-  // Create sampler
-  create_sampler(params);
+  std::vector<Slot *> drafting;
+  for (auto &slot : slots_) {
+    slot->draft.clear();
+    if (slot->state != SlotState::GENERATE) {
+      continue;
+    }
+    // A step emits at most one token more than it drafts, and every draft
+    // token needs room in the sequence
+    const int remaining = slot->request->params.max_tokens - slot->result.completion_tokens;
+    const int n_draft = std::min({n_draft_, remaining - 1, n_ctx - slot->n_past - 1});
+    if (n_draft <= 0) {
+      continue;
+    }
+    slot->n_draft_max = n_draft;
+
+    // Copying spans of the prompt (e.g. extraction) needs no draft model
+    if (n_lookup_ > 0) {
+      slot->cache_tokens.push_back(slot->next_token);
+      lookup_draft(slot->cache_tokens, n_lookup_, slot->n_draft_max, slot->draft);
+      slot->cache_tokens.pop_back();
+      if (!slot->draft.empty()) {
+        continue;
+      }
+    }
+    if (!draft_ctx_) {
+      continue;
+    }
 
-  // Process prompt in chunks if it exceeds batch size (chunked prefill)
-  size_t n_tokens = prompt_tokens.size();
-  size_t n_processed = 0;
+    // Keep the part of the draft sequence that still matches the target sequence
+    size_t n_keep = common_prefix_length(slot->draft_cache_tokens, slot->cache_tokens);
+    if (mem && !llama_memory_seq_rm(mem, slot->seq_id, n_keep, -1)) {
+      llama_memory_seq_rm(mem, slot->seq_id, -1, -1);
+      n_keep = 0;
+    }
+    slot->draft_cache_tokens.resize(n_keep);
+    drafting.push_back(slot.get());
+  }
 
-  while (n_processed < n_tokens) {
-    size_t n_chunk = std::min(static_cast<size_t>(n_batch_), n_tokens - n_processed);
-    llama_batch batch = llama_batch_get_one(prompt_tokens.data() + n_processed, n_chunk);
+  const int n_vocab = draft_model_
+                          ? std::min(llama_vocab_n_tokens(llama_model_get_vocab(model_)),
+                                     llama_vocab_n_tokens(llama_model_get_vocab(draft_model_)))
+                          : 0;
+
+  // Each round feeds the draft model every token it has not seen yet (cached
+  // tokens, the pending token, then earlier drafts) and drafts one greedy token
+  while (!drafting.empty()) {
+    batch.n_tokens = 0;
+    for (Slot *slot : drafting) {
+      slot->i_draft = -1;
+      const size_t n_cached = slot->cache_tokens.size();
+      const size_t n_known = n_cached + 1 + slot->draft.size();
+      while (slot->draft_cache_tokens.size() < n_known && batch.n_tokens < n_batch_) {
+        const size_t pos = slot->draft_cache_tokens.size();
+        const int32_t token = pos < n_cached    ? slot->cache_tokens[pos]
+                              : pos == n_cached ? slot->next_token
+                                                : slot->draft[pos - n_cached - 1];
+        const bool is_last = pos + 1 == n_known;
+        if (is_last) {
+          slot->i_draft = batch.n_tokens;
+        }
+        slot->draft_cache_tokens.push_back(token);
+        batch_add(batch, token, pos, slot->seq_id, is_last);
+      }
+    }
 
-    if (llama_decode(ctx_, batch) != 0) {
-      return result;
+    if (llama_decode(draft_ctx_, batch) != 0) {
+      // Drafting is only an optimization: decode without drafts this step
+      for (Slot *slot : drafting) {
+        if (mem) {
+          llama_memory_seq_rm(mem, slot->seq_id, -1, -1);
+        }
+        slot->draft_cache_tokens.clear();
+        slot->draft.clear();
+      }
+      return;
     }
 
-    n_processed += n_chunk;
+    for (auto it = drafting.begin(); it != drafting.end();) {
+      Slot *slot = *it;
+      if (slot->i_draft >= 0) {
+        const float *logits = llama_get_logits_ith(draft_ctx_, slot->i_draft);
+        const int32_t token = std::max_element(logits, logits + n_vocab) - logits;
+        slot->draft.push_back(token);
+        // Nothing follows the end of the sequence
+        if (is_eos_token(token)) {
+          slot->n_draft_max = slot->draft.size();
+        }
+      }
+      if (slot->draft.size() >= slot->n_draft_max) {
+        it = drafting.erase(it);
+      } else {
+        ++it;
+      }
+    }
   }
+}
 
-  // Generate tokens
-  std::string generated_text;
-  int n_cur = prompt_tokens.size();
+int LlamaModel::n_ctx_seq() const {
+  // Embedding contexts have no slots and a single sequence
+  return slots_.empty() ? llama_n_ctx(ctx_) : llama_n_ctx(ctx_) / slots_.size();
+}
 
-  for (int i = 0; i < params.max_tokens; i++) {
-    // Sample the next token
-    int32_t new_token = llama_sampler_sample(sampler_, ctx_, -1);
+bool LlamaModel::prepare_prompt(GenerationRequest &request, std::string *error) {
+  for (const auto &entry : request.params.lora) {
+    const std::string &name = entry.first;
+    if (std::none_of(lora_adapters_.begin(), lora_adapters_.end(),
+                     [&](const LoadedLoraAdapter &loaded) { return loaded.name == name; })) {
+      if (error) {
+        *error = "Unknown LoRA adapter: " + name;
+      }
+      return false;
+    }
+  }
 
-    // Check for end of sequence
-    if (is_eos_token(new_token)) {
-      result.finish_reason = "stop";
-      break;
+  // Session prefixes are rendered without the assistant prompt so that they
+  // stay a prefix of later conversations
+  const bool add_assistant = request.type != RequestType::SAVE_SESSION;
+  if (request.tokenized) {
+    // Pre-tokenized prompts skip the template and the tokenizer
+    if (request.prompt_tokens.empty() || !valid_tokens(request.prompt_tokens)) {
+      if (error) {
+        *error = request.prompt_tokens.empty() ? "Prompt has no tokens"
+                                               : "Prompt has tokens outside the vocabulary";
+      }
+      return false;
+    }
+  } else {
+    // Apply chat template to get the prompt
+    auto start = std::chrono::steady_clock::now();
+    std::string prompt = apply_chat_template(request.messages, add_assistant);
+    auto end = std::chrono::steady_clock::now();
+    request.timings.template_ms += elapsed_ms(start, end);
+    if (prompt.empty()) {
+      return false;
     }
 
-    // Convert token to string
-    std::string token_str = detokenize(new_token);
-    generated_text += token_str;
-    result.completion_tokens++;
+    // Tokenize the prompt
+    start = end;
+    request.prompt_tokens = tokenize_prompt(prompt);
+    end = std::chrono::steady_clock::now();
+    request.timings.tokenize_ms += elapsed_ms(start, end);
+    if (request.prompt_tokens.empty()) {
+      return false;
+    }
+  }
 
-    // Call the callback with the new token
-    if (!callback(token_str)) {
-      result.finish_reason = "stop";
-      break;
+  // Nothing to do if the whole conversation fits
+  const GenerationParams &params = request.params;
+  const size_t n_ctx = n_ctx_seq();
+  const size_t n_prompt = request.prompt_tokens.size();
+  if (n_prompt + std::max(params.max_tokens, 0) <= n_ctx) {
+    return true;
+  }
+  const ContextOverflow overflow =
+      request.type == RequestType::GENERATE ? params.overflow : ContextOverflow::ERROR;
+
+  // Leading system messages are never dropped
+  size_t n_system = 0;
+  while (n_system < request.messages.size() && request.messages[n_system].role == "system") {
+    n_system++;
+  }
+
+  if (overflow == ContextOverflow::SHIFT) {
+    // Keep the system prompt (or just BOS) at the start of the sequence, but
+    // at most half of it so that shifting still frees room
+    size_t n_keep = request.prompt_tokens[0] == llama_vocab_bos(llama_model_get_vocab(model_));
+    if (n_system > 0) {
+      const std::vector<ChatMessage> system(request.messages.begin(),
+                                            request.messages.begin() + n_system);
+      n_keep = common_prefix_length(tokenize(apply_chat_template(system, false), true),
+                                    request.prompt_tokens);
     }
+    n_keep = std::min(n_keep, n_ctx / 2);
+    request.n_keep = n_keep;
+
+    // Longer prompts keep their start and the most recent half of the rest;
+    // the generation shifts the context further as it fills up
+    if (n_prompt >= n_ctx) {
+      const size_t n_tail = (n_ctx - n_keep) / 2;
+      request.prompt_tokens.erase(request.prompt_tokens.begin() + n_keep,
+                                  request.prompt_tokens.end() - n_tail);
+      request.n_discarded = n_prompt - request.prompt_tokens.size();
+    }
+    return true;
+  }
 
-    // Check for stop sequences
-    bool should_stop = false;
-    for (const auto &stop_seq : params.stop_sequences) {
-      if (generated_text.length() >= stop_seq.length()) {
-        if (generated_text.substr(generated_text.length() - stop_seq.length()) == stop_seq) {
-          should_stop = true;
-          result.finish_reason = "stop";
-          break;
-        }
+  if (overflow == ContextOverflow::TRUNCATE_MIDDLE && request.messages.size() > n_system + 1) {
+    // Leave room for the completion, but never drop history to generate more
+    // than half of the context
+    const size_t n_budget = n_ctx - std::min<size_t>(std::max(params.max_tokens, 1), n_ctx / 2);
+    const size_t n_middle = request.messages.size() - 1 - n_system;
+
+    // Drop the n oldest messages after the system prompt (and the replies up
+    // to the next user message, so the conversation still starts with one)
+    auto drop = [&](size_t n) {
+      while (n < n_middle && request.messages[n_system + n].role != "user") {
+        n++;
+      }
+      std::vector<ChatMessage> kept(request.messages.begin(), request.messages.begin() + n_system);
+      kept.insert(kept.end(), request.messages.begin() + n_system + n, request.messages.end());
+      return kept;
+    };
+
+    // Binary search for the fewest dropped messages that fit into the budget
+    std::vector<ChatMessage> best;
+    std::vector<int32_t> best_tokens;
+    size_t lo = 1;
+    size_t hi = n_middle;
+    while (lo <= hi) {
+      const size_t mid = lo + (hi - lo) / 2;
+      std::vector<ChatMessage> kept = drop(mid);
+      std::vector<int32_t> tokens = tokenize(apply_chat_template(kept, add_assistant), true);
+      if (!tokens.empty() && tokens.size() <= n_budget) {
+        best = std::move(kept);
+        best_tokens = std::move(tokens);
+        hi = mid - 1;
+      } else {
+        lo = mid + 1;
       }
     }
-    if (should_stop)
-      break;
+    if (best_tokens.empty()) {
+      // Without the whole middle, use the oldest messages only if that fits at all
+      best = drop(n_middle);
+      best_tokens = tokenize(apply_chat_template(best, add_assistant), true);
+    }
+    if (!best_tokens.empty() && best_tokens.size() < n_prompt) {
+      request.messages = std::move(best);
+      request.prompt_tokens = std::move(best_tokens);
+      request.n_discarded = n_prompt - request.prompt_tokens.size();
+    }
+  }
+
+  if (request.prompt_tokens.size() > n_ctx) {
+    if (error) {
+      *error = "Prompt has " + std::to_string(request.prompt_tokens.size()) +
+               " tokens, which exceeds the context size of " + std::to_string(n_ctx);
+    }
+    return false;
+  }
+  return true;
+}
 
-    // Prepare for next iteration
-    llama_batch token_batch = llama_batch_get_one(&new_token, 1);
-    if (llama_decode(ctx_, token_batch) != 0) {
+bool LlamaModel::shift_context(Slot &slot) {
+  llama_memory_t mem = llama_get_memory(ctx_);
+  const int n_keep = slot.n_keep;
+  const int n_discard = (slot.n_past - n_keep) / 2;
+  if (!mem || n_discard <= 0 || !llama_memory_can_shift(mem)) {
+    return false;
+  }
+
+  llama_memory_seq_rm(mem, slot.seq_id, n_keep, n_keep + n_discard);
+  llama_memory_seq_add(mem, slot.seq_id, n_keep + n_discard, slot.n_past, -n_discard);
+  slot.cache_tokens.erase(slot.cache_tokens.begin() + n_keep,
+                          slot.cache_tokens.begin() + n_keep + n_discard);
+  slot.n_past -= n_discard;
+  slot.result.discarded_tokens += n_discard;
+
+  // Shift the draft model's copy of the sequence the same way, or let
+  // speculate() rebuild it from the kept prefix
+  if (draft_ctx_) {
+    llama_memory_t draft_mem = llama_get_memory(draft_ctx_);
+    std::vector<int32_t> &draft_tokens = slot.draft_cache_tokens;
+    if (draft_tokens.size() >= static_cast<size_t>(n_keep + n_discard) &&
+        llama_memory_can_shift(draft_mem)) {
+      llama_memory_seq_rm(draft_mem, slot.seq_id, n_keep, n_keep + n_discard);
+      llama_memory_seq_add(draft_mem, slot.seq_id, n_keep + n_discard, -1, -n_discard);
+      draft_tokens.erase(draft_tokens.begin() + n_keep,
+                         draft_tokens.begin() + n_keep + n_discard);
+    } else {
+      const size_t n_valid = std::min<size_t>(draft_tokens.size(), n_keep);
+      llama_memory_seq_rm(draft_mem, slot.seq_id, n_valid, -1);
+      draft_tokens.resize(n_valid);
+    }
+  }
+  return true;
+}
+
+Slot *LlamaModel::select_slot(const std::vector<int32_t> &prompt_tokens,
+                              const LoraAdapters &lora) {
+  Slot *best = nullptr;
+  size_t best_prefix = 0;
+
+  for (auto &slot : slots_) {
+    if (slot->state != SlotState::IDLE) {
+      continue;
+    }
+    const size_t prefix =
+        slot->cache_lora == lora ? common_prefix_length(slot->cache_tokens, prompt_tokens) : 0;
+    // Prefer the longest reusable prefix, then the least recently used slot so
+    // that warm caches of other conversations survive as long as possible
+    if (!best || prefix > best_prefix ||
+        (prefix == best_prefix && slot->last_used < best->last_used)) {
+      best = slot.get();
+      best_prefix = prefix;
+    }
+  }
+
+  return best;
+}
+
+void LlamaModel::restore_session(Slot &slot, GenerationRequest &request) {
+  GenerationResult result;
+  result.finish_reason = "error";
+
+  llama_memory_t mem = llama_get_memory(ctx_);
+  if (mem) {
+    llama_memory_seq_rm(mem, slot.seq_id, -1, -1);
+  }
+  slot.cache_tokens.clear();
+  slot.cache_lora.clear();
+  slot.last_used = ++admission_counter_;
+
+  // A sequence can hold at most its share of the context
+  std::vector<int32_t> tokens(n_ctx_seq());
+  size_t n_tokens = 0;
+  if (llama_state_seq_load_file(ctx_, request.session_path.c_str(), slot.seq_id, tokens.data(),
+                                tokens.size(), &n_tokens) > 0) {
+    tokens.resize(n_tokens);
+    slot.cache_tokens = std::move(tokens);
+    result.prompt_tokens = n_tokens;
+    result.finish_reason = "stop";
+  } else if (mem) {
+    // Do not leave a partially restored sequence behind
+    llama_memory_seq_rm(mem, slot.seq_id, -1, -1);
+  }
+
+  complete(request, std::move(result));
+}
+
+void LlamaModel::admit(Slot &slot, std::shared_ptr<GenerationRequest> request, size_t choice) {
+  slot.request = std::move(request);
+  slot.state = choice == 0 ? SlotState::PREFILL : SlotState::FORK;
+  slot.choice = choice;
+  slot.forks.clear();
+  slot.last_used = ++admission_counter_;
+  slot.result = GenerationResult();
+  slot.result.finish_reason = "error";
+  slot.result.timings = slot.request->timings;
+  slot.admitted_at = std::chrono::steady_clock::now();
+  // The output buffer keeps its capacity across requests
+  slot.generated_text.clear();
+  slot.generated_text.reserve(
+      std::min<size_t>(slot.request->params.max_tokens, n_ctx_seq()) * 4);
+  slot.stop_matcher = StopMatcher(slot.request->params.stop_sequences);
+  slot.n_streamed = 0;
+
+  slot.sampler_config = sampler_config(slot.request->params, choice);
+  slot.sampler = acquire_sampler(slot.sampler_config);
+  slot.greedy = slot.sampler_config.plain_greedy();
+  if (!slot.request->params.grammar.empty()) {
+    slot.grammar = grammar_sampler(slot.request->params.grammar);
+  }
+  if (choice > 0) {
+    return;
+  }
+
+  slot.prompt_tokens = std::move(slot.request->prompt_tokens);
+  accept_prompt(slot);
+  slot.result.prompt_tokens = slot.prompt_tokens.size();
+  slot.result.discarded_tokens = slot.request->n_discarded;
+  slot.n_keep = slot.request->n_keep;
+
+  // Reuse the longest common prefix of the previous request's tokens, unless
+  // they were decoded with other adapters. At least the last prompt token is
+  // always decoded again to produce fresh logits.
+  if (slot.cache_lora != slot.request->params.lora) {
+    slot.cache_tokens.clear();
+    slot.cache_lora = slot.request->params.lora;
+  }
+  size_t n_reuse = common_prefix_length(slot.cache_tokens, slot.prompt_tokens);
+  n_reuse = std::min(n_reuse, slot.prompt_tokens.size() - 1);
+
+  // Remove only the divergent tail from this sequence's memory/KV cache
+  llama_memory_t mem = llama_get_memory(ctx_);
+  if (mem && !llama_memory_seq_rm(mem, slot.seq_id, n_reuse, -1)) {
+    // Partial removal is not supported (e.g. recurrent models): start over
+    llama_memory_seq_rm(mem, slot.seq_id, -1, -1);
+    n_reuse = 0;
+  }
+  slot.cache_tokens.resize(n_reuse);
+  slot.n_prefilled = n_reuse;
+  slot.n_past = n_reuse;
+  slot.result.cached_tokens = n_reuse;
+}
+
+void LlamaModel::fork(Slot &slot) {
+  llama_memory_t mem = llama_get_memory(ctx_);
+  for (Slot *fork : slot.forks) {
+    if (mem) {
+      llama_memory_seq_rm(mem, fork->seq_id, -1, -1);
+      llama_memory_seq_cp(mem, slot.seq_id, fork->seq_id, -1, -1);
+    }
+    fork->prompt_tokens = slot.prompt_tokens;
+    accept_prompt(*fork);
+    fork->cache_tokens = slot.cache_tokens;
+    fork->cache_lora = slot.cache_lora;
+    fork->n_prefilled = slot.n_prefilled;
+    fork->n_past = slot.n_past;
+    fork->n_keep = slot.n_keep;
+    fork->result.prompt_tokens = slot.result.prompt_tokens;
+    fork->admitted_at = slot.admitted_at;
+    // Sample from the logits of the shared last prompt token
+    fork->i_batch = slot.i_batch;
+    fork->state = SlotState::PREFILL;
+  }
+  slot.forks.clear();
+}
+
+bool LlamaModel::process_token(Slot &slot, int32_t token) {
+  const GenerationParams &params = slot.request->params;
+  GenerationResult &result = slot.result;
+  std::string &generated_text = slot.generated_text;
+  // Only the first choice is streamed
+  const bool streaming = slot.request->callback && slot.choice == 0;
+
+  // Check for end of sequence
+  if (is_eos_token(token)) {
+    result.finish_reason = "stop";
+    return false;
+  }
+
+  // Look up the token's text
+  const std::string_view piece = detokenize(token);
+  result.completion_tokens++;
+  if (params.return_tokens) {
+    result.tokens.push_back(token);
+  }
+
+  // Feed the piece to the stop sequence matcher; text after a match is dropped
+  size_t n_piece = piece.size();
+  size_t n_stop = 0;
+  for (size_t i = 0; i < piece.size(); i++) {
+    n_stop = slot.stop_matcher.feed(piece[i]);
+    if (n_stop > 0) {
+      n_piece = i + 1;
       break;
     }
-    n_cur++;
+  }
+  generated_text.append(piece.data(), n_piece);
+  // Remove the stop sequence from output. It was never streamed, because text
+  // that may still become a stop sequence is held back.
+  generated_text.resize(generated_text.size() - n_stop);
+
+  // Call the callback with the text that cannot be part of a stop sequence
+  // anymore, up to the last complete UTF-8 character
+  if (streaming) {
+    const size_t n_safe = generated_text.size() - (n_stop > 0 ? 0 : slot.stop_matcher.pending());
+    const std::string_view ready = std::string_view(generated_text).substr(
+        slot.n_streamed, n_safe > slot.n_streamed ? n_safe - slot.n_streamed : 0);
+    const size_t n_ready = utf8_complete_length(ready.data(), ready.size());
+    if (n_ready > 0) {
+      const auto callback_start = std::chrono::steady_clock::now();
+      const bool keep_going = slot.request->callback(ready.substr(0, n_ready));
+      result.timings.callback_ms +=
+          elapsed_ms(callback_start, std::chrono::steady_clock::now());
+      slot.n_streamed += n_ready;
+      if (!keep_going) {
+        result.finish_reason = "stop";
+        return false;
+      }
+    }
   }
 
-  if (result.finish_reason == "error" && result.completion_tokens >= params.max_tokens) {
-    result.finish_reason = "length";
-  } else if (result.finish_reason == "error") {
+  if (n_stop > 0) {
     result.finish_reason = "stop";
+    return false;
   }
 
-  result.text = generated_text;
-  return result;
+  if (result.completion_tokens >= params.max_tokens) {
+    result.finish_reason = "length";
+    return false;
+  }
+
+  // Decode the token in the next step
+  slot.next_token = token;
+  return true;
+}
+
+// Combine the results of a request's choices: the first one provides the text
+// and the prompt statistics, while token counts and per-choice work add up
+static GenerationResult merge_choices(std::vector<GenerationResult> &choices) {
+  GenerationResult merged = choices[0];
+  for (size_t i = 1; i < choices.size(); i++) {
+    const GenerationResult &choice = choices[i];
+    merged.completion_tokens += choice.completion_tokens;
+    merged.draft_tokens += choice.draft_tokens;
+    merged.accepted_tokens += choice.accepted_tokens;
+    // Choices decode in the same steps, so their decode times overlap
+    merged.timings.eval_ms = std::max(merged.timings.eval_ms, choice.timings.eval_ms);
+    merged.timings.decode_ms = std::max(merged.timings.decode_ms, choice.timings.decode_ms);
+    merged.timings.sample_ms += choice.timings.sample_ms;
+  }
+  merged.choices.reserve(choices.size());
+  for (GenerationResult &choice : choices) {
+    merged.choices.push_back(
+        {std::move(choice.text), choice.completion_tokens, std::move(choice.finish_reason),
+         std::move(choice.tokens)});
+  }
+  return merged;
+}
+
+void LlamaModel::retire(Slot &slot) {
+  GenerationResult &result = slot.result;
+
+  // A sequence that stopped during generation without an explicit reason
+  // (e.g. a failed decode) still returns its partial output
+  if (slot.state == SlotState::GENERATE && result.finish_reason == "error" &&
+      result.error.empty()) {
+    result.finish_reason =
+        result.completion_tokens >= slot.request->params.max_tokens ? "length" : "stop";
+  }
+
+  // Choices still waiting for this slot's prompt end with it
+  for (Slot *fork : slot.forks) {
+    if (fork->state == SlotState::FORK) {
+      fork->result.finish_reason = result.finish_reason;
+      fork->result.error = result.error;
+      retire(*fork);
+    }
+  }
+  slot.forks.clear();
+
+  // Persist the prefilled prompt prefix together with its tokens
+  if (slot.request->type == RequestType::SAVE_SESSION) {
+    const bool prefilled = slot.state == SlotState::GENERATE && result.error.empty() &&
+                           slot.cache_tokens.size() == slot.prompt_tokens.size();
+    const bool saved =
+        prefilled && llama_state_seq_save_file(ctx_, slot.request->session_path.c_str(),
+                                               slot.seq_id, slot.cache_tokens.data(),
+                                               slot.cache_tokens.size()) > 0;
+    result.finish_reason = saved ? "stop" : "error";
+  }
+
+  // Deliver the text held back for the stop sequence matcher or UTF-8 assembly
+  auto now = std::chrono::steady_clock::now();
+  if (slot.request->callback && slot.choice == 0 &&
+      slot.n_streamed < slot.generated_text.size()) {
+    slot.request->callback(std::string_view(slot.generated_text).substr(slot.n_streamed));
+    const auto callback_end = std::chrono::steady_clock::now();
+    result.timings.callback_ms += elapsed_ms(now, callback_end);
+    now = callback_end;
+  }
+  if (slot.state == SlotState::GENERATE) {
+    result.timings.decode_ms = elapsed_ms(slot.first_token_at, now);
+  } else {
+    result.timings.prefill_ms = elapsed_ms(slot.admitted_at, now);
+  }
+
+  // Copy instead of moving so that the slot keeps its output buffer
+  result.text = slot.generated_text;
+  GenerationRequest &request = *slot.request;
+  if (request.params.n > 1) {
+    if (request.choices.empty()) {
+      request.choices.resize(request.params.n);
+    }
+    request.choices[slot.choice] = std::move(result);
+    if (++request.n_finished == request.choices.size()) {
+      complete(request, merge_choices(request.choices));
+    }
+  } else {
+    complete(request, std::move(result));
+  }
+
+  if (slot.sampler) {
+    release_sampler(slot.sampler_config, slot.sampler);
+    slot.sampler = nullptr;
+  }
+  if (slot.grammar) {
+    llama_sampler_free(slot.grammar);
+    slot.grammar = nullptr;
+  }
+  slot.request.reset();
+  slot.generated_text.clear();
+  slot.state = SlotState::IDLE;
 }
 
 } // namespace llama_wrapper
@@ -1,80 +1,223 @@
 #ifndef LLAMA_WRAPPER_H
 #define LLAMA_WRAPPER_H
 
+#include "metrics.h"
+#include "model-registry.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <functional>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 // Forward declarations for llama.cpp types
 struct llama_model;
 struct llama_context;
 struct llama_sampler;
+struct llama_batch;
+struct llama_token_data;
+struct llama_adapter_lora;
 
 namespace llama_wrapper {
 
-struct ModelParams {
-  std::string model_path;
-  int n_gpu_layers = 99; // Use GPU by default if available
-  bool use_mmap = true;
-  bool use_mlock = false;
-  bool debug = false; // Show verbose llama.cpp output
-  std::string chat_template =
-      "auto"; // "auto" uses template from model, or specify a built-in template
-};
-
 struct ChatMessage {
   std::string role;
   std::string content;
 };
 
+// LoRA adapters by the name they were loaded under, with their scales
+using LoraAdapters = std::vector<std::pair<std::string, float>>;
+
 struct ContextParams {
-  int n_ctx = 2048;       // Context size
-  int n_batch = 512;      // Batch size for prompt processing
-  int n_threads = 4;      // Number of threads
-  bool embedding = false; // Enable embedding mode with mean pooling
+  int n_ctx = 2048;        // Context size (per sequence)
+  int n_batch = 512;       // Batch size for prompt processing
+  int n_ubatch = 0;        // Physical batch size (0 = llama.cpp default, at most n_batch)
+  int n_threads = 4;       // Number of threads for token generation
+  int n_threads_batch = 0; // Number of threads for prompt processing (0 = n_threads)
+  int n_seq_max = 1;       // Number of sequences decoded concurrently (continuous batching)
+  int max_queue = 0;       // Maximum number of waiting requests (0 = unlimited)
+  int n_draft = 8;         // Tokens drafted per decode step (draft model or prompt lookup)
+  int n_lookup = 0;        // N-gram length for prompt-lookup drafts (0 = disabled)
+  bool embedding = false;  // Enable embedding mode with mean pooling
+  bool warmup = false;     // Run throwaway decodes so the first request sees steady-state latency
+
+  // KV cache types: f32, f16, bf16, q8_0, q4_0, q4_1, iq4_nl, q5_0 or q5_1.
+  // Quantized value caches need flash attention.
+  std::string type_k = "f16";
+  std::string type_v = "f16";
+  std::string flash_attn = "auto"; // "auto" (enabled where the backend supports it), "on" or "off"
+
+  // LoRA adapters to load for generation requests, by name and file path
+  std::vector<std::pair<std::string, std::string>> lora_adapters;
+};
+
+// What to do when a conversation does not fit into a sequence's context
+enum class ContextOverflow {
+  ERROR,           // Reject prompts that do not fit; stop with "length" when the context is full
+  SHIFT,           // Keep the system prompt and discard the oldest half of the rest (KV shift)
+  TRUNCATE_MIDDLE, // Drop the oldest messages after the system prompt before tokenization
 };
 
 struct GenerationParams {
   int max_tokens = 256;
   float temperature = 0.7f;
   float top_p = 0.9f;
-  int top_k = 40;
-  float repeat_penalty = 1.1f;
+  int top_k = 40;                 // 0 = disabled
+  float min_p = 0.0f;             // 0 = disabled
+  float typical_p = 1.0f;         // Locally typical sampling (1 = disabled)
+  float repeat_penalty = 1.0f;    // 1 = disabled
+  float frequency_penalty = 0.0f; // 0 = disabled
+  float presence_penalty = 0.0f;  // 0 = disabled
+  int penalty_last_n = 64;        // Recent tokens the penalties look at (-1 = whole sequence)
+  int64_t seed = -1;              // Seed of the random sampler (-1 = random)
   std::vector<std::string> stop_sequences;
   std::string grammar; // GBNF grammar string for structured output
+  int priority = 0;    // Higher priorities are admitted first, FIFO within a priority
+  int timeout_ms = 0;  // Deadline measured from submission, including queueing (0 = none)
+  ContextOverflow overflow = ContextOverflow::ERROR;
+  int n = 1; // Completions sampled from one shared prefill, each in its own sequence
+  bool return_tokens = false; // Also return the ids of the generated tokens
+  LoraAdapters lora;          // Adapters applied on top of the base weights (empty = none)
+};
+
+// Settings that determine the stages of a sampler chain
+struct SamplerConfig {
+  float temperature = 0.0f;
+  int top_k = 0;
+  float top_p = 1.0f;
+  float min_p = 0.0f;
+  float typical_p = 1.0f;
+  float repeat_penalty = 1.0f;
+  float frequency_penalty = 0.0f;
+  float presence_penalty = 0.0f;
+  int penalty_last_n = 0;
+  uint32_t seed = 0;
+
+  bool operator==(const SamplerConfig &other) const;
+  // Whether the chain has a penalties stage, which tracks the sequence's tokens
+  bool penalized() const;
+  // Whether sampling picks the most likely token without any other stage
+  bool plain_greedy() const;
+};
+
+// One of the n completions of a request
+struct GenerationChoice {
+  std::string text;
+  int completion_tokens = 0;
+  std::string finish_reason;
+  std::vector<int32_t> tokens; // With return_tokens
 };
 
 struct GenerationResult {
   std::string text;
-  int prompt_tokens;
-  int completion_tokens;
-  std::string finish_reason; // "stop", "length", or "error"
+  int prompt_tokens = 0;
+  int completion_tokens = 0;
+  int cached_tokens = 0;     // Prompt tokens reused from the KV cache of a previous request
+  int draft_tokens = 0;      // Tokens proposed by the draft model
+  int accepted_tokens = 0;   // Proposed tokens that matched the target model's samples
+  int discarded_tokens = 0;  // Prompt or context tokens dropped to fit the context
+  std::string finish_reason; // "stop", "length", "cancelled", "timeout", or "error"
+  std::string error;         // Why the request was rejected (e.g. queue full), if it was
+  GenerationTimings timings;
+  std::vector<int32_t> tokens; // Generated token ids without end of sequence (with return_tokens)
+  // With n > 1, every completion in order; text and finish_reason are those of
+  // the first one, while the token counts cover all of them
+  std::vector<GenerationChoice> choices;
+};
+
+struct SessionResult {
+  bool success = false;
+  int n_tokens = 0; // Tokens covered by the saved/restored state
+  std::string error;
+};
+
+struct LoraAdapterResult {
+  bool success = false;
+  std::string error;
+};
+
+struct TokenizeResult {
+  bool success = false;
+  std::vector<int32_t> tokens; // Tokens of all texts, concatenated
+  std::vector<size_t> offsets; // Start of each text's tokens, followed by the end
+};
+
+struct DetokenizeResult {
+  bool success = false;
+  std::vector<std::string> texts;
+};
+
+struct QueueStats {
+  size_t pending = 0; // Requests waiting for a free sequence
+  size_t active = 0;  // Requests currently being decoded
+};
+
+// Output format of embedding vectors (all are L2-normalized first)
+enum class EmbeddingEncoding {
+  FLOAT32, // float per dimension
+  FLOAT16, // IEEE half-precision bits per dimension
+  INT8,    // int8 per dimension, multiply by the row's scale to dequantize
+  BINARY,  // one sign bit per dimension (x > 0), packed MSB-first
 };
 
 struct EmbeddingResult {
-  std::vector<std::vector<float>> embeddings; // One embedding vector per input text
-  int total_tokens;
+  EmbeddingEncoding encoding = EmbeddingEncoding::FLOAT32;
+  std::vector<uint8_t> data; // One row per input text, stored contiguously
+  size_t row_bytes = 0;      // Size of each row in data
+  std::vector<float> scales; // Per-row dequantization scale (INT8 only)
+  int n_embd = 0;
+  int total_tokens = 0;
+  double tokenize_ms = 0; // Tokenizing the texts
+  double eval_ms = 0;     // Decoding the batches
+  double total_ms = 0;
 };
 
-// Token callback for streaming: returns false to stop generation
-using TokenCallback = std::function<bool(const std::string &token)>;
+// Identifies a queued or running generation request of one model
+using RequestId = uint64_t;
+
+// Token callback for streaming: receives the next complete UTF-8 characters of
+// the output (usually one token); returns false to stop generation
+using TokenCallback = std::function<bool(std::string_view text)>;
+
+// Completion callbacks of asynchronous requests, invoked exactly once on the
+// model's scheduler thread (or on the calling thread if the request is rejected)
+using GenerationDoneCallback = std::function<void(GenerationResult result)>;
+using SessionDoneCallback = std::function<void(SessionResult result)>;
+using EmbeddingDoneCallback = std::function<void(EmbeddingResult result)>;
+using TokenizeDoneCallback = std::function<void(TokenizeResult result)>;
+using LoraAdapterDoneCallback = std::function<void(LoraAdapterResult result)>;
+using DetokenizeDoneCallback = std::function<void(DetokenizeResult result)>;
+
+// Scheduler internals (defined in llama-wrapper.cpp)
+struct GenerationRequest;
+struct Slot;
 
 class LlamaModel {
 public:
   LlamaModel();
   ~LlamaModel();
 
-  // Disable copy
+  // Disable copy and move (the scheduler thread holds a pointer to this instance).
+  // Destroying the model completes its outstanding requests with an error.
   LlamaModel(const LlamaModel &) = delete;
   LlamaModel &operator=(const LlamaModel &) = delete;
 
-  // Enable move
-  LlamaModel(LlamaModel &&other) noexcept;
-  LlamaModel &operator=(LlamaModel &&other) noexcept;
+  // Load a model (and its draft model, if any) from GGUF files. Weights that
+  // are already loaded by another instance with the same parameters are shared.
+  // On failure, error (if given) is set to the reason if there is one.
+  bool load(const ModelParams &params, std::string *error = nullptr);
 
-  // Load a model from a GGUF file
-  bool load(const ModelParams &params);
+  // Share the weights and chat template of another loaded model, e.g. to
+  // create a second context with different parameters over the same weights.
+  // Fails if the other model is not loaded (or was evicted meanwhile).
+  bool load_from(const LlamaModel &other);
 
   // Check if model is loaded
   bool is_loaded() const;
@@ -85,42 +228,308 @@ public:
   // Get the model path
   const std::string &get_model_path() const { return model_path_; }
 
-  // Create a context for inference (or embeddings if params.embedding is true)
-  bool create_context(const ContextParams &params);
+  // Create a context for inference (or embeddings if params.embedding is true).
+  // On failure, error (if given) is set to the reason, or left empty if
+  // llama.cpp could not create the context.
+  bool create_context(const ContextParams &params, std::string *error = nullptr);
 
   // Apply chat template to messages and return formatted prompt
-  std::string apply_chat_template(const std::vector<ChatMessage> &messages);
+  std::string apply_chat_template(const std::vector<ChatMessage> &messages,
+                                  bool add_assistant = true);
 
-  // Generate text from messages (non-streaming)
+  // Generate text from messages (non-streaming).
+  // Safe to call from multiple threads: concurrent requests are batched onto
+  // separate sequences of the shared context by the scheduler.
   GenerationResult generate(const std::vector<ChatMessage> &messages,
                             const GenerationParams &params);
 
-  // Generate text from messages (streaming)
+  // Generate text from messages (streaming). The callback runs on the scheduler thread.
   GenerationResult generate_streaming(const std::vector<ChatMessage> &messages,
                                       const GenerationParams &params, TokenCallback callback);
 
-  // Generate embeddings for multiple texts
-  EmbeddingResult embed(const std::vector<std::string> &texts);
+  // Queue a generation and return immediately; on_done receives the result.
+  // callback may be empty for non-streaming requests.
+  RequestId generate_async(const std::vector<ChatMessage> &messages,
+                           const GenerationParams &params, TokenCallback callback,
+                           GenerationDoneCallback on_done);
+
+  // Queue a generation from prompt tokens instead of messages. The tokens are
+  // decoded as given, so they include BOS and the chat template's markup.
+  RequestId generate_tokens_async(std::vector<int32_t> prompt_tokens,
+                                  const GenerationParams &params, TokenCallback callback,
+                                  GenerationDoneCallback on_done);
+
+  // Cancel a queued or running request. It completes with finish reason
+  // "cancelled" and the text generated so far; a running decode step is
+  // interrupted once every sequence in it is cancelled or past its deadline.
+  // Returns false if the request has already completed.
+  bool cancel(RequestId id);
+
+  // Prefill a prompt prefix (e.g. a system prompt) on an idle sequence and save
+  // the sequence state together with its tokens to a file
+  SessionResult save_session(const std::string &path, const std::vector<ChatMessage> &messages);
+
+  // Restore a saved prompt prefix into an idle sequence. Later requests that
+  // start with the same tokens reuse it instead of prefilling it again.
+  SessionResult load_session(const std::string &path);
+
+  // Asynchronous variants of save_session/load_session
+  void save_session_async(const std::string &path, const std::vector<ChatMessage> &messages,
+                          SessionDoneCallback on_done);
+  void load_session_async(const std::string &path, SessionDoneCallback on_done);
+
+  // Number of queued and running generation requests
+  QueueStats queue_stats();
+
+  // Counters and latency histograms of all requests on this context so far
+  MetricsSnapshot get_metrics() const { return metrics_.snapshot(); }
+
+  // Generate embeddings for multiple texts (calls on one model are serialized)
+  EmbeddingResult embed(const std::vector<std::string> &texts,
+                        EmbeddingEncoding encoding = EmbeddingEncoding::FLOAT32);
+
+  // Run embed() on the context's scheduler thread; on_done receives the result
+  void embed_async(const std::vector<std::string> &texts, EmbeddingEncoding encoding,
+                   EmbeddingDoneCallback on_done);
+
+  // embed() for texts that are already tokenized; token lists with ids outside
+  // the vocabulary get a zero embedding like texts that do not fit a batch
+  EmbeddingResult embed_tokens(std::vector<std::vector<int32_t>> tokens,
+                               EmbeddingEncoding encoding = EmbeddingEncoding::FLOAT32);
+  void embed_tokens_async(std::vector<std::vector<int32_t>> tokens, EmbeddingEncoding encoding,
+                          EmbeddingDoneCallback on_done);
+
+  // Tokenize texts on the scheduler thread. add_special adds the BOS/EOS tokens
+  // the model expects; control tokens written in the texts are always parsed.
+  void tokenize_async(std::vector<std::string> texts, bool add_special,
+                      TokenizeDoneCallback on_done);
+
+  // Text of token lists on the scheduler thread; special renders control
+  // tokens as text instead of leaving them out
+  void detokenize_async(std::vector<std::vector<int32_t>> tokens, bool special,
+                        DetokenizeDoneCallback on_done);
+
+  // Load a LoRA adapter of the base model under a name that requests select it
+  // by (see GenerationParams::lora). Loading a name again with the same path
+  // does nothing; the adapters stay loaded until the model is released.
+  void load_lora_adapter_async(std::string name, std::string path,
+                               LoraAdapterDoneCallback on_done);
 
 private:
-  llama_model *model_ = nullptr;
+  // Guards the weights and model pointers, which eviction releases on another
+  // thread while is_loaded() and load_from() may read them
+  mutable std::mutex weights_mutex_;
+  std::shared_ptr<ModelWeights> weights_;
+  std::shared_ptr<ModelWeights> draft_weights_;
+  llama_model *model_ = nullptr; // Model of weights_
   llama_context *ctx_ = nullptr;
-  llama_sampler *sampler_ = nullptr;
+  llama_model *draft_model_ = nullptr; // Proposes tokens for ctx_ to verify (optional)
+  llama_context *draft_ctx_ = nullptr; // Mirrors the sequences of ctx_
+  int n_draft_ = 0;                    // Draft tokens per step (0 = no speculative decoding)
+  int n_lookup_ = 0;                   // N-gram length for prompt-lookup drafts (0 = disabled)
   std::string model_path_;
+  std::string draft_model_path_;
   std::string chat_template_;
   int n_batch_ = 512; // Batch size for prompt processing
 
+  // Continuous-batching scheduler: one slot per sequence id of ctx_ (none for
+  // embedding contexts). The scheduler thread also runs posted tasks, so all
+  // inference happens on this thread instead of the caller's.
+  std::vector<std::unique_ptr<Slot>> slots_;
+  std::deque<std::shared_ptr<GenerationRequest>> pending_;
+  std::deque<std::function<void(bool run)>> tasks_; // Invoked with false on shutdown
+  std::mutex scheduler_mutex_;
+  std::condition_variable scheduler_cv_;
+  std::thread scheduler_thread_;
+  // Written under scheduler_mutex_; also read by the abort callback mid-decode
+  std::atomic<bool> scheduler_stop_{false};
+  size_t max_queue_ = 0;
+  size_t n_active_ = 0; // Requests owned by the scheduler thread (guarded by scheduler_mutex_)
+  // Posted tasks taken by the scheduler thread (guarded by scheduler_mutex_)
+  bool running_tasks_ = false;
+  uint64_t admission_counter_ = 0;
+
+  // Incomplete generation requests by id, for cancellation (guarded by scheduler_mutex_)
+  std::unordered_map<RequestId, std::shared_ptr<GenerationRequest>> requests_;
+  RequestId next_request_id_ = 1;
+
+  // Candidate buffer for grammar-constrained sampling (scheduler thread only)
+  std::vector<llama_token_data> candidates_;
+
+  // Requests decoded by the current llama_decode step, read by the abort callback
+  std::vector<const GenerationRequest *> batch_requests_;
+
+  // Synchronous embed() calls from other threads take turns with posted ones
+  std::mutex embed_mutex_;
+
+  Metrics metrics_;
+
+  // Parsed grammar samplers by hash of their GBNF text, most recently used
+  // first. Requests get a clone (scheduler thread only).
+  using GrammarCacheEntry = std::pair<std::string, llama_sampler *>;
+  std::list<GrammarCacheEntry> grammar_cache_;
+  std::unordered_map<size_t, std::list<GrammarCacheEntry>::iterator> grammar_index_;
+
+  // A rendered prompt with its tokens and the points where tokenizing may
+  // resume: text offsets right after a control token with the number of
+  // tokens up to there. Control tokens are split off before the text between
+  // them is tokenized, so the tokens before such a point never change.
+  struct PromptCacheEntry {
+    std::string text;
+    std::vector<int32_t> tokens;
+    std::vector<std::pair<size_t, size_t>> boundaries;
+  };
+
+  // Recently tokenized prompts, most recently used first (scheduler thread only)
+  std::list<PromptCacheEntry> prompt_cache_;
+
+  // Sampler chains of retired requests by their settings, oldest first. They
+  // are reset and reused instead of being rebuilt (scheduler thread only).
+  std::vector<std::pair<SamplerConfig, llama_sampler *>> sampler_pool_;
+
+  // Loaded LoRA adapters by name with their paths (scheduler thread only)
+  struct LoadedLoraAdapter {
+    std::string name;
+    std::string path;
+    llama_adapter_lora *adapter;
+  };
+  std::vector<LoadedLoraAdapter> lora_adapters_;
+  // Adapters are set on the whole context, so all running requests share one
+  // adapter set (changed under scheduler_mutex_ by the scheduler thread)
+  LoraAdapters lora_group_;
+  LoraAdapters lora_applied_; // Adapter set currently set on ctx_
+  // Requests of lora_group_ admitted past an older request for another set
+  size_t lora_overtaken_ = 0;
+
+  // Queue a request for the scheduler; its on_done callback receives the result
+  void enqueue(std::shared_ptr<GenerationRequest> request);
+
+  // Run a task on the scheduler thread between decode steps
+  void post(std::function<void(bool run)> task);
+
+  // Forget a finished request and hand its result to on_done
+  void complete(GenerationRequest &request, GenerationResult result);
+
+  // llama.cpp abort callback: stops a decode step nobody is waiting for anymore
+  static bool abort_callback(void *data);
+
+  // Restore a session file into an idle slot (scheduler thread)
+  void restore_session(Slot &slot, GenerationRequest &request);
+
+  // Free the context and release the weights
+  void release();
+
+  // Registry eviction: release() unless a request or task is queued or running
+  bool release_if_idle();
+
+  // Start/stop the scheduler thread for the current context
+  void start_scheduler(int n_seq_max);
+  void stop_scheduler();
+
+  // Scheduler thread main loop
+  void scheduler_loop();
+
+  // Apply the chat template and tokenize a request's prompt, fitting it into
+  // the context according to its overflow policy. On failure, error is set to
+  // the reason if there is one.
+  bool prepare_prompt(GenerationRequest &request, std::string *error);
+
+  // Context size of a single sequence
+  int n_ctx_seq() const;
+
+  // Make room at the end of a full sequence by discarding the older half of
+  // the tokens after its kept prefix and shifting the rest back; returns false
+  // if the memory cannot be shifted
+  bool shift_context(Slot &slot);
+
+  // Pick the idle slot whose cached tokens share the longest prefix with the
+  // prompt, counting only caches computed with the same adapters
+  Slot *select_slot(const std::vector<int32_t> &prompt_tokens, const LoraAdapters &lora = {});
+
+  // Assign a prepared request to an idle slot, reusing its cached prompt prefix.
+  // Further choices of the request wait in their own slots until fork() copies
+  // the prefilled prompt into them.
+  void admit(Slot &slot, std::shared_ptr<GenerationRequest> request, size_t choice = 0);
+
+  // Copy the prefilled prompt of a slot into the sequences of its waiting choices
+  void fork(Slot &slot);
+
+  // Propose the next tokens of every generating slot, from the sequence itself
+  // (prompt lookup) or the draft model
+  void speculate(llama_batch &batch);
+
+  // Handle a freshly sampled token for a slot; returns false when the slot is done
+  bool process_token(Slot &slot, int32_t token);
+
+  // Complete the slot's choice of its request and return the slot to the idle
+  // pool; the request completes once all of its choices have
+  void retire(Slot &slot);
+
   // Tokenize a string
   std::vector<int32_t> tokenize(const std::string &text, bool add_bos);
 
-  // Normalize an embedding vector (L2 normalization)
-  static void normalize_embedding(float *embedding, int n_embd);
+  // Whether every token id is part of the vocabulary
+  bool valid_tokens(const std::vector<int32_t> &tokens) const;
+
+  // Shared implementation of embed() (texts given) and embed_tokens()
+  EmbeddingResult embed_batch(const std::vector<std::string> *texts,
+                              std::vector<std::vector<int32_t>> tokens,
+                              EmbeddingEncoding encoding);
+
+  // Tokenize a rendered prompt (with BOS), reusing the tokens of the cached
+  // prompt that shares the longest prefix with it up to a control token, so
+  // that a conversation that grew by a message only tokenizes the new tail
+  std::vector<int32_t> tokenize_prompt(const std::string &prompt);
+
+  // Record where tokenizing the entry's text may resume, for the tokens from
+  // index first on, whose text starts at offset pos
+  void find_boundaries(PromptCacheEntry &entry, size_t first, size_t pos) const;
+
+  // Copy an embedding vector while applying L2 normalization
+  static void normalize_embedding(const float *src, float *dst, int n_embd);
+
+  // Write a normalized embedding into its output row in the requested encoding
+  static void encode_embedding(const float *embedding, int n_embd, EmbeddingEncoding encoding,
+                               uint8_t *row, float *scale);
+
+  // Text of a single token
+  std::string_view detokenize(int32_t token) const;
+
+  // Sampler settings of a request's choice; the seed differs between choices
+  SamplerConfig sampler_config(const GenerationParams &params, size_t choice) const;
+
+  // Create a sampler chain for the settings, leaving out stages that would not
+  // change the result (caller owns the result). The grammar is not part of it.
+  static llama_sampler *create_sampler(const SamplerConfig &config);
+
+  // Pooled sampler chain for the settings in its initial state, or a new one
+  llama_sampler *acquire_sampler(const SamplerConfig &config);
+
+  // Return a chain to the pool, freeing the least recently returned one when full
+  void release_sampler(const SamplerConfig &config, llama_sampler *sampler);
+
+  // Free all pooled sampler chains
+  void clear_sampler_pool();
+
+  // Load an adapter unless one is loaded under the name already; error is set
+  // when that fails or the name belongs to another file
+  bool load_lora_adapter(const std::string &name, const std::string &path, std::string *error);
+
+  // Set the adapters of ctx_ to the given set if they differ
+  void apply_lora(const LoraAdapters &lora);
+
+  // Free all loaded adapters
+  void clear_lora_adapters();
+
+  // Sample a token for a slot from the logits at batch index idx, honoring its grammar
+  int32_t sample(Slot &slot, int32_t idx);
 
-  // Detokenize a single token
-  std::string detokenize(int32_t token);
+  // Fresh grammar sampler for a GBNF grammar, or null if it does not parse
+  // (caller owns the result)
+  llama_sampler *grammar_sampler(const std::string &grammar);
 
-  // Create sampler with given params
-  void create_sampler(const GenerationParams &params);
+  // Free all cached grammar samplers
+  void clear_grammar_cache();
 
   // Check if token is end-of-sequence
   bool is_eos_token(int32_t token);
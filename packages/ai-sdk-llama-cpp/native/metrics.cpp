@@ -0,0 +1,107 @@
+#include "metrics.h"
+#include "llama-wrapper.h"
+#include <algorithm>
+
+namespace llama_wrapper {
+
+// Bucket bounds in seconds for request latencies and for per-token latencies
+static const std::vector<double> LATENCY_BOUNDS = {0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5,
+                                                   1,     2.5,  5,     10,   30,  60,   120};
+static const std::vector<double> TOKEN_BOUNDS = {0.001, 0.0025, 0.005, 0.01, 0.02, 0.035,
+                                                 0.05,  0.075,  0.1,   0.25, 0.5,  1};
+
+Metrics::Histogram::Histogram(std::vector<double> bounds)
+    : bounds_(std::move(bounds)), counts_(bounds_.size() + 1, 0) {}
+
+void Metrics::Histogram::observe(double value) {
+  // The first bucket whose upper bound is not below the value
+  counts_[std::lower_bound(bounds_.begin(), bounds_.end(), value) - bounds_.begin()]++;
+  sum_ += value;
+}
+
+HistogramSnapshot Metrics::Histogram::snapshot() const {
+  HistogramSnapshot snapshot;
+  snapshot.bounds = bounds_;
+  snapshot.counts.reserve(bounds_.size());
+  for (size_t i = 0; i < bounds_.size(); i++) {
+    snapshot.count += counts_[i];
+    snapshot.counts.push_back(snapshot.count);
+  }
+  snapshot.count += counts_.back();
+  snapshot.sum = sum_;
+  return snapshot;
+}
+
+Metrics::Metrics()
+    : queue_wait_(LATENCY_BOUNDS), time_to_first_token_(LATENCY_BOUNDS),
+      time_per_output_token_(TOKEN_BOUNDS), request_duration_(LATENCY_BOUNDS),
+      embedding_duration_(LATENCY_BOUNDS) {}
+
+void Metrics::record_generation(const GenerationResult &result) {
+  const GenerationTimings &timings = result.timings;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = std::find_if(totals_.requests.begin(), totals_.requests.end(),
+                         [&](const auto &entry) { return entry.first == result.finish_reason; });
+  if (it == totals_.requests.end()) {
+    totals_.requests.emplace_back(result.finish_reason, 1);
+  } else {
+    it->second++;
+  }
+  totals_.prompt_tokens += result.prompt_tokens;
+  totals_.cached_prompt_tokens += result.cached_tokens;
+  totals_.completion_tokens += result.completion_tokens;
+  totals_.draft_tokens += result.draft_tokens;
+  totals_.accepted_draft_tokens += result.accepted_tokens;
+  totals_.discarded_tokens += result.discarded_tokens;
+
+  // Decode time is recorded per step, since steps are shared between requests
+  totals_.template_seconds += timings.template_ms / 1000;
+  totals_.tokenize_seconds += timings.tokenize_ms / 1000;
+  totals_.sample_seconds += timings.sample_ms / 1000;
+  totals_.callback_seconds += timings.callback_ms / 1000;
+
+  queue_wait_.observe(timings.queue_ms / 1000);
+  request_duration_.observe(timings.total_ms / 1000);
+  if (result.completion_tokens > 0) {
+    time_to_first_token_.observe(timings.ttft_ms / 1000);
+  }
+  if (result.completion_tokens > 1) {
+    time_per_output_token_.observe(timings.decode_ms / 1000 / (result.completion_tokens - 1));
+  }
+}
+
+void Metrics::record_embedding(const EmbeddingResult &result, size_t n_texts) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  totals_.embedding_requests++;
+  totals_.embedding_texts += n_texts;
+  totals_.embedding_tokens += result.total_tokens;
+  totals_.tokenize_seconds += result.tokenize_ms / 1000;
+  totals_.eval_seconds += result.eval_ms / 1000;
+  embedding_duration_.observe(result.total_ms / 1000);
+}
+
+void Metrics::record_step(int n_tokens, double eval_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  totals_.decode_steps++;
+  totals_.decode_tokens += n_tokens;
+  totals_.eval_seconds += eval_ms / 1000;
+}
+
+void Metrics::record_draft(double draft_ms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  totals_.draft_seconds += draft_ms / 1000;
+}
+
+MetricsSnapshot Metrics::snapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  MetricsSnapshot snapshot = totals_;
+  snapshot.queue_wait = queue_wait_.snapshot();
+  snapshot.time_to_first_token = time_to_first_token_.snapshot();
+  snapshot.time_per_output_token = time_per_output_token_.snapshot();
+  snapshot.request_duration = request_duration_.snapshot();
+  snapshot.embedding_duration = embedding_duration_.snapshot();
+  return snapshot;
+}
+
+} // namespace llama_wrapper
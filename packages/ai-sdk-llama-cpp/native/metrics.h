@@ -0,0 +1,109 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llama_wrapper {
+
+struct GenerationResult;
+struct EmbeddingResult;
+
+// Where the time of a single generation request went, in milliseconds
+struct GenerationTimings {
+  double queue_ms = 0;    // Submission until the scheduler picked the request up
+  double template_ms = 0; // Chat template rendering
+  double tokenize_ms = 0; // Prompt tokenization
+  double prefill_ms = 0;  // Admission until the first completion token was sampled
+  double decode_ms = 0;   // First completion token until the end of the request
+  double eval_ms = 0;     // llama_decode time of the steps the sequence took part in
+  double sample_ms = 0;   // Sampling, including grammar checks
+  double callback_ms = 0; // Streaming token callbacks (staging text and queueing flushes)
+  double ttft_ms = 0;     // Submission until the first completion token (0 if there was none)
+  double total_ms = 0;    // Submission until completion
+};
+
+// Histogram with fixed upper bounds in seconds, in the cumulative layout of
+// Prometheus histograms
+struct HistogramSnapshot {
+  std::vector<double> bounds;   // Ascending upper bounds, excluding +Inf
+  std::vector<uint64_t> counts; // Observations less than or equal to each bound
+  uint64_t count = 0;           // All observations (the +Inf bucket)
+  double sum = 0;
+};
+
+struct MetricsSnapshot {
+  // Finished generation requests by finish reason
+  std::vector<std::pair<std::string, uint64_t>> requests;
+  uint64_t prompt_tokens = 0;
+  uint64_t cached_prompt_tokens = 0;
+  uint64_t completion_tokens = 0;
+  uint64_t draft_tokens = 0;
+  uint64_t accepted_draft_tokens = 0;
+  uint64_t discarded_tokens = 0;
+
+  uint64_t embedding_requests = 0;
+  uint64_t embedding_texts = 0;
+  uint64_t embedding_tokens = 0;
+
+  uint64_t decode_steps = 0;  // Decode calls of the scheduler
+  uint64_t decode_tokens = 0; // Tokens in those decode calls
+
+  // Seconds spent in each phase, summed over all requests
+  double template_seconds = 0;
+  double tokenize_seconds = 0;
+  double eval_seconds = 0;  // Decode calls of the scheduler and embeddings
+  double draft_seconds = 0; // Speculative drafting
+  double sample_seconds = 0;
+  double callback_seconds = 0;
+
+  HistogramSnapshot queue_wait;            // Seconds until a request was picked up
+  HistogramSnapshot time_to_first_token;   // Seconds from submission to the first token
+  HistogramSnapshot time_per_output_token; // Seconds per completion token after the first
+  HistogramSnapshot request_duration;      // Seconds from submission to completion
+  HistogramSnapshot embedding_duration;    // Seconds per embed() call
+};
+
+// Aggregated counters and histograms of one model context. Updated by the
+// scheduler thread, read from any thread.
+class Metrics {
+public:
+  Metrics();
+
+  void record_generation(const GenerationResult &result);
+  void record_embedding(const EmbeddingResult &result, size_t n_texts);
+
+  // A decode call of the scheduler over n_tokens tokens
+  void record_step(int n_tokens, double eval_ms);
+  void record_draft(double draft_ms);
+
+  MetricsSnapshot snapshot() const;
+
+private:
+  class Histogram {
+  public:
+    explicit Histogram(std::vector<double> bounds);
+    void observe(double value);
+    HistogramSnapshot snapshot() const;
+
+  private:
+    std::vector<double> bounds_;
+    std::vector<uint64_t> counts_; // Per bucket, the last one is +Inf
+    double sum_ = 0;
+  };
+
+  mutable std::mutex mutex_;
+  MetricsSnapshot totals_; // Counters only; histograms are kept below
+  Histogram queue_wait_;
+  Histogram time_to_first_token_;
+  Histogram time_per_output_token_;
+  Histogram request_duration_;
+  Histogram embedding_duration_;
+};
+
+} // namespace llama_wrapper
+
+#endif // METRICS_H
@@ -0,0 +1,443 @@
+#include "model-registry.h"
+#include "llama.h"
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace llama_wrapper {
+
+// The llama.cpp backend is initialized while any weights are loaded
+static std::mutex g_backend_mutex;
+static int g_backend_refs = 0;
+static bool g_numa_initialized = false;
+
+static void backend_acquire(ggml_numa_strategy numa) {
+  std::lock_guard<std::mutex> lock(g_backend_mutex);
+  if (g_backend_refs++ == 0) {
+    llama_backend_init();
+  }
+  // ggml keeps the NUMA placement for the lifetime of the process
+  if (numa != GGML_NUMA_STRATEGY_DISABLED && !g_numa_initialized) {
+    llama_numa_init(numa);
+    g_numa_initialized = true;
+  }
+}
+
+static void backend_release() {
+  std::lock_guard<std::mutex> lock(g_backend_mutex);
+  if (--g_backend_refs == 0) {
+    llama_backend_free();
+  }
+}
+
+static int64_t now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+ModelWeights::~ModelWeights() {
+  if (model_) {
+    llama_model_free(model_);
+    backend_release();
+  }
+}
+
+// Ask the kernel to read a file into the page cache in the background, so the
+// page faults of the mmap'd weights (while loading and on the first decode)
+// hit memory instead of the disk. Best effort: errors are ignored.
+static void prefetch_file(const std::string &path) {
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+#if defined(__APPLE__)
+    // F_RDADVISE takes an int length, so advise in chunks
+    const off_t chunk = 1 << 30;
+    for (off_t offset = 0; offset < st.st_size; offset += chunk) {
+      struct radvisory advice;
+      advice.ra_offset = offset;
+      advice.ra_count = static_cast<int>(std::min<off_t>(chunk, st.st_size - offset));
+      if (fcntl(fd, F_RDADVISE, &advice) != 0) {
+        break;
+      }
+    }
+#elif defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+#endif
+  }
+  close(fd);
+}
+
+// Adapts ModelParams::progress to llama.cpp's load progress callback
+static bool report_progress(float progress, void *user_data) {
+  (*static_cast<const std::function<void(float)> *>(user_data))(progress);
+  return true;
+}
+
+static bool parse_split_mode(const std::string &name, llama_split_mode *mode) {
+  static const std::pair<const char *, llama_split_mode> modes[] = {
+      {"none", LLAMA_SPLIT_MODE_NONE},
+      {"layer", LLAMA_SPLIT_MODE_LAYER},
+      {"row", LLAMA_SPLIT_MODE_ROW},
+  };
+  for (const auto &entry : modes) {
+    if (name == entry.first) {
+      *mode = entry.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool parse_numa(const std::string &name, ggml_numa_strategy *numa) {
+  static const std::pair<const char *, ggml_numa_strategy> strategies[] = {
+      {"disabled", GGML_NUMA_STRATEGY_DISABLED}, {"distribute", GGML_NUMA_STRATEGY_DISTRIBUTE},
+      {"isolate", GGML_NUMA_STRATEGY_ISOLATE},   {"numactl", GGML_NUMA_STRATEGY_NUMACTL},
+      {"mirror", GGML_NUMA_STRATEGY_MIRROR},
+  };
+  for (const auto &entry : strategies) {
+    if (name == entry.first) {
+      *numa = entry.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ModelWeights::load(const ModelParams &params, std::string *error) {
+  auto fail = [error](std::string reason) {
+    if (error) {
+      *error = std::move(reason);
+    }
+    return false;
+  };
+
+  // Set up model parameters
+  llama_model_params model_params = llama_model_default_params();
+  model_params.n_gpu_layers = params.n_gpu_layers;
+  if (!parse_split_mode(params.split_mode, &model_params.split_mode)) {
+    return fail("Split mode must be \"none\", \"layer\" or \"row\"");
+  }
+  model_params.main_gpu = params.main_gpu;
+  if (params.tensor_split.size() > llama_max_devices()) {
+    return fail("Tensor split has more entries than the " + std::to_string(llama_max_devices()) +
+                " supported devices");
+  }
+  // llama.cpp reads llama_max_devices() entries
+  std::vector<float> tensor_split(llama_max_devices(), 0.0f);
+  if (!params.tensor_split.empty()) {
+    std::copy(params.tensor_split.begin(), params.tensor_split.end(), tensor_split.begin());
+    model_params.tensor_split = tensor_split.data();
+  }
+  ggml_numa_strategy numa;
+  if (!parse_numa(params.numa, &numa)) {
+    return fail("Unsupported NUMA strategy: " + params.numa);
+  }
+
+  backend_acquire(numa);
+
+  // Null-terminated list of the selected devices; devices register with the backend
+  std::vector<ggml_backend_dev_t> devices;
+  for (const std::string &name : params.devices) {
+    ggml_backend_dev_t device = ggml_backend_dev_by_name(name.c_str());
+    if (!device) {
+      backend_release();
+      return fail("Unknown device: " + name);
+    }
+    devices.push_back(device);
+  }
+  if (!devices.empty()) {
+    devices.push_back(nullptr);
+    model_params.devices = devices.data();
+  }
+
+  model_params.use_mmap = params.use_mmap;
+  model_params.use_mlock = params.use_mlock;
+  if (params.progress) {
+    model_params.progress_callback = report_progress;
+    model_params.progress_callback_user_data = const_cast<std::function<void(float)> *>(
+        &params.progress);
+  }
+
+  // Without mmap, llama.cpp reads the file sequentially anyway
+  if (params.prefetch && params.use_mmap) {
+    prefetch_file(params.model_path);
+  }
+
+  // Load the model
+  model_ = llama_model_load_from_file(params.model_path.c_str(), model_params);
+  if (!model_) {
+    backend_release();
+    return fail("");
+  }
+  path_ = params.model_path;
+  touch();
+
+  // Offloaded layers live in device memory; the output layer is offloaded last
+  const size_t size = llama_model_size(model_);
+  const int n_layer = llama_model_n_layer(model_) + 1;
+  const int n_offloaded =
+      llama_supports_gpu_offload() ? std::min(std::max(params.n_gpu_layers, 0), n_layer) : 0;
+  vram_bytes_ = size * n_offloaded / n_layer;
+  ram_bytes_ = size - vram_bytes_;
+
+  // Precompute the text of every token of the vocabulary
+  const llama_vocab *vocab = llama_model_get_vocab(model_);
+  const int n_vocab = llama_vocab_n_tokens(vocab);
+  piece_offsets_.reserve(n_vocab + 1);
+  piece_offsets_.push_back(0);
+  for (int token = 0; token < n_vocab; token++) {
+    const size_t offset = piece_data_.size();
+    piece_data_.resize(offset + 256);
+    int n = llama_token_to_piece(vocab, token, &piece_data_[offset], 256, 0, true);
+    if (n < 0) {
+      // -n is the required size
+      piece_data_.resize(offset - n);
+      n = llama_token_to_piece(vocab, token, &piece_data_[offset], -n, 0, true);
+    }
+    piece_data_.resize(offset + std::max(0, n));
+    piece_offsets_.push_back(piece_data_.size());
+  }
+  piece_data_.shrink_to_fit();
+  return true;
+}
+
+std::string_view ModelWeights::piece(int32_t token) const {
+  if (token < 0 || static_cast<size_t>(token) + 1 >= piece_offsets_.size()) {
+    return {};
+  }
+  const uint32_t begin = piece_offsets_[token];
+  return std::string_view(piece_data_).substr(begin, piece_offsets_[token + 1] - begin);
+}
+
+void ModelWeights::touch() {
+  last_used_.store(now_ms(), std::memory_order_relaxed);
+}
+
+ModelRegistry &ModelRegistry::instance() {
+  static ModelRegistry registry;
+  return registry;
+}
+
+std::vector<DeviceInfo> list_devices() {
+  backend_acquire(GGML_NUMA_STRATEGY_DISABLED);
+  std::vector<DeviceInfo> devices;
+  for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+    ggml_backend_dev_t device = ggml_backend_dev_get(i);
+    DeviceInfo info;
+    info.name = ggml_backend_dev_name(device);
+    info.description = ggml_backend_dev_description(device);
+    switch (ggml_backend_dev_type(device)) {
+    case GGML_BACKEND_DEVICE_TYPE_CPU:
+      info.type = "cpu";
+      break;
+    case GGML_BACKEND_DEVICE_TYPE_GPU:
+      info.type = "gpu";
+      break;
+    case GGML_BACKEND_DEVICE_TYPE_IGPU:
+      info.type = "igpu";
+      break;
+    default:
+      info.type = "accel";
+      break;
+    }
+    ggml_backend_dev_memory(device, &info.free_bytes, &info.total_bytes);
+    devices.push_back(std::move(info));
+  }
+  backend_release();
+  return devices;
+}
+
+// Everything that changes the loaded weights is part of the key
+static std::string registry_key(const ModelParams &params) {
+  std::string key = params.model_path + '\n' + std::to_string(params.n_gpu_layers) +
+                    (params.use_mmap ? "m" : "") + (params.use_mlock ? "l" : "") + '\n' +
+                    params.split_mode + ' ' + std::to_string(params.main_gpu);
+  for (float share : params.tensor_split) {
+    key += ' ' + std::to_string(share);
+  }
+  for (const std::string &device : params.devices) {
+    key += '\n' + device;
+  }
+  return key;
+}
+
+std::shared_ptr<ModelWeights> ModelRegistry::acquire(const ModelParams &params,
+                                                     std::string *error) {
+  const std::string key = registry_key(params);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [&] { return loading_.count(key) == 0; });
+  auto it = weights_.find(key);
+  if (it != weights_.end()) {
+    if (std::shared_ptr<ModelWeights> weights = it->second.lock()) {
+      if (params.progress) {
+        params.progress(1.0f);
+      }
+      weights->touch();
+      return weights;
+    }
+  }
+
+  // Drop entries of weights that have been freed in the meantime
+  for (auto entry = weights_.begin(); entry != weights_.end();) {
+    entry = entry->second.expired() ? weights_.erase(entry) : std::next(entry);
+  }
+
+  // The file size estimates the memory of the weights before they are loaded.
+  // Other acquire() calls wait for this entry instead of loading them again.
+  PendingLoad &pending = loading_[key];
+  if (budget_.ram_bytes > 0 || budget_.vram_bytes > 0) {
+    struct stat st;
+    const size_t file_bytes = stat(params.model_path.c_str(), &st) == 0 ? st.st_size : 0;
+    const bool on_gpu = params.n_gpu_layers > 0 && llama_supports_gpu_offload();
+    (on_gpu ? pending.vram_bytes : pending.ram_bytes) = file_bytes;
+    evict_to_fit(lock);
+  }
+  lock.unlock();
+
+  auto weights = std::make_shared<ModelWeights>();
+  const bool loaded = weights->load(params, error);
+
+  lock.lock();
+  loading_.erase(key);
+  if (loaded) {
+    weights_[key] = weights;
+  }
+  lock.unlock();
+  changed_.notify_all();
+  return loaded ? weights : nullptr;
+}
+
+void ModelRegistry::attach(const void *owner, const ModelWeights *weights,
+                           const ModelWeights *draft, ReleaseCallback release) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  holders_.push_back({owner, weights, draft, std::move(release)});
+}
+
+void ModelRegistry::detach(const void *owner) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const auto owned = [owner](const Holder &holder) { return holder.owner == owner; };
+  changed_.wait(lock, [&] {
+    return std::none_of(holders_.begin(), holders_.end(),
+                        [&](const Holder &holder) { return owned(holder) && holder.releasing; });
+  });
+  holders_.erase(std::remove_if(holders_.begin(), holders_.end(), owned), holders_.end());
+}
+
+void ModelRegistry::set_budget(const MemoryBudget &budget) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  budget_ = budget;
+  evict_to_fit(lock);
+}
+
+void ModelRegistry::evict_to_fit(std::unique_lock<std::mutex> &lock) {
+  const auto fits = [&]() {
+    size_t ram = 0;
+    size_t vram = 0;
+    for (const auto &entry : weights_) {
+      if (std::shared_ptr<ModelWeights> weights = entry.second.lock()) {
+        ram += weights->ram_bytes_;
+        vram += weights->vram_bytes_;
+      }
+    }
+    for (const auto &entry : loading_) {
+      ram += entry.second.ram_bytes;
+      vram += entry.second.vram_bytes;
+    }
+    return (budget_.ram_bytes == 0 || ram <= budget_.ram_bytes) &&
+           (budget_.vram_bytes == 0 || vram <= budget_.vram_bytes);
+  };
+
+  // Weights with attached contexts, least recently used first. Raw pointers
+  // only, so that the candidates themselves do not keep the weights alive.
+  std::vector<std::pair<int64_t, const ModelWeights *>> candidates;
+  for (const auto &entry : weights_) {
+    if (std::shared_ptr<ModelWeights> weights = entry.second.lock()) {
+      candidates.emplace_back(weights->last_used_.load(std::memory_order_relaxed),
+                              weights.get());
+    }
+  }
+  std::sort(candidates.begin(), candidates.end());
+
+  for (const auto &candidate : candidates) {
+    if (fits()) {
+      break;
+    }
+
+    // The weights are freed once every context using them is released.
+    // Releasing joins the scheduler threads, so it runs without the lock;
+    // the marked holders stay attached until then.
+    std::vector<std::pair<const void *, ReleaseCallback>> releases;
+    for (auto &holder : holders_) {
+      if ((holder.weights == candidate.second || holder.draft == candidate.second) &&
+          !holder.releasing) {
+        holder.releasing = true;
+        releases.emplace_back(holder.owner, holder.release);
+      }
+    }
+    if (releases.empty()) {
+      continue;
+    }
+
+    lock.unlock();
+    std::vector<const void *> released;
+    for (const auto &release : releases) {
+      if (release.second()) {
+        released.push_back(release.first);
+      }
+    }
+    lock.lock();
+
+    // Busy contexts stay attached; holders marked by other evictions are theirs
+    const auto has = [](const auto &owners, const void *owner) {
+      return std::any_of(owners.begin(), owners.end(),
+                         [owner](const auto &entry) { return entry == owner; });
+    };
+    std::vector<const void *> marked;
+    for (const auto &release : releases) {
+      marked.push_back(release.first);
+    }
+    for (auto holder = holders_.begin(); holder != holders_.end();) {
+      if (holder->releasing && has(marked, holder->owner)) {
+        holder->releasing = false;
+        if (has(released, holder->owner)) {
+          holder = holders_.erase(holder);
+          continue;
+        }
+      }
+      ++holder;
+    }
+    changed_.notify_all();
+  }
+}
+
+std::vector<ResidentModel> ModelRegistry::resident() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const int64_t now = now_ms();
+  std::vector<ResidentModel> models;
+  for (const auto &entry : weights_) {
+    std::shared_ptr<ModelWeights> weights = entry.second.lock();
+    if (!weights) {
+      continue;
+    }
+    ResidentModel model;
+    model.model_path = weights->path_;
+    model.ram_bytes = weights->ram_bytes_;
+    model.vram_bytes = weights->vram_bytes_;
+    model.contexts = std::count_if(holders_.begin(), holders_.end(), [&](const Holder &holder) {
+      return holder.weights == weights.get() || holder.draft == weights.get();
+    });
+    model.idle_ms = static_cast<double>(now - weights->last_used_.load(std::memory_order_relaxed));
+    models.push_back(std::move(model));
+  }
+  return models;
+}
+
+} // namespace llama_wrapper
@@ -0,0 +1,179 @@
+#ifndef MODEL_REGISTRY_H
+#define MODEL_REGISTRY_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Forward declarations for llama.cpp types
+struct llama_model;
+
+namespace llama_wrapper {
+
+struct ModelParams {
+  std::string model_path;
+  int n_gpu_layers = 99; // Use GPU by default if available
+
+  // Placement across GPUs: "layer" splits layers across devices, "row" also
+  // splits tensors by rows, "none" keeps the model on main_gpu
+  std::string split_mode = "layer";
+  int main_gpu = 0;                 // Index of the GPU used by "none" (among the used GPUs)
+  std::vector<float> tensor_split;  // Proportion of the model per device (empty = by free memory)
+  std::vector<std::string> devices; // Backend devices to use, e.g. "CUDA0" (empty = all)
+
+  // NUMA placement for CPU inference: "disabled", "distribute", "isolate",
+  // "numactl" or "mirror". Process-wide; only the first non-disabled value applies.
+  std::string numa = "disabled";
+
+  bool use_mmap = true;
+  bool use_mlock = false;
+  bool prefetch = false; // Read the weights into the page cache ahead of the mmap page faults
+  bool debug = false;    // Show verbose llama.cpp output
+  std::string chat_template =
+      "auto"; // "auto" uses template from model, or specify a built-in template
+  std::string draft_model_path; // Small model with the same vocabulary for speculative decoding
+
+  // Called on the loading thread with the fraction of the weights loaded (0-1).
+  // Not part of the registry key; weights that are already loaded report 1.
+  std::function<void(float)> progress;
+};
+
+// Weights of a loaded GGUF file, shared by every context created from them.
+// Freed when the last context releases them.
+class ModelWeights {
+public:
+  ModelWeights() = default;
+  ~ModelWeights();
+
+  ModelWeights(const ModelWeights &) = delete;
+  ModelWeights &operator=(const ModelWeights &) = delete;
+
+  llama_model *model() const { return model_; }
+
+  // Text of a single token
+  std::string_view piece(int32_t token) const;
+
+  // Mark the weights as used now, for least-recently-used eviction
+  void touch();
+
+private:
+  friend class ModelRegistry;
+
+  llama_model *model_ = nullptr;
+  std::string path_;
+
+  // Estimated memory of the weights in host memory and on GPU devices
+  size_t ram_bytes_ = 0;
+  size_t vram_bytes_ = 0;
+  std::atomic<int64_t> last_used_{0}; // steady_clock milliseconds
+
+  // Text of every token, concatenated and indexed by piece_offsets_
+  std::string piece_data_;
+  std::vector<uint32_t> piece_offsets_;
+
+  // Load params.model_path and precompute the token table. On failure, error
+  // is set to the reason if there is one.
+  bool load(const ModelParams &params, std::string *error);
+};
+
+// A backend device, as reported by list_devices()
+struct DeviceInfo {
+  std::string name; // Name for ModelParams::devices
+  std::string description;
+  std::string type; // "cpu", "gpu", "igpu" or "accel"
+  size_t free_bytes = 0;
+  size_t total_bytes = 0;
+};
+
+// Devices of the available backends
+std::vector<DeviceInfo> list_devices();
+
+// Memory limits for loaded weights in bytes (0 = unlimited)
+struct MemoryBudget {
+  size_t ram_bytes = 0;
+  size_t vram_bytes = 0;
+};
+
+// Loaded weights as reported by ModelRegistry::resident()
+struct ResidentModel {
+  std::string model_path;
+  size_t ram_bytes = 0;
+  size_t vram_bytes = 0;
+  int contexts = 0;   // Evictable contexts using the weights
+  double idle_ms = 0; // Time since the weights were last used
+};
+
+// Process-wide registry of loaded weights keyed by file and load parameters,
+// so that contexts over the same GGUF (e.g. chat and embeddings) map it once.
+//
+// Contexts attach themselves with a release callback. When loading weights
+// would exceed the memory budget, the least recently used weights are freed
+// by releasing their idle contexts; busy contexts are never released.
+class ModelRegistry {
+public:
+  // Releases a context if it is idle; returns false if it is busy
+  using ReleaseCallback = std::function<bool()>;
+
+  static ModelRegistry &instance();
+
+  // Return the weights for params, loading them if no context holds them yet.
+  // Loads run outside the registry lock; a second acquire() of weights that
+  // are being loaded waits for that load. Returns null if loading fails, with
+  // error (if given) set to the reason if there is one.
+  std::shared_ptr<ModelWeights> acquire(const ModelParams &params, std::string *error = nullptr);
+
+  // Register a context over weights (and optionally draft weights) as a
+  // candidate for eviction. release() runs outside the registry lock and must
+  // not detach its own context.
+  void attach(const void *owner, const ModelWeights *weights, const ModelWeights *draft,
+              ReleaseCallback release);
+
+  // Remove a context; waits until an eviction that is releasing it finishes.
+  // Has no effect if the owner is not attached (e.g. after eviction).
+  void detach(const void *owner);
+
+  // Set the memory budget, evicting idle weights that no longer fit
+  void set_budget(const MemoryBudget &budget);
+
+  std::vector<ResidentModel> resident();
+
+private:
+  ModelRegistry() = default;
+
+  struct Holder {
+    const void *owner;
+    const ModelWeights *weights;
+    const ModelWeights *draft;
+    ReleaseCallback release;
+    bool releasing = false; // An eviction is running release() without the lock
+  };
+
+  // Estimated memory of weights that are being loaded
+  struct PendingLoad {
+    size_t ram_bytes = 0;
+    size_t vram_bytes = 0;
+  };
+
+  // Release idle contexts of the least recently used weights until the
+  // resident weights and the weights being loaded fit the budget. Called with
+  // lock held; unlocks it while contexts are released.
+  void evict_to_fit(std::unique_lock<std::mutex> &lock);
+
+  std::mutex mutex_;
+  std::condition_variable changed_; // A load or a release finished
+  std::unordered_map<std::string, std::weak_ptr<ModelWeights>> weights_;
+  std::unordered_map<std::string, PendingLoad> loading_; // The same weights are never loaded twice
+  std::vector<Holder> holders_;
+  MemoryBudget budget_;
+};
+
+} // namespace llama_wrapper
+
+#endif // MODEL_REGISTRY_H
@@ -0,0 +1,94 @@
+#ifndef STOP_MATCHER_H
+#define STOP_MATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace llama_wrapper {
+
+// Aho-Corasick automaton over the stop sequences of a request. Generated text
+// is fed one byte at a time; every byte is a single table lookup, so matching
+// neither allocates nor depends on the number of stop sequences.
+class StopMatcher {
+public:
+  StopMatcher() : StopMatcher(std::vector<std::string>()) {}
+
+  explicit StopMatcher(const std::vector<std::string> &patterns) {
+    add_state(0);
+
+    // Build the trie of all (non-empty) patterns
+    for (const std::string &pattern : patterns) {
+      if (pattern.empty()) {
+        continue;
+      }
+      int32_t state = 0;
+      for (unsigned char c : pattern) {
+        const size_t edge = state * 256 + c;
+        if (next_[edge] == 0) {
+          const int32_t child = add_state(depth_[state] + 1); // May reallocate next_
+          next_[edge] = child;
+        }
+        state = next_[edge];
+      }
+      match_[state] = pattern.size();
+    }
+
+    // Turn it into a DFA: missing transitions follow the failure links, and a
+    // state also matches the longest pattern that is a suffix of it
+    std::vector<int32_t> fail(depth_.size(), 0);
+    std::deque<int32_t> queue;
+    for (int c = 0; c < 256; c++) {
+      if (next_[c] != 0) {
+        queue.push_back(next_[c]);
+      }
+    }
+    while (!queue.empty()) {
+      const int32_t state = queue.front();
+      queue.pop_front();
+      if (match_[state] == 0) {
+        match_[state] = match_[fail[state]];
+      }
+      for (int c = 0; c < 256; c++) {
+        int32_t &child = next_[state * 256 + c];
+        const int32_t fallback = next_[fail[state] * 256 + c];
+        if (child == 0) {
+          child = fallback;
+        } else {
+          fail[child] = fallback;
+          queue.push_back(child);
+        }
+      }
+    }
+  }
+
+  // Consume one byte and return the length of the stop sequence that ends
+  // with it (the longest one if several do), or 0
+  size_t feed(char c) {
+    state_ = next_[state_ * 256 + static_cast<unsigned char>(c)];
+    return match_[state_];
+  }
+
+  // Length of the longest suffix of the input that may still turn out to be
+  // the start of a stop sequence
+  size_t pending() const { return depth_[state_]; }
+
+private:
+  std::vector<int32_t> next_;   // Transitions, 256 per state
+  std::vector<uint32_t> depth_; // Length of the pattern prefix each state stands for
+  std::vector<uint32_t> match_; // Length of the pattern matched in each state (0 = none)
+  int32_t state_ = 0;
+
+  int32_t add_state(uint32_t depth) {
+    next_.resize(next_.size() + 256, 0);
+    depth_.push_back(depth);
+    match_.push_back(0);
+    return depth_.size() - 1;
+  }
+};
+
+} // namespace llama_wrapper
+
+#endif // STOP_MATCHER_H
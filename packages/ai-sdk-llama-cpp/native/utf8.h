@@ -0,0 +1,24 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <algorithm>
+#include <cstddef>
+
+namespace llama_wrapper {
+
+// Length of the longest prefix of text that does not end inside a UTF-8 sequence
+inline size_t utf8_complete_length(const char *text, size_t n) {
+  for (size_t back = 1; back <= std::min<size_t>(n, 4); back++) {
+    const unsigned char c = text[n - back];
+    if ((c & 0xC0) == 0x80) {
+      continue; // Continuation byte, keep looking for the lead byte
+    }
+    const size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    return len > back ? n - back : n;
+  }
+  return n;
+}
+
+} // namespace llama_wrapper
+
+#endif // UTF8_H
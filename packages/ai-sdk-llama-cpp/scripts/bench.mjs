@@ -0,0 +1,226 @@
+// JavaScript-level benchmark through the provider, including the N-API layer.
+//
+// Reports the same measurements as the native llama_binding_bench executable,
+// plus the overhead of the binding: the difference between the wall time seen
+// by JavaScript and the native request time.
+//
+// Usage: node scripts/bench.mjs --model <gguf> [--embedding-model <gguf>]
+//          [--prompt-words 512] [--gen-tokens 128] [--repetitions 3]
+//          [--parallel 1] [--embed-batch 1,8,32] [--embed-length 32,128,512]
+// Requires the native addon and the TypeScript build (pnpm run build).
+
+import { parseArgs } from "node:util";
+import { llamaCpp } from "../dist/index.js";
+
+const { values: args } = parseArgs({
+  options: {
+    model: { type: "string" },
+    "embedding-model": { type: "string" },
+    ctx: { type: "string", default: "4096" },
+    "prompt-words": { type: "string", default: "512" },
+    "gen-tokens": { type: "string", default: "128" },
+    repetitions: { type: "string", default: "3" },
+    parallel: { type: "string", default: "1" },
+    "embed-batch": { type: "string", default: "1,8,32" },
+    "embed-length": { type: "string", default: "32,128,512" },
+  },
+});
+
+if (!args.model) {
+  console.error("Usage: node scripts/bench.mjs --model <path> [options]");
+  process.exit(1);
+}
+
+const promptWords = Number(args["prompt-words"]);
+const genTokens = Number(args["gen-tokens"]);
+const repetitions = Number(args.repetitions);
+const parallel = Number(args.parallel);
+const list = (value) => value.split(",").filter(Boolean).map(Number);
+
+const WORDS = ["time", "year", "people", "way", "day", "thing", "life"];
+
+// Roughly one token per word; the seed keeps runs from reusing the KV cache
+function makeText(words, seed) {
+  let text = `Run ${seed}:`;
+  for (let i = 0; i < words; i++) {
+    text += " " + WORDS[(i * 7 + seed) % WORDS.length];
+  }
+  return text;
+}
+
+function median(values) {
+  if (values.length === 0) return 0;
+  const sorted = [...values].sort((a, b) => a - b);
+  const mid = Math.floor(sorted.length / 2);
+  return sorted.length % 2 ? sorted[mid] : (sorted[mid - 1] + sorted[mid]) / 2;
+}
+
+const perSecond = (count, ms) => (ms > 0 ? (count * 1000) / ms : 0);
+
+let seed = 0;
+
+async function benchGeneration(model, { stream = false, n = 1 } = {}) {
+  const runs = [];
+  let wallMs = 0;
+
+  for (let rep = 0; rep < repetitions; rep++) {
+    const start = performance.now();
+    const results = await Promise.all(
+      Array.from({ length: n }, async () => {
+        const prompt = [
+          {
+            role: "user",
+            content: [
+              {
+                type: "text",
+                text: `${makeText(promptWords, ++seed)}\nContinue the list:`,
+              },
+            ],
+          },
+        ];
+        const requestStart = performance.now();
+        let firstChunkMs = 0;
+        let metadata;
+        let usage;
+        if (stream) {
+          const { stream: parts } = await model.doStream({
+            prompt,
+            maxOutputTokens: genTokens,
+            temperature: 0,
+          });
+          for await (const part of parts) {
+            if (part.type === "text-delta" && firstChunkMs === 0) {
+              firstChunkMs = performance.now() - requestStart;
+            }
+            if (part.type === "finish") {
+              metadata = part.providerMetadata;
+              usage = part.usage;
+            }
+          }
+        } else {
+          const result = await model.doGenerate({
+            prompt,
+            maxOutputTokens: genTokens,
+            temperature: 0,
+          });
+          metadata = result.providerMetadata;
+          usage = result.usage;
+        }
+        return {
+          wallMs: performance.now() - requestStart,
+          firstChunkMs,
+          promptTokens: usage?.inputTokens.total ?? 0,
+          completionTokens: usage?.outputTokens.total ?? 0,
+          timings: metadata?.llamaCpp?.timings,
+        };
+      })
+    );
+    wallMs += performance.now() - start;
+    runs.push(...results);
+  }
+
+  const timed = runs.filter((run) => run.timings);
+  const completionTokens = runs.reduce(
+    (sum, run) => sum + run.completionTokens,
+    0
+  );
+  return {
+    runs: runs.length,
+    promptTokens: median(runs.map((run) => run.promptTokens)),
+    completionTokens: median(runs.map((run) => run.completionTokens)),
+    timeToFirstTokenMs: median(
+      timed.map((run) => run.timings.timeToFirstTokenMs)
+    ),
+    ...(stream && {
+      timeToFirstChunkMs: median(runs.map((run) => run.firstChunkMs)),
+    }),
+    prefillTokensPerSecond: median(
+      timed.map((run) => perSecond(run.promptTokens, run.timings.prefillMs))
+    ),
+    decodeTokensPerSecond: median(
+      timed.map((run) =>
+        perSecond(run.completionTokens - 1, run.timings.decodeMs)
+      )
+    ),
+    aggregateTokensPerSecond: perSecond(completionTokens, wallMs),
+    // Native request time against the wall time seen by JavaScript
+    nativeMs: median(timed.map((run) => run.timings.totalMs)),
+    wallMs: median(runs.map((run) => run.wallMs)),
+    bindingOverheadMs: median(
+      timed.map((run) => run.wallMs - run.timings.totalMs)
+    ),
+    callbackMs: median(timed.map((run) => run.timings.callbackMs)),
+  };
+}
+
+async function benchEmbeddings(path) {
+  const batchSizes = list(args["embed-batch"]);
+  const lengths = list(args["embed-length"]);
+  // Texts must fit into one batch, which in turn must fit into the context
+  const maxTokens = Math.max(512, ...lengths.map((words) => words * 2 + 16));
+  const model = llamaCpp.embedding({
+    modelPath: path,
+    contextSize: Math.max(Number(args.ctx), maxTokens),
+    batchSize: maxTokens,
+    parallelSequences: Math.max(...batchSizes),
+  });
+
+  const results = [];
+  try {
+    for (const batchSize of batchSizes) {
+      for (const length of lengths) {
+        const textsPerSecond = [];
+        const tokensPerSecond = [];
+        for (let rep = 0; rep < repetitions; rep++) {
+          const values = Array.from({ length: batchSize }, (_, i) =>
+            makeText(length, rep * batchSize + i)
+          );
+          const start = performance.now();
+          const result = await model.doEmbed({ values });
+          const ms = performance.now() - start;
+          textsPerSecond.push(perSecond(batchSize, ms));
+          tokensPerSecond.push(perSecond(result.usage?.tokens ?? 0, ms));
+        }
+        results.push({
+          batchSize,
+          words: length,
+          textsPerSecond: median(textsPerSecond),
+          tokensPerSecond: median(tokensPerSecond),
+        });
+      }
+    }
+  } finally {
+    await model.dispose();
+  }
+  return results;
+}
+
+const model = llamaCpp({
+  modelPath: args.model,
+  contextSize: Number(args.ctx),
+  parallelSequences: parallel,
+  streamFlushTokens: 1,
+});
+
+const report = { model: args.model };
+try {
+  // Warm up caches and backend kernels before measuring
+  await model.doGenerate({
+    prompt: [{ role: "user", content: [{ type: "text", text: "Hi" }] }],
+    maxOutputTokens: 4,
+  });
+
+  report.generation = await benchGeneration(model);
+  report.stream = await benchGeneration(model, { stream: true });
+  if (parallel > 1) {
+    report.parallel = await benchGeneration(model, { n: parallel });
+  }
+} finally {
+  await model.dispose();
+}
+
+if (args["embedding-model"]) {
+  report.embedding = await benchEmbeddings(args["embedding-model"]);
+}
+
+console.log(JSON.stringify(report, null, 2));
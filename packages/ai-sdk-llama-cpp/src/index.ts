@@ -17,7 +17,35 @@ export {
   buildToolSystemPrompt,
   type ParsedToolCall,
 } from "./llama-cpp-language-model.js";
-export { LlamaCppEmbeddingModel } from "./llama-cpp-embedding-model.js";
+export {
+  LlamaCppEmbeddingModel,
+  type EmbedStreamOptions,
+  type EmbedStreamBatch,
+} from "./llama-cpp-embedding-model.js";
+
+// Prometheus export of native metrics
+export {
+  formatPrometheusMetrics,
+  type PrometheusFormatOptions,
+} from "./metrics.js";
+export type {
+  EmbedResult,
+  GenerateChoice,
+  GenerateTimings,
+  MetricsHistogram,
+  ModelMetrics,
+} from "./native-binding.js";
+
+// Process-wide memory budget for loaded models and device placement
+export {
+  setMemoryBudget,
+  getResidentModels,
+  getDevices,
+  type MemoryBudget,
+  type ResidentModel,
+  type DeviceInfo,
+  type NumaStrategy,
+} from "./native-binding.js";
 
 // Export JSON schema to grammar converter for advanced use cases
 export {
@@ -1101,15 +1101,37 @@ export class SchemaConverter {
   }
 }
 
+/** Number of converted schemas kept by convertJsonSchemaToGrammar */
+const GRAMMAR_CACHE_SIZE = 128;
+
+/** Grammars by serialized schema and options, least recently used first */
+const grammarCache = new Map<string, string>();
+
 /**
- * Convert a JSON Schema to a GBNF grammar string
+ * Convert a JSON Schema to a GBNF grammar string.
+ * Results are memoized, since the same schemas tend to be used for many calls.
  */
 export function convertJsonSchemaToGrammar(
   schema: JSONSchema7,
   options: SchemaConverterOptions = {}
 ): string {
+  const key = JSON.stringify([schema, options]);
+  const cached = grammarCache.get(key);
+  if (cached !== undefined) {
+    // Re-insert to mark the entry as most recently used
+    grammarCache.delete(key);
+    grammarCache.set(key, cached);
+    return cached;
+  }
+
   const converter = new SchemaConverter(options);
   converter.resolveRefs(schema);
   converter.visit(schema, "");
-  return converter.formatGrammar();
+  const grammar = converter.formatGrammar();
+
+  grammarCache.set(key, grammar);
+  if (grammarCache.size > GRAMMAR_CACHE_SIZE) {
+    grammarCache.delete(grammarCache.keys().next().value as string);
+  }
+  return grammar;
 }
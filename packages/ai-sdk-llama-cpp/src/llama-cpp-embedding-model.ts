@@ -9,12 +9,38 @@ import {
   loadModel,
   unloadModel,
   embed,
+  tokenize,
+  detokenize,
   isModelLoaded,
+  getMetrics,
   type LoadModelOptions,
+  type ModelMetrics,
   type EmbedOptions,
+  type EmbedResult,
+  type EmbeddingEncoding,
 } from "./native-binding.js";
 import type { LlamaCppProviderConfig } from "./llama-cpp-provider.js";
 
+export interface EmbedStreamOptions {
+  /** Texts per native embedding call (default: the model's `parallelSequences`) */
+  batchSize?: number;
+  /**
+   * Batches submitted ahead of the consumer (default: 2). Once this many are
+   * done or in flight, no more texts are read until the consumer catches up.
+   */
+  maxPendingBatches?: number;
+  /** Output encoding (default: float32) */
+  encoding?: EmbeddingEncoding;
+}
+
+/** Embeddings of consecutive texts of an `embedStream()` input */
+export interface EmbedStreamBatch extends EmbedResult {
+  /** Index of the batch's first text in the input */
+  offset: number;
+  /** The embedded texts */
+  values: string[];
+}
+
 export class LlamaCppEmbeddingModel implements EmbeddingModelV3 {
   readonly specificationVersion = "v3" as const;
   readonly provider = "llama.cpp";
@@ -35,17 +61,50 @@ export class LlamaCppEmbeddingModel implements EmbeddingModelV3 {
   private modelHandle: number | null = null;
   private readonly config: LlamaCppProviderConfig;
   private initPromise: Promise<void> | null = null;
+  // Incremented by dispose(), whose unloading fails the running calls
+  private disposals = 0;
 
   constructor(config: LlamaCppProviderConfig) {
     this.config = config;
     this.modelId = config.modelPath;
   }
 
+  /**
+   * Run a native call on the model, loading it first. The memory budget can
+   * evict the model between the load check and the call, which then fails; in
+   * that case the call is retried once on the reloaded model.
+   */
+  private async withModel<T>(run: (handle: number) => Promise<T>): Promise<T> {
+    return this.retryIfEvicted(await this.ensureModelLoaded(), run);
+  }
+
+  private async retryIfEvicted<T>(
+    handle: number,
+    run: (handle: number) => Promise<T>
+  ): Promise<T> {
+    const disposals = this.disposals;
+    try {
+      return await run(handle);
+    } catch (error) {
+      // Requests cut short by dispose() are not retried
+      if (disposals !== this.disposals || isModelLoaded(handle)) {
+        throw error;
+      }
+      return run(await this.ensureModelLoaded());
+    }
+  }
+
   private async ensureModelLoaded(): Promise<number> {
     if (this.modelHandle !== null && isModelLoaded(this.modelHandle)) {
       return this.modelHandle;
     }
 
+    if (this.modelHandle !== null) {
+      // Evicted by the memory budget: release the stale handle and reload
+      unloadModel(this.modelHandle);
+      this.modelHandle = null;
+    }
+
     if (this.initPromise) {
       await this.initPromise;
       if (this.modelHandle !== null) {
@@ -58,9 +117,23 @@ export class LlamaCppEmbeddingModel implements EmbeddingModelV3 {
         modelPath: this.config.modelPath,
         contextSize: this.config.contextSize ?? 2048,
         gpuLayers: this.config.gpuLayers ?? 99,
+        splitMode: this.config.splitMode,
+        mainGpu: this.config.mainGpu,
+        tensorSplit: this.config.tensorSplit,
+        devices: this.config.devices,
+        numa: this.config.numa,
+        useMmap: this.config.useMmap,
+        useMlock: this.config.useMlock,
         threads: this.config.threads ?? 4,
+        batchSize: this.config.batchSize ?? 512,
+        threadsBatch: this.config.threadsBatch,
         debug: this.config.debug ?? false,
         embedding: true,
+        // Number of texts packed into a single embedding batch
+        parallelSequences: this.config.parallelSequences ?? 32,
+        warmup: this.config.warmup ?? true,
+        prefetch: this.config.prefetch ?? false,
+        onProgress: this.config.onLoadProgress,
       };
 
       this.modelHandle = await loadModel(options);
@@ -76,28 +149,142 @@ export class LlamaCppEmbeddingModel implements EmbeddingModelV3 {
     return this.modelHandle;
   }
 
+  /**
+   * Load the model now instead of on the first call.
+   */
+  async load(): Promise<void> {
+    await this.ensureModelLoaded();
+  }
+
   /**
    * Dispose of the model and free resources.
    */
   async dispose(): Promise<void> {
+    this.disposals++;
     if (this.modelHandle !== null) {
       unloadModel(this.modelHandle);
       this.modelHandle = null;
     }
   }
 
+  /**
+   * Counters and latency histograms of the model's context since it was
+   * loaded, or undefined before the first call loads it.
+   */
+  getMetrics(): ModelMetrics | undefined {
+    if (this.modelHandle === null || !isModelLoaded(this.modelHandle)) {
+      return undefined;
+    }
+    return getMetrics(this.modelHandle);
+  }
+
+  /**
+   * Token ids of each text, as views into one shared buffer. `addSpecial`
+   * adds the BOS/EOS tokens the model expects (default: true).
+   */
+  async tokenize(
+    texts: string[],
+    options: { addSpecial?: boolean } = {}
+  ): Promise<Int32Array[]> {
+    return this.withModel((handle) => tokenize(handle, { texts, ...options }));
+  }
+
+  /**
+   * Text of each token list. `special` renders control tokens as text
+   * instead of leaving them out (default: false).
+   */
+  async detokenize(
+    tokens: Int32Array[],
+    options: { special?: boolean } = {}
+  ): Promise<string[]> {
+    return this.withModel((handle) =>
+      detokenize(handle, { tokens, ...options })
+    );
+  }
+
+  /**
+   * Embed already tokenized texts, e.g. chunks produced by `tokenize()`,
+   * without converting the result to number arrays.
+   */
+  async embedTokens(
+    tokens: Int32Array[],
+    options: { encoding?: EmbeddingEncoding } = {}
+  ): Promise<EmbedResult> {
+    return this.withModel((handle) => embed(handle, { tokens, ...options }));
+  }
+
+  /**
+   * Embed a corpus of any size in batches, yielding each batch in input order
+   * as soon as it is done. Texts are read from `values` only as batches are
+   * submitted, and at most `maxPendingBatches` are ahead of the consumer, so
+   * memory stays bounded and embedding overlaps with consuming the results.
+   */
+  async *embedStream(
+    values: AsyncIterable<string> | Iterable<string>,
+    options: EmbedStreamOptions = {}
+  ): AsyncGenerator<EmbedStreamBatch> {
+    const batchSize = Math.max(
+      1,
+      options.batchSize ?? this.config.parallelSequences ?? 32
+    );
+    const maxPendingBatches = Math.max(1, options.maxPendingBatches ?? 2);
+    const encoding = options.encoding;
+
+    const pending: Promise<EmbedStreamBatch>[] = [];
+    let offset = 0;
+    const submit = (texts: string[]) => {
+      const batchOffset = offset;
+      offset += texts.length;
+      const batch = this.withModel((handle) =>
+        embed(handle, {
+          texts,
+          ...(encoding !== undefined && { encoding }),
+        })
+      ).then((result) => ({ ...result, offset: batchOffset, values: texts }));
+      // Failures surface when the batch is yielded
+      batch.catch(() => {});
+      pending.push(batch);
+    };
+
+    let texts: string[] = [];
+    for await (const value of values) {
+      texts.push(value);
+      if (texts.length < batchSize) {
+        continue;
+      }
+      submit(texts);
+      texts = [];
+      if (pending.length >= maxPendingBatches) {
+        yield await pending.shift()!;
+      }
+    }
+    if (texts.length > 0) {
+      submit(texts);
+    }
+    while (pending.length > 0) {
+      yield await pending.shift()!;
+    }
+  }
+
   async doEmbed(
     options: EmbeddingModelV3CallOptions
   ): Promise<EmbeddingModelV3Result> {
     const handle = await this.ensureModelLoaded();
 
+    const encoding = options.providerOptions?.llamaCpp?.encoding as
+      | EmbeddingEncoding
+      | undefined;
+
     const embedOptions: EmbedOptions = {
       texts: options.values,
+      ...(encoding !== undefined && { encoding }),
     };
 
-    const result = await embed(handle, embedOptions);
+    const result = await this.retryIfEvicted(handle, (handle) =>
+      embed(handle, embedOptions)
+    );
 
-    // Convert Float32Array[] to number[][]
+    // Convert typed arrays to number[][]
     const embeddings: number[][] = result.embeddings.map((embedding) =>
       Array.from(embedding)
     );
@@ -109,6 +296,11 @@ export class LlamaCppEmbeddingModel implements EmbeddingModelV3 {
       usage: {
         tokens: result.totalTokens,
       },
+      ...(result.scales && {
+        providerMetadata: {
+          llamaCpp: { scales: Array.from(result.scales) },
+        },
+      }),
       warnings,
     };
   }
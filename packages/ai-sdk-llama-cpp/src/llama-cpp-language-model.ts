@@ -9,6 +9,8 @@ import type {
   LanguageModelV3StreamPart,
   LanguageModelV3StreamResult,
   LanguageModelV3Usage,
+  JSONValue,
+  SharedV3ProviderMetadata,
   SharedV3Warning,
 } from "@ai-sdk/provider";
 
@@ -18,9 +20,23 @@ import {
   generate,
   generateStream,
   isModelLoaded,
+  getQueueLength,
+  getMetrics,
+  saveSession,
+  loadSession,
+  tokenize,
+  detokenize,
+  loadLoraAdapter,
   type LoadModelOptions,
   type GenerateOptions,
+  type GenerateResult,
   type ChatMessage,
+  type QueueLength,
+  type ModelMetrics,
+  type KvCacheType,
+  type ContextOverflow,
+  type LoraAdapterScale,
+  type NumaStrategy,
 } from "./native-binding.js";
 
 import type { JSONSchema7 } from "@ai-sdk/provider";
@@ -33,7 +49,49 @@ export interface LlamaCppModelConfig {
   modelPath: string;
   contextSize?: number;
   gpuLayers?: number;
+  /**
+   * Placement across GPUs: `splitMode` "layer" (default) assigns layers to
+   * devices, "row" also splits tensors, "none" keeps the model on `mainGpu`
+   * (default: 0). `tensorSplit` sets the proportion per device (e.g. `[3, 1]`,
+   * default: by free memory) and `devices` the device names to use (see
+   * `getDevices()`, default: all).
+   */
+  splitMode?: "none" | "layer" | "row";
+  mainGpu?: number;
+  tensorSplit?: number[];
+  devices?: string[];
+  /**
+   * NUMA placement for CPU inference on multi-socket machines, e.g.
+   * "distribute" or "isolate". Process-wide; the first value set wins.
+   * Default: "disabled"
+   */
+  numa?: NumaStrategy;
+  /**
+   * Map the model file (`useMmap`, default: true) and lock the weights in RAM
+   * (`useMlock`, default: false).
+   */
+  useMmap?: boolean;
+  useMlock?: boolean;
   threads?: number;
+  /**
+   * Prompt processing tuning: tokens per decode call (`batchSize`, default: 512),
+   * per backend compute graph (`ubatchSize`, default: llama.cpp default) and
+   * the threads used for it (`threadsBatch`, default: `threads`).
+   */
+  batchSize?: number;
+  ubatchSize?: number;
+  threadsBatch?: number;
+  /**
+   * KV cache types of keys and values (default: "f16"). "q8_0" halves the
+   * cache memory, fitting twice the context or parallel sequences; quantized
+   * value caches need flash attention.
+   */
+  cacheTypeK?: KvCacheType;
+  cacheTypeV?: KvCacheType;
+  /**
+   * Flash attention: "auto" (default) enables it where the backend supports it.
+   */
+  flashAttention?: "auto" | "on" | "off";
   /**
    * Enable verbose debug output from llama.cpp.
    * Default: false
@@ -49,6 +107,88 @@ export interface LlamaCppModelConfig {
    * deepseek3, command-r, and more.
    */
   chatTemplate?: string;
+  /**
+   * Number of requests that are decoded concurrently with continuous batching.
+   * Concurrent `doGenerate()`/`doStream()` calls share a single context, each on
+   * its own sequence with the full `contextSize`.
+   * Default: 1
+   */
+  parallelSequences?: number;
+  /**
+   * Maximum number of requests waiting for a free sequence. Further calls
+   * fail with a "Request queue is full" error instead of queueing.
+   * Default: 0 (unlimited)
+   */
+  maxQueueSize?: number;
+  /**
+   * Path to a small draft model with the same vocabulary (e.g. a 1B model of
+   * the same family) for speculative decoding. Each step the draft model
+   * proposes `draftTokens` tokens (default: 8) that the main model verifies in
+   * one batch; the output is unchanged, but several tokens can be accepted per
+   * step. Acceptance is reported in `providerMetadata.llamaCpp`.
+   */
+  draftModelPath?: string;
+  draftTokens?: number;
+  /**
+   * Draft-free speculative decoding for outputs that copy spans of the prompt
+   * (extraction, rewriting, structured output): the last `lookupNgramSize`
+   * tokens (e.g. 3) are looked up in the prompt and earlier output, and the
+   * tokens that followed are verified as drafts. Falls back to the draft model
+   * (if any) when nothing matches.
+   * Default: 0 (disabled)
+   */
+  lookupNgramSize?: number;
+  /**
+   * Decode a throwaway batch when the model is loaded, so that the first
+   * request sees steady-state latency instead of paying for page faults and
+   * kernel compilation. Default: true
+   */
+  warmup?: boolean;
+  /**
+   * Read the model file into the page cache in the background while loading.
+   * Default: false
+   */
+  prefetch?: boolean;
+  /**
+   * Called with the fraction of the weights loaded (0 to 1) while loading.
+   */
+  onLoadProgress?: (progress: number) => void;
+  /**
+   * Streamed text is coalesced in native code and delivered to JavaScript at
+   * most every `streamFlushIntervalMs` milliseconds (default: 16) or every
+   * `streamFlushTokens` tokens (default: 32), whichever comes first. Use
+   * `streamFlushTokens: 1` to receive every token as soon as it is generated.
+   */
+  streamFlushIntervalMs?: number;
+  streamFlushTokens?: number;
+  /**
+   * Default deadline for each request in milliseconds, including time spent
+   * waiting in the queue. Requests that run out of time finish early with the
+   * raw finish reason "timeout". Override per call with
+   * `providerOptions.llamaCpp.timeoutMs`.
+   * Default: none
+   */
+  timeoutMs?: number;
+  /**
+   * What to do when a conversation outgrows `contextSize`:
+   * - "error" (default): prompts that do not fit fail; generation stops with
+   *   finish reason "length" when the context is full
+   * - "shift": keep the system prompt and discard the oldest half of the
+   *   remaining tokens by shifting the KV cache, so long chats never prefill
+   *   from scratch
+   * - "truncate-middle": drop the oldest messages after the system prompt
+   *   until the prompt fits with room for the completion
+   *
+   * The number of dropped tokens is reported as
+   * `providerMetadata.llamaCpp.discardedTokens`.
+   */
+  contextOverflow?: ContextOverflow;
+  /**
+   * LoRA adapters of the base model by name and file path, e.g. one per
+   * tenant. They share the base weights and are selected per call with
+   * `providerOptions.llamaCpp.lora`. Add more with `loadLoraAdapter()`.
+   */
+  loraAdapters?: Record<string, string>;
 }
 
 export interface LlamaCppGenerationConfig {
@@ -76,15 +216,102 @@ export function convertFinishReason(
   return { unified, raw: reason };
 }
 
+/**
+ * Read a numeric per-call option from `providerOptions.llamaCpp`, e.g. the
+ * scheduling `priority` or `timeoutMs`.
+ */
+export function getNumberProviderOption(
+  options: LanguageModelV3CallOptions,
+  name: string
+): number | undefined {
+  const value = options.providerOptions?.llamaCpp?.[name];
+  return typeof value === "number" ? value : undefined;
+}
+
+/**
+ * Read `providerOptions.llamaCpp.promptTokens`, the token ids of an already
+ * rendered prompt that replace the converted messages.
+ */
+export function getPromptTokensProviderOption(
+  options: LanguageModelV3CallOptions
+): Int32Array | undefined {
+  const value = options.providerOptions?.llamaCpp?.promptTokens;
+  return Array.isArray(value) && value.every((id) => typeof id === "number")
+    ? Int32Array.from(value as number[])
+    : undefined;
+}
+
+/**
+ * Read `providerOptions.llamaCpp.lora`: the name of one adapter, a list of
+ * names, or an object of names and their scales.
+ */
+export function getLoraProviderOption(
+  options: LanguageModelV3CallOptions
+): LoraAdapterScale[] | undefined {
+  const value = options.providerOptions?.llamaCpp?.lora;
+  if (typeof value === "string") {
+    return [{ name: value }];
+  }
+  if (Array.isArray(value)) {
+    return value
+      .filter((name): name is string => typeof name === "string")
+      .map((name) => ({ name }));
+  }
+  if (value && typeof value === "object") {
+    return Object.entries(value)
+      .filter(
+        (entry): entry is [string, number] => typeof entry[1] === "number"
+      )
+      .map(([name, scale]) => ({ name, scale }));
+  }
+  return undefined;
+}
+
+/**
+ * Timings, speculative decoding and context overflow statistics of a result,
+ * and its choices when several completions were sampled, if any.
+ */
+export function convertProviderMetadata(
+  result: GenerateResult
+): SharedV3ProviderMetadata | undefined {
+  const metadata: Record<string, JSONValue> = {};
+  if (result.timings) {
+    metadata.timings = { ...result.timings };
+  }
+  if (result.draftTokens) {
+    metadata.draftTokens = result.draftTokens;
+    metadata.acceptedDraftTokens = result.acceptedDraftTokens;
+    metadata.draftAcceptanceRate =
+      result.acceptedDraftTokens / result.draftTokens;
+  }
+  if (result.discardedTokens) {
+    metadata.discardedTokens = result.discardedTokens;
+  }
+  if (result.tokens) {
+    metadata.tokens = Array.from(result.tokens);
+  }
+  if (result.choices) {
+    metadata.choices = result.choices.map(({ tokens, ...choice }) => ({
+      ...choice,
+      ...(tokens && { tokens: Array.from(tokens) }),
+    }));
+  }
+  return Object.keys(metadata).length > 0 ? { llamaCpp: metadata } : undefined;
+}
+
 export function convertUsage(
   promptTokens: number,
-  completionTokens: number
+  completionTokens: number,
+  cachedPromptTokens?: number
 ): LanguageModelV3Usage {
   return {
     inputTokens: {
       total: promptTokens,
-      noCache: undefined,
-      cacheRead: undefined,
+      noCache:
+        cachedPromptTokens !== undefined
+          ? promptTokens - cachedPromptTokens
+          : undefined,
+      cacheRead: cachedPromptTokens,
       cacheWrite: undefined,
     },
     outputTokens: {
@@ -429,10 +656,40 @@ export class LlamaCppLanguageModel implements LanguageModelV3 {
   private modelHandle: number | null = null;
   private readonly config: LlamaCppModelConfig;
   private initPromise: Promise<void> | null = null;
+  // Incremented by dispose(), whose unloading fails the running calls
+  private disposals = 0;
+  // Adapter paths by name, loaded again when the model is reloaded
+  private readonly loraAdapters: Map<string, string>;
 
   constructor(config: LlamaCppModelConfig) {
     this.config = config;
     this.modelId = config.modelPath;
+    this.loraAdapters = new Map(Object.entries(config.loraAdapters ?? {}));
+  }
+
+  /**
+   * Run a native call on the model, loading it first. The memory budget can
+   * evict the model between the load check and the call, which then fails; in
+   * that case the call is retried once on the reloaded model.
+   */
+  private async withModel<T>(run: (handle: number) => Promise<T>): Promise<T> {
+    return this.retryIfEvicted(await this.ensureModelLoaded(), run);
+  }
+
+  private async retryIfEvicted<T>(
+    handle: number,
+    run: (handle: number) => Promise<T>
+  ): Promise<T> {
+    const disposals = this.disposals;
+    try {
+      return await run(handle);
+    } catch (error) {
+      // Requests cut short by dispose() are not retried
+      if (disposals !== this.disposals || isModelLoaded(handle)) {
+        throw error;
+      }
+      return run(await this.ensureModelLoaded());
+    }
   }
 
   private async ensureModelLoaded(): Promise<number> {
@@ -440,6 +697,12 @@ export class LlamaCppLanguageModel implements LanguageModelV3 {
       return this.modelHandle;
     }
 
+    if (this.modelHandle !== null) {
+      // Evicted by the memory budget: release the stale handle and reload
+      unloadModel(this.modelHandle);
+      this.modelHandle = null;
+    }
+
     if (this.initPromise) {
       await this.initPromise;
       if (this.modelHandle !== null) {
@@ -452,9 +715,34 @@ export class LlamaCppLanguageModel implements LanguageModelV3 {
         modelPath: this.config.modelPath,
         contextSize: this.config.contextSize ?? 2048,
         gpuLayers: this.config.gpuLayers ?? 99,
+        splitMode: this.config.splitMode,
+        mainGpu: this.config.mainGpu,
+        tensorSplit: this.config.tensorSplit,
+        devices: this.config.devices,
+        numa: this.config.numa,
+        useMmap: this.config.useMmap,
+        useMlock: this.config.useMlock,
         threads: this.config.threads ?? 4,
+        batchSize: this.config.batchSize ?? 512,
+        ubatchSize: this.config.ubatchSize,
+        threadsBatch: this.config.threadsBatch,
+        cacheTypeK: this.config.cacheTypeK ?? "f16",
+        cacheTypeV: this.config.cacheTypeV ?? "f16",
+        flashAttention: this.config.flashAttention ?? "auto",
         debug: this.config.debug ?? false,
         chatTemplate: this.config.chatTemplate ?? "auto",
+        parallelSequences: this.config.parallelSequences ?? 1,
+        maxQueueSize: this.config.maxQueueSize ?? 0,
+        draftModelPath: this.config.draftModelPath,
+        draftTokens: this.config.draftTokens ?? 8,
+        lookupNgramSize: this.config.lookupNgramSize ?? 0,
+        loraAdapters:
+          this.loraAdapters.size > 0
+            ? Array.from(this.loraAdapters, ([name, path]) => ({ name, path }))
+            : undefined,
+        warmup: this.config.warmup ?? true,
+        prefetch: this.config.prefetch ?? false,
+        onProgress: this.config.onLoadProgress,
       };
 
       this.modelHandle = await loadModel(options);
@@ -470,13 +758,105 @@ export class LlamaCppLanguageModel implements LanguageModelV3 {
     return this.modelHandle;
   }
 
+  /**
+   * Load the model now instead of on the first call, e.g. before a server
+   * reports itself ready. Resolves once the model (and its warm-up) is done.
+   */
+  async load(): Promise<void> {
+    await this.ensureModelLoaded();
+  }
+
   async dispose(): Promise<void> {
+    this.disposals++;
     if (this.modelHandle !== null) {
       unloadModel(this.modelHandle);
       this.modelHandle = null;
     }
   }
 
+  /**
+   * Number of requests waiting for and occupying the model's sequences.
+   */
+  getQueueLength(): QueueLength {
+    if (this.modelHandle === null || !isModelLoaded(this.modelHandle)) {
+      return { pending: 0, active: 0 };
+    }
+    return getQueueLength(this.modelHandle);
+  }
+
+  /**
+   * Counters and latency histograms of the model's context since it was
+   * loaded, or undefined before the first call loads it. Use
+   * `formatPrometheusMetrics()` to export them.
+   */
+  getMetrics(): ModelMetrics | undefined {
+    if (this.modelHandle === null || !isModelLoaded(this.modelHandle)) {
+      return undefined;
+    }
+    return getMetrics(this.modelHandle);
+  }
+
+  /**
+   * Prefill a prompt prefix (typically a large system prompt) and save the
+   * resulting KV cache state to a file. Returns the number of saved tokens.
+   */
+  async saveSession(
+    path: string,
+    prompt: LanguageModelV3Message[]
+  ): Promise<number> {
+    const result = await this.withModel((handle) =>
+      saveSession(handle, { path, messages: convertMessages(prompt) })
+    );
+    return result.tokens;
+  }
+
+  /**
+   * Restore a KV cache state written by `saveSession()`. Subsequent requests
+   * that start with the saved prefix skip its prefill. Returns the number of
+   * restored tokens.
+   */
+  async loadSession(path: string): Promise<number> {
+    const result = await this.withModel((handle) =>
+      loadSession(handle, { path })
+    );
+    return result.tokens;
+  }
+
+  /**
+   * Token ids of each text, as views into one shared buffer. `addSpecial`
+   * adds the BOS token the model expects (default: true); control tokens
+   * written in the texts (e.g. `<|im_start|>`) are parsed as such.
+   */
+  async tokenize(
+    texts: string[],
+    options: { addSpecial?: boolean } = {}
+  ): Promise<Int32Array[]> {
+    return this.withModel((handle) => tokenize(handle, { texts, ...options }));
+  }
+
+  /**
+   * Text of each token list. `special` renders control tokens as text
+   * instead of leaving them out (default: false).
+   */
+  async detokenize(
+    tokens: Int32Array[],
+    options: { special?: boolean } = {}
+  ): Promise<string[]> {
+    return this.withModel((handle) =>
+      detokenize(handle, { tokens, ...options })
+    );
+  }
+
+  /**
+   * Load a LoRA adapter of the base model under `name`, which calls select
+   * with `providerOptions.llamaCpp.lora`. The base weights are shared, so an
+   * adapter only adds its own (small) tensors.
+   */
+  async loadLoraAdapter(name: string, path: string): Promise<void> {
+    await this.withModel((handle) => loadLoraAdapter(handle, { name, path }));
+    this.loraAdapters.set(name, path);
+  }
+
   async doGenerate(
     options: LanguageModelV3CallOptions
   ): Promise<LanguageModelV3GenerateResult> {
@@ -515,11 +895,31 @@ export class LlamaCppLanguageModel implements LanguageModelV3 {
       temperature: options.temperature ?? 0.7,
       topP: options.topP ?? 0.9,
       topK: options.topK ?? 40,
+      minP: getNumberProviderOption(options, "minP"),
+      typicalP: getNumberProviderOption(options, "typicalP"),
+      repeatPenalty: getNumberProviderOption(options, "repeatPenalty"),
+      frequencyPenalty: options.frequencyPenalty,
+      presencePenalty: options.presencePenalty,
+      penaltyLastN: getNumberProviderOption(options, "penaltyLastN"),
+      seed: options.seed,
       stopSequences: options.stopSequences,
       grammar,
+      priority: getNumberProviderOption(options, "priority"),
+      n: getNumberProviderOption(options, "n"),
+      promptTokens: getPromptTokensProviderOption(options),
+      returnTokens: options.providerOptions?.llamaCpp?.returnTokens === true,
+      lora: getLoraProviderOption(options),
+      timeoutMs:
+        getNumberProviderOption(options, "timeoutMs") ?? this.config.timeoutMs,
+      contextOverflow: this.config.contextOverflow,
     };
 
-    const result = await generate(handle, generateOptions);
+    const result = await this.retryIfEvicted(handle, (handle) =>
+      generate(handle, generateOptions, options.abortSignal)
+    );
+    if (result.finishReason === "cancelled" && options.abortSignal?.aborted) {
+      throw options.abortSignal.reason;
+    }
 
     const warnings: SharedV3Warning[] = [];
     const content: LanguageModelV3Content[] = [];
@@ -565,7 +965,12 @@ export class LlamaCppLanguageModel implements LanguageModelV3 {
     return {
       content,
       finishReason,
-      usage: convertUsage(result.promptTokens, result.completionTokens),
+      usage: convertUsage(
+        result.promptTokens,
+        result.completionTokens,
+        result.cachedPromptTokens
+      ),
+      providerMetadata: convertProviderMetadata(result),
       warnings,
       request: {
         body: generateOptions,
@@ -611,13 +1016,45 @@ export class LlamaCppLanguageModel implements LanguageModelV3 {
       temperature: options.temperature ?? 0.7,
       topP: options.topP ?? 0.9,
       topK: options.topK ?? 40,
+      minP: getNumberProviderOption(options, "minP"),
+      typicalP: getNumberProviderOption(options, "typicalP"),
+      repeatPenalty: getNumberProviderOption(options, "repeatPenalty"),
+      frequencyPenalty: options.frequencyPenalty,
+      presencePenalty: options.presencePenalty,
+      penaltyLastN: getNumberProviderOption(options, "penaltyLastN"),
+      seed: options.seed,
       stopSequences: options.stopSequences,
       grammar,
+      priority: getNumberProviderOption(options, "priority"),
+      n: getNumberProviderOption(options, "n"),
+      promptTokens: getPromptTokensProviderOption(options),
+      returnTokens: options.providerOptions?.llamaCpp?.returnTokens === true,
+      lora: getLoraProviderOption(options),
+      timeoutMs:
+        getNumberProviderOption(options, "timeoutMs") ?? this.config.timeoutMs,
+      contextOverflow: this.config.contextOverflow,
+      flushIntervalMs: this.config.streamFlushIntervalMs ?? 16,
+      flushTokens: this.config.streamFlushTokens ?? 32,
     };
 
     const textId = crypto.randomUUID();
 
+    // Cancels the native request when the caller aborts or the consumer
+    // cancels the stream, so abandoned streams stop using the GPU
+    const abortController = new AbortController();
+    const onAbort = () => abortController.abort(options.abortSignal?.reason);
+    if (options.abortSignal?.aborted) {
+      onAbort();
+    } else {
+      options.abortSignal?.addEventListener("abort", onAbort, { once: true });
+    }
+    let streamCancelled = false;
+
     const stream = new ReadableStream<LanguageModelV3StreamPart>({
+      cancel: () => {
+        streamCancelled = true;
+        abortController.abort();
+      },
       start: async (controller) => {
         try {
           // Emit stream start
@@ -636,73 +1073,84 @@ export class LlamaCppLanguageModel implements LanguageModelV3 {
           // Buffer tokens during detection phase when tools are present
           let tokenBuffer: string[] = [];
 
-          const result = await generateStream(
-            handle,
-            generateOptions,
-            (token) => {
-              fullText += token;
-
-              // When tools are provided, detect if output looks like a tool call
-              if (hasTools && options.toolChoice?.type !== "none") {
-                if (!detectionComplete) {
-                  // Buffer tokens during detection phase
-                  tokenBuffer.push(token);
-
-                  const trimmed = fullText.trimStart();
-                  // Check if it starts with JSON object/array (tool call pattern)
-                  if (trimmed.startsWith("{") || trimmed.startsWith("[")) {
-                    isToolCallMode = true;
-                    detectionComplete = true;
-                    // Don't flush buffer - suppress all tokens for tool calls
-                    return;
-                  } else if (trimmed.length > 0) {
-                    // First non-whitespace char is not JSON - it's regular text
-                    detectionComplete = true;
-                    // Flush buffered tokens as text deltas
-                    if (!textStartEmitted) {
-                      controller.enqueue({
-                        type: "text-start",
-                        id: textId,
-                      });
-                      textStartEmitted = true;
-                    }
-                    for (const bufferedToken of tokenBuffer) {
-                      controller.enqueue({
-                        type: "text-delta",
-                        id: textId,
-                        delta: bufferedToken,
-                      });
+          const result = await this.retryIfEvicted(handle, (handle) =>
+            generateStream(
+              handle,
+              generateOptions,
+              (token) => {
+                if (abortController.signal.aborted) {
+                  return;
+                }
+                fullText += token;
+  
+                // When tools are provided, detect if output looks like a tool call
+                if (hasTools && options.toolChoice?.type !== "none") {
+                  if (!detectionComplete) {
+                    // Buffer tokens during detection phase
+                    tokenBuffer.push(token);
+  
+                    const trimmed = fullText.trimStart();
+                    // Check if it starts with JSON object/array (tool call pattern)
+                    if (trimmed.startsWith("{") || trimmed.startsWith("[")) {
+                      isToolCallMode = true;
+                      detectionComplete = true;
+                      // Don't flush buffer - suppress all tokens for tool calls
+                      return;
+                    } else if (trimmed.length > 0) {
+                      // First non-whitespace char is not JSON - it's regular text
+                      detectionComplete = true;
+                      // Flush buffered tokens as text deltas
+                      if (!textStartEmitted) {
+                        controller.enqueue({
+                          type: "text-start",
+                          id: textId,
+                        });
+                        textStartEmitted = true;
+                      }
+                      for (const bufferedToken of tokenBuffer) {
+                        controller.enqueue({
+                          type: "text-delta",
+                          id: textId,
+                          delta: bufferedToken,
+                        });
+                      }
+                      tokenBuffer = [];
+                      return;
                     }
-                    tokenBuffer = [];
+                    // Still in detection phase (only whitespace so far)
+                    return;
+                  }
+  
+                  // If in tool call mode, don't emit text deltas
+                  if (isToolCallMode) {
                     return;
                   }
-                  // Still in detection phase (only whitespace so far)
-                  return;
                 }
-
-                // If in tool call mode, don't emit text deltas
-                if (isToolCallMode) {
-                  return;
+  
+                // Emit text start on first actual text delta
+                if (!textStartEmitted) {
+                  controller.enqueue({
+                    type: "text-start",
+                    id: textId,
+                  });
+                  textStartEmitted = true;
                 }
-              }
-
-              // Emit text start on first actual text delta
-              if (!textStartEmitted) {
+  
                 controller.enqueue({
-                  type: "text-start",
+                  type: "text-delta",
                   id: textId,
+                  delta: token,
                 });
-                textStartEmitted = true;
-              }
-
-              controller.enqueue({
-                type: "text-delta",
-                id: textId,
-                delta: token,
-              });
-            }
+              },
+              abortController.signal
+            );
           );
 
+          if (abortController.signal.aborted) {
+            // Surface the abort reason instead of a partial result
+            throw abortController.signal.reason;
+          }
+
           // Emit text end if we started text
           if (textStartEmitted) {
             controller.enqueue({
@@ -742,16 +1190,26 @@ export class LlamaCppLanguageModel implements LanguageModelV3 {
           controller.enqueue({
             type: "finish",
             finishReason,
-            usage: convertUsage(result.promptTokens, result.completionTokens),
+            usage: convertUsage(
+              result.promptTokens,
+              result.completionTokens,
+              result.cachedPromptTokens
+            ),
+            providerMetadata: convertProviderMetadata(result),
           });
 
           controller.close();
         } catch (error) {
-          controller.enqueue({
-            type: "error",
-            error,
-          });
-          controller.close();
+          // A cancelled stream no longer accepts parts
+          if (!streamCancelled) {
+            controller.enqueue({
+              type: "error",
+              error,
+            });
+            controller.close();
+          }
+        } finally {
+          options.abortSignal?.removeEventListener("abort", onAbort);
         }
       },
     });
@@ -3,6 +3,11 @@ import {
   type LlamaCppModelConfig,
 } from "./llama-cpp-language-model.js";
 import { LlamaCppEmbeddingModel } from "./llama-cpp-embedding-model.js";
+import type {
+  ContextOverflow,
+  KvCacheType,
+  NumaStrategy,
+} from "./native-binding.js";
 
 export interface LlamaCppProviderConfig {
   /**
@@ -21,15 +26,151 @@ export interface LlamaCppProviderConfig {
    */
   gpuLayers?: number;
 
+  /**
+   * Multi-GPU split: "layer" (default), "row" or "none" (whole model on `mainGpu`).
+   */
+  splitMode?: "none" | "layer" | "row";
+
+  /**
+   * GPU used with `splitMode: "none"` (default: 0).
+   */
+  mainGpu?: number;
+
+  /**
+   * Proportion of the model per device, e.g. [3, 1] (default: by free memory).
+   */
+  tensorSplit?: number[];
+
+  /**
+   * Names of the devices to use, see `getDevices()` (default: all).
+   */
+  devices?: string[];
+
+  /**
+   * Process-wide NUMA placement for CPU inference (default: "disabled").
+   */
+  numa?: NumaStrategy;
+
+  /**
+   * Map the model file instead of reading it (default: true).
+   */
+  useMmap?: boolean;
+
+  /**
+   * Lock the weights in RAM so they are never swapped out (default: false).
+   */
+  useMlock?: boolean;
+
   /**
    * Number of CPU threads to use (default2: 4).
    */
   threads?: number;
 
+  /**
+   * Tokens submitted per decode call during prompt processing (default: 512).
+   */
+  batchSize?: number;
+
+  /**
+   * Tokens per backend compute graph, at most `batchSize` (default: llama.cpp default).
+   */
+  ubatchSize?: number;
+
+  /**
+   * Number of CPU threads used for prompt processing (default: `threads`).
+   */
+  threadsBatch?: number;
+
+  /**
+   * KV cache type of keys (default: "f16"). "q8_0" halves the cache memory.
+   */
+  cacheTypeK?: KvCacheType;
+
+  /**
+   * KV cache type of values (default: "f16"). Quantized types need flash attention.
+   */
+  cacheTypeV?: KvCacheType;
+
+  /**
+   * Flash attention: "auto" enables it where the backend supports it (default: "auto").
+   */
+  flashAttention?: "auto" | "on" | "off";
+
   /**
    * Enable verbose debug output from llama.cpp (default: false).
    */
   debug?: boolean;
+
+  /**
+   * Number of requests decoded concurrently with continuous batching (default: 1).
+   * Each concurrent request gets its own sequence with the full context size.
+   * For embedding models, the maximum number of texts packed into one batch (default: 32).
+   */
+  parallelSequences?: number;
+
+  /**
+   * Maximum number of requests waiting for a free sequence (default: 0, unlimited).
+   * Further requests are rejected with a "Request queue is full" error.
+   */
+  maxQueueSize?: number;
+
+  /**
+   * Draft model with the same vocabulary for speculative decoding (default: none).
+   */
+  draftModelPath?: string;
+
+  /**
+   * Tokens drafted per decode step by the draft model or prompt lookup (default: 8).
+   */
+  draftTokens?: number;
+
+  /**
+   * N-gram length for draft-free prompt-lookup speculative decoding (default: 0, disabled).
+   */
+  lookupNgramSize?: number;
+
+  /**
+   * Warm up the context at load time for steady-state first-request latency (default: true).
+   */
+  warmup?: boolean;
+
+  /**
+   * Prefetch the model file into the page cache while loading (default: false).
+   */
+  prefetch?: boolean;
+
+  /**
+   * Called with the fraction of the weights loaded (0 to 1) while the model loads.
+   */
+  onLoadProgress?: (progress: number) => void;
+
+  /**
+   * Maximum delay in milliseconds before streamed text is delivered (default: 16).
+   */
+  streamFlushIntervalMs?: number;
+
+  /**
+   * Maximum number of tokens coalesced into one streamed chunk (default: 32).
+   */
+  streamFlushTokens?: number;
+
+  /**
+   * Default per-request deadline in milliseconds, including queueing (default: none).
+   */
+  timeoutMs?: number;
+
+  /**
+   * Handling of conversations that outgrow the context: "error" (default),
+   * "shift" (KV cache shift keeping the system prompt) or "truncate-middle"
+   * (drop the oldest messages after the system prompt).
+   */
+  contextOverflow?: ContextOverflow;
+
+  /**
+   * LoRA adapters by name and file path, selected per call with
+   * `providerOptions.llamaCpp.lora` (default: none).
+   */
+  loraAdapters?: Record<string, string>;
 }
 
 export interface LlamaCppProvider {
@@ -44,8 +185,34 @@ function createLlamaCpp(): LlamaCppProvider {
       modelPath: config.modelPath,
       contextSize: config.contextSize,
       gpuLayers: config.gpuLayers,
+      splitMode: config.splitMode,
+      mainGpu: config.mainGpu,
+      tensorSplit: config.tensorSplit,
+      devices: config.devices,
+      numa: config.numa,
+      useMmap: config.useMmap,
+      useMlock: config.useMlock,
       threads: config.threads,
+      batchSize: config.batchSize,
+      ubatchSize: config.ubatchSize,
+      threadsBatch: config.threadsBatch,
+      cacheTypeK: config.cacheTypeK,
+      cacheTypeV: config.cacheTypeV,
+      flashAttention: config.flashAttention,
       debug: config.debug,
+      parallelSequences: config.parallelSequences,
+      maxQueueSize: config.maxQueueSize,
+      draftModelPath: config.draftModelPath,
+      draftTokens: config.draftTokens,
+      lookupNgramSize: config.lookupNgramSize,
+      warmup: config.warmup,
+      prefetch: config.prefetch,
+      onLoadProgress: config.onLoadProgress,
+      streamFlushIntervalMs: config.streamFlushIntervalMs,
+      streamFlushTokens: config.streamFlushTokens,
+      timeoutMs: config.timeoutMs,
+      contextOverflow: config.contextOverflow,
+      loraAdapters: config.loraAdapters,
     };
 
     return new LlamaCppLanguageModel(modelConfig);
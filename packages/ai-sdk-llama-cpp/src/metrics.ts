@@ -0,0 +1,163 @@
+import type { MetricsHistogram, ModelMetrics } from "./native-binding.js";
+
+export interface PrometheusFormatOptions {
+  /** Prefix of every metric name (default: "llamacpp_") */
+  prefix?: string;
+  /** Labels added to every sample, e.g. `{ model: "llama-3.2-1b" }` */
+  labels?: Record<string, string>;
+}
+
+type Labels = Record<string, string>;
+
+function escapeLabelValue(value: string): string {
+  return value
+    .replace(/\\/g, "\\\\")
+    .replace(/\n/g, "\\n")
+    .replace(/"/g, '\\"');
+}
+
+function formatLabels(labels: Labels): string {
+  const entries = Object.entries(labels);
+  if (entries.length === 0) {
+    return "";
+  }
+  return `{${entries
+    .map(([name, value]) => `${name}="${escapeLabelValue(value)}"`)
+    .join(",")}}`;
+}
+
+function formatValue(value: number): string {
+  if (value === Infinity) return "+Inf";
+  if (value === -Infinity) return "-Inf";
+  return String(value);
+}
+
+/**
+ * Format the metrics of a model handle (see `getMetrics()`) in the Prometheus
+ * text exposition format, e.g. to serve them from a `/metrics` endpoint.
+ */
+export function formatPrometheusMetrics(
+  metrics: ModelMetrics,
+  options: PrometheusFormatOptions = {}
+): string {
+  const prefix = options.prefix ?? "llamacpp_";
+  const base = options.labels ?? {};
+  const lines: string[] = [];
+
+  const family = (
+    name: string,
+    type: "counter" | "histogram",
+    help: string
+  ) => {
+    lines.push(`# HELP ${prefix}${name} ${help}`);
+    lines.push(`# TYPE ${prefix}${name} ${type}`);
+  };
+  const sample = (name: string, value: number, labels: Labels = {}) => {
+    lines.push(
+      `${prefix}${name}${formatLabels({ ...base, ...labels })} ${formatValue(value)}`
+    );
+  };
+  const counter = (name: string, help: string, value: number) => {
+    family(name, "counter", help);
+    sample(name, value);
+  };
+  const histogram = (name: string, help: string, data: MetricsHistogram) => {
+    family(name, "histogram", help);
+    for (const bucket of data.buckets) {
+      sample(`${name}_bucket`, bucket.count, { le: formatValue(bucket.le) });
+    }
+    sample(`${name}_bucket`, data.count, { le: "+Inf" });
+    sample(`${name}_sum`, data.sum);
+    sample(`${name}_count`, data.count);
+  };
+
+  family("requests_total", "counter", "Finished generation requests.");
+  for (const [reason, count] of Object.entries(metrics.requests)) {
+    sample("requests_total", count ?? 0, { finish_reason: reason });
+  }
+
+  counter(
+    "prompt_tokens_total",
+    "Prompt tokens of generation requests.",
+    metrics.promptTokens
+  );
+  counter(
+    "cached_prompt_tokens_total",
+    "Prompt tokens reused from the KV cache.",
+    metrics.cachedPromptTokens
+  );
+  counter(
+    "completion_tokens_total",
+    "Generated completion tokens.",
+    metrics.completionTokens
+  );
+  counter(
+    "draft_tokens_total",
+    "Tokens proposed by speculative decoding.",
+    metrics.draftTokens
+  );
+  counter(
+    "accepted_draft_tokens_total",
+    "Proposed tokens accepted by the main model.",
+    metrics.acceptedDraftTokens
+  );
+  counter(
+    "discarded_tokens_total",
+    "Tokens dropped to fit the context.",
+    metrics.discardedTokens
+  );
+  counter(
+    "embedding_requests_total",
+    "Embedding requests.",
+    metrics.embeddingRequests
+  );
+  counter("embedding_texts_total", "Embedded texts.", metrics.embeddingTexts);
+  counter(
+    "embedding_tokens_total",
+    "Tokens of embedded texts.",
+    metrics.embeddingTokens
+  );
+  counter(
+    "decode_steps_total",
+    "Decode calls of the generation scheduler.",
+    metrics.decodeSteps
+  );
+  counter(
+    "decode_tokens_total",
+    "Tokens in decode calls of the generation scheduler.",
+    metrics.decodeTokens
+  );
+
+  family("phase_seconds_total", "counter", "Seconds spent in each phase.");
+  for (const [phase, seconds] of Object.entries(metrics.seconds)) {
+    sample("phase_seconds_total", seconds, { phase });
+  }
+
+  histogram(
+    "queue_wait_seconds",
+    "Time until a request was picked up by the scheduler.",
+    metrics.histograms.queueWait
+  );
+  histogram(
+    "time_to_first_token_seconds",
+    "Time from submission to the first completion token.",
+    metrics.histograms.timeToFirstToken
+  );
+  histogram(
+    "time_per_output_token_seconds",
+    "Time per completion token after the first.",
+    metrics.histograms.timePerOutputToken
+  );
+  histogram(
+    "request_duration_seconds",
+    "Time from submission to completion of generation requests.",
+    metrics.histograms.requestDuration
+  );
+  histogram(
+    "embedding_duration_seconds",
+    "Duration of embedding requests.",
+    metrics.histograms.embeddingDuration
+  );
+
+  return lines.join("\n") + "\n";
+}
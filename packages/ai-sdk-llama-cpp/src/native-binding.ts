@@ -10,11 +10,123 @@ const binding = require(
   join(__dirname, "..", "build", "Release", "llama_binding.node")
 ) as NativeBinding;
 
-export interface LoadModelOptions {
-  modelPath: string;
-  gpuLayers?: number;
+/**
+ * KV cache element type. Quantized types (`q8_0` halves the memory of `f16`
+ * with little quality loss) need flash attention for the V cache.
+ */
+export type KvCacheType =
+  | "f32"
+  | "f16"
+  | "bf16"
+  | "q8_0"
+  | "q4_0"
+  | "q4_1"
+  | "iq4_nl"
+  | "q5_0"
+  | "q5_1";
+
+/** Options of a context (shared by `loadModel()` and `createContext()`) */
+export interface ContextOptions {
   contextSize?: number;
+  /**
+   * Maximum number of tokens submitted per decode call (prompt chunk size).
+   * Default: 512
+   */
+  batchSize?: number;
+  /**
+   * Physical batch size processed by the backend per compute graph, at most
+   * `batchSize`. Default: llama.cpp default (512)
+   */
+  ubatchSize?: number;
+  /** Threads used for token generation. Default: 4 */
   threads?: number;
+  /** Threads used for prompt processing. Default: `threads` */
+  threadsBatch?: number;
+  /** KV cache type of keys. Default: "f16" */
+  cacheTypeK?: KvCacheType;
+  /** KV cache type of values. Quantized types need flash attention. Default: "f16" */
+  cacheTypeV?: KvCacheType;
+  /**
+   * Flash attention: "auto" enables it where the backend supports it.
+   * Default: "auto"
+   */
+  flashAttention?: "auto" | "on" | "off";
+  /**
+   * Whether to create an embedding context.
+   * When true, creates an embedding context with mean pooling enabled.
+   * Default: false
+   */
+  embedding?: boolean;
+  /**
+   * Number of requests that are decoded concurrently on one context
+   * (continuous batching). Each sequence gets its own `contextSize`.
+   * For embedding contexts, the maximum number of texts packed into one batch.
+   * Default: 1
+   */
+  parallelSequences?: number;
+  /**
+   * Maximum number of requests waiting for a free sequence. Further requests
+   * are rejected with a "Request queue is full" error.
+   * Default: 0 (unlimited)
+   */
+  maxQueueSize?: number;
+  /**
+   * Number of tokens drafted per decode step by the draft model or prompt lookup.
+   * Default: 8
+   */
+  draftTokens?: number;
+  /**
+   * Prompt-lookup speculative decoding: the last `lookupNgramSize` tokens are
+   * matched against the earlier prompt and output, and the tokens that followed
+   * the match are verified as drafts. Needs no draft model. Default: 0 (disabled)
+   */
+  lookupNgramSize?: number;
+  /**
+   * LoRA adapters of the base model to load with the context, by the name
+   * that requests select them with (generation contexts only)
+   */
+  loraAdapters?: { name: string; path: string }[];
+}
+
+export type NumaStrategy =
+  | "disabled"
+  | "distribute"
+  | "isolate"
+  | "numactl"
+  | "mirror";
+
+/**
+ * Loaded weights are shared: loading a file (or draft model) that is already
+ * loaded with the same `gpuLayers` and placement options only creates a new
+ * context over it.
+ */
+export interface LoadModelOptions extends ContextOptions {
+  modelPath: string;
+  gpuLayers?: number;
+  /**
+   * How the model is split across multiple GPUs: "layer" (default) assigns
+   * whole layers to each device, "row" also splits tensors by rows, "none"
+   * keeps the model on `mainGpu`.
+   */
+  splitMode?: "none" | "layer" | "row";
+  /** Index of the GPU used with `splitMode: "none"`. Default: 0 */
+  mainGpu?: number;
+  /**
+   * Proportion of the model per device, e.g. `[3, 1]`. Default: proportional
+   * to the free memory of each device
+   */
+  tensorSplit?: number[];
+  /** Names of the devices to use (see `getDevices()`). Default: all */
+  devices?: string[];
+  /**
+   * NUMA placement of CPU threads and memory. Applies to the whole process;
+   * only the first value other than "disabled" takes effect. Default: "disabled"
+   */
+  numa?: NumaStrategy;
+  /** Map the model file instead of reading it into memory. Default: true */
+  useMmap?: boolean;
+  /** Lock the weights in RAM so that they are never swapped out. Default: false */
+  useMlock?: boolean;
   debug?: boolean;
   /**
    * Chat template to use for formatting messages.
@@ -23,11 +135,21 @@ export interface LoadModelOptions {
    */
   chatTemplate?: string;
   /**
-   * Whether to load the model for embedding generation.
-   * When true, creates an embedding context with mean pooling enabled.
+   * Path to a small GGUF model with the same vocabulary that drafts tokens for
+   * speculative decoding. The main model verifies the drafts in one decode step.
+   */
+  draftModelPath?: string;
+  /**
+   * Ask the OS to read the model file into the page cache in the background
+   * while it is loaded, instead of faulting the mmap'd weights in page by page.
    * Default: false
    */
-  embedding?: boolean;
+  prefetch?: boolean;
+  /**
+   * Called with the fraction of the weights loaded (0 to 1) while the model
+   * loads. Called once with 1 if the weights are already loaded.
+   */
+  onProgress?: (progress: number) => void;
 }
 
 export interface ChatMessage {
@@ -36,30 +158,291 @@ export interface ChatMessage {
 }
 
 export interface GenerateOptions {
-  messages: ChatMessage[];
+  /** Chat messages, rendered with the model's chat template */
+  messages?: ChatMessage[];
+  /**
+   * Tokens of an already rendered prompt, used instead of `messages`. They are
+   * decoded as given, so they include BOS and the chat template's markup.
+   */
+  promptTokens?: Int32Array;
+  /** Also return the ids of the generated tokens (default: false) */
+  returnTokens?: boolean;
   maxTokens?: number;
   temperature?: number;
   topP?: number;
   topK?: number;
+  /** Minimum probability relative to the most likely token (default: 0, disabled) */
+  minP?: number;
+  /** Locally typical sampling threshold (default: 1, disabled) */
+  typicalP?: number;
+  /** Penalty for repeated tokens, e.g. 1.1 (default: 1, disabled) */
+  repeatPenalty?: number;
+  /** Penalty proportional to how often a token occurred (default: 0) */
+  frequencyPenalty?: number;
+  /** Penalty for tokens that occurred at all (default: 0) */
+  presencePenalty?: number;
+  /** Recent tokens the penalties look at, -1 for the whole sequence (default: 64) */
+  penaltyLastN?: number;
+  /**
+   * Seed of the random sampler for reproducible outputs (default: random).
+   * With `n` > 1, choice i uses `seed + i`.
+   */
+  seed?: number;
   stopSequences?: string[];
   /** GBNF grammar string for structured output */
   grammar?: string;
+  /** Requests with a higher priority are started first (default: 0) */
+  priority?: number;
+  /**
+   * Streaming only: generated text is delivered in chunks at most every
+   * `flushIntervalMs` milliseconds (default: 16) and at least every
+   * `flushTokens` tokens (default: 32). The first token is delivered immediately.
+   */
+  flushIntervalMs?: number;
+  flushTokens?: number;
+  /**
+   * Deadline in milliseconds measured from submission, including time spent
+   * waiting in the queue. Expired requests finish with reason "timeout".
+   * Default: 0 (none)
+   */
+  timeoutMs?: number;
+  /**
+   * What to do when the conversation does not fit into the context:
+   * - "error" (default): fail prompts that do not fit; stop with "length" when the context is full
+   * - "shift": keep the system prompt and discard the oldest half of the rest,
+   *   shifting the KV cache instead of prefilling again
+   * - "truncate-middle": drop the oldest messages after the system prompt
+   */
+  contextOverflow?: ContextOverflow;
+  /**
+   * Number of completions to sample from the prompt (default: 1). The prompt
+   * is prefilled once and copied into `n` sequences that are decoded together,
+   * so `n` may not exceed the model's `parallelSequences`. Streaming delivers
+   * the first completion only.
+   */
+  n?: number;
+  /**
+   * LoRA adapters to apply, by the name they were loaded under (scale
+   * default: 1). Requests for different adapter sets take turns on the
+   * context, since adapters apply to all sequences decoded together.
+   */
+  lora?: LoraAdapterScale[];
+}
+
+export interface LoraAdapterScale {
+  name: string;
+  scale?: number;
 }
 
+export type ContextOverflow = "error" | "shift" | "truncate-middle";
+
 export interface GenerateResult {
   text: string;
   promptTokens: number;
   completionTokens: number;
-  finishReason: "stop" | "length" | "error";
+  /** Prompt tokens reused from the KV cache of a previous request */
+  cachedPromptTokens: number;
+  /** Tokens proposed by the draft model or prompt lookup (0 without speculative decoding) */
+  draftTokens: number;
+  /** Proposed tokens that matched the main model's samples */
+  acceptedDraftTokens: number;
+  /** Prompt or context tokens dropped by the `contextOverflow` policy */
+  discardedTokens: number;
+  finishReason: "stop" | "length" | "cancelled" | "timeout" | "error";
+  timings: GenerateTimings;
+  /**
+   * With `n` > 1, every completion in order. `text` and `finishReason` are
+   * those of the first one, while `completionTokens` counts all of them.
+   */
+  choices?: GenerateChoice[];
+  /** Generated token ids without end of sequence (with `returnTokens`) */
+  tokens?: Int32Array;
+}
+
+/** One of the `n` completions of a request */
+export interface GenerateChoice {
+  text: string;
+  completionTokens: number;
+  finishReason: GenerateResult["finishReason"];
+  tokens?: Int32Array;
+}
+
+/** Where the time of a generation request went, in milliseconds */
+export interface GenerateTimings {
+  /** Submission until the scheduler picked the request up */
+  queueMs: number;
+  /** Chat template rendering */
+  templateMs: number;
+  /** Prompt tokenization */
+  tokenizeMs: number;
+  /** Admission until the first completion token was sampled */
+  prefillMs: number;
+  /** First completion token until the end of the request */
+  decodeMs: number;
+  /**
+   * llama.cpp decode time of the batches the request took part in, which are
+   * shared with the other requests decoded at the same time
+   */
+  evalMs: number;
+  /** Sampling, including grammar checks */
+  sampleMs: number;
+  /**
+   * Streaming token callbacks on the native side: staging text and queueing
+   * flushes to JavaScript, which never wait for the event loop
+   */
+  callbackMs: number;
+  /** Submission until the first completion token (0 if there was none) */
+  timeToFirstTokenMs: number;
+  /** Submission until completion */
+  totalMs: number;
+}
+
+/** Cumulative histogram in seconds, in the layout of Prometheus histograms */
+export interface MetricsHistogram {
+  /** Observations less than or equal to each upper bound */
+  buckets: { le: number; count: number }[];
+  /** All observations (the +Inf bucket) */
+  count: number;
+  sum: number;
+}
+
+/** Counters and latency histograms of one model handle since it was loaded */
+export interface ModelMetrics {
+  /** Finished generation requests by finish reason */
+  requests: Partial<Record<GenerateResult["finishReason"], number>>;
+  promptTokens: number;
+  cachedPromptTokens: number;
+  completionTokens: number;
+  draftTokens: number;
+  acceptedDraftTokens: number;
+  discardedTokens: number;
+  embeddingRequests: number;
+  embeddingTexts: number;
+  embeddingTokens: number;
+  /** Decode calls of the scheduler, and the tokens in them */
+  decodeSteps: number;
+  decodeTokens: number;
+  /** Total seconds spent per phase */
+  seconds: {
+    template: number;
+    tokenize: number;
+    eval: number;
+    draft: number;
+    sample: number;
+    callback: number;
+  };
+  histograms: {
+    queueWait: MetricsHistogram;
+    timeToFirstToken: MetricsHistogram;
+    timePerOutputToken: MetricsHistogram;
+    requestDuration: MetricsHistogram;
+    embeddingDuration: MetricsHistogram;
+  };
 }
 
+/**
+ * Memory limits for the weights of all loaded models, in bytes. When loading a
+ * model would exceed a limit, idle models are unloaded, least recently used
+ * first. Omitted or 0: unlimited.
+ */
+export interface MemoryBudget {
+  ramBytes?: number;
+  vramBytes?: number;
+}
+
+/** Weights currently loaded in the process */
+export interface ResidentModel {
+  modelPath: string;
+  /** Estimated size of the weights in host memory */
+  ramBytes: number;
+  /** Estimated size of the weights offloaded to GPU devices */
+  vramBytes: number;
+  /** Contexts using the weights (e.g. a language and an embedding model) */
+  contexts: number;
+  /** Milliseconds since the weights were last used by a request */
+  idleMs: number;
+}
+
+/** A backend device that models can be placed on */
+export interface DeviceInfo {
+  /** Name for the `devices` option, e.g. "Metal" or "CUDA0" */
+  name: string;
+  description: string;
+  type: "cpu" | "gpu" | "igpu" | "accel";
+  freeBytes: number;
+  totalBytes: number;
+}
+
+export interface QueueLength {
+  /** Requests waiting for a free sequence */
+  pending: number;
+  /** Requests currently being decoded */
+  active: number;
+}
+
+export interface SaveSessionOptions {
+  /** File to write the session state to */
+  path: string;
+  /** Prompt prefix (e.g. the system prompt) to prefill and save */
+  messages: ChatMessage[];
+}
+
+export interface LoadSessionOptions {
+  /** Session file written by saveSession */
+  path: string;
+}
+
+export interface SessionResult {
+  /** Number of prompt tokens covered by the session state */
+  tokens: number;
+}
+
+/**
+ * Output format of L2-normalized embeddings:
+ * - `float32`: one float per dimension (`Float32Array`)
+ * - `float16`: IEEE half-precision bits per dimension (`Uint16Array`)
+ * - `int8`: one int8 per dimension (`Int8Array`); multiply by the row's scale to dequantize
+ * - `binary`: one sign bit per dimension, packed MSB-first (`Uint8Array`)
+ */
+export type EmbeddingEncoding = "float32" | "float16" | "int8" | "binary";
+
+export type EmbeddingArray = Float32Array | Uint16Array | Int8Array | Uint8Array;
+
 export interface EmbedOptions {
-  texts: string[];
+  texts?: string[];
+  /**
+   * Already tokenized texts, used instead of `texts`. Token lists with ids
+   * outside the vocabulary get a zero embedding.
+   */
+  tokens?: Int32Array[];
+  /** Output encoding (default: float32) */
+  encoding?: EmbeddingEncoding;
 }
 
 export interface EmbedResult {
-  embeddings: Float32Array[];
+  /** One embedding per input text; each is a view into `data` */
+  embeddings: EmbeddingArray[];
+  /** All embeddings as one contiguous row-major buffer */
+  data: EmbeddingArray;
+  encoding: EmbeddingEncoding;
+  /** Number of dimensions of each embedding */
+  dimensions: number;
+  /** Per-embedding dequantization scale (int8 only) */
+  scales?: Float32Array;
   totalTokens: number;
+  timings: { tokenizeMs: number; evalMs: number; totalMs: number };
+}
+
+export interface TokenizeOptions {
+  texts: string[];
+  /** Add the BOS/EOS tokens the model expects (default: true) */
+  addSpecial?: boolean;
+}
+
+export interface DetokenizeOptions {
+  tokens: Int32Array[];
+  /** Render control tokens as text instead of leaving them out (default: false) */
+  special?: boolean;
 }
 
 interface NativeBinding {
@@ -67,25 +450,66 @@ interface NativeBinding {
     options: LoadModelOptions,
     callback: (error: string | null, handle: number | null) => void
   ): void;
+  createContext(
+    handle: number,
+    options: ContextOptions,
+    callback: (error: string | null, handle: number | null) => void
+  ): void;
   unloadModel(handle: number): boolean;
+  getQueueLength(handle: number): QueueLength;
+  getMetrics(handle: number): ModelMetrics;
+  setMemoryBudget(
+    budget: MemoryBudget,
+    callback: (error: string | null) => void
+  ): void;
+  getResidentModels(): ResidentModel[];
+  getDevices(): DeviceInfo[];
+  /** Returns the request id for `cancel()` */
   generate(
     handle: number,
     options: GenerateOptions,
     callback: (error: string | null, result: GenerateResult | null) => void
-  ): void;
+  ): number | undefined;
   generateStream(
     handle: number,
     options: GenerateOptions,
     tokenCallback: (token: string) => void,
     doneCallback: (error: string | null, result: GenerateResult | null) => void
-  ): void;
+  ): number | undefined;
+  cancel(handle: number, requestId: number): boolean;
   isModelLoaded(handle: number): boolean;
+  saveSession(
+    handle: number,
+    options: SaveSessionOptions,
+    callback: (error: string | null, result: SessionResult | null) => void
+  ): void;
+  loadSession(
+    handle: number,
+    options: LoadSessionOptions,
+    callback: (error: string | null, result: SessionResult | null) => void
+  ): void;
+  loadLoraAdapter(
+    handle: number,
+    options: { name: string; path: string },
+    callback: (error: string | null, result: boolean | null) => void
+  ): void;
   // Embedding functions
   embed(
     handle: number,
     options: EmbedOptions,
     callback: (error: string | null, result: EmbedResult | null) => void
   ): void;
+  // Token functions
+  tokenize(
+    handle: number,
+    options: TokenizeOptions,
+    callback: (error: string | null, tokens: Int32Array[] | null) => void
+  ): void;
+  detokenize(
+    handle: number,
+    options: DetokenizeOptions,
+    callback: (error: string | null, texts: string[] | null) => void
+  ): void;
 }
 
 export function loadModel(options: LoadModelOptions): Promise<number> {
@@ -102,16 +526,72 @@ export function loadModel(options: LoadModelOptions): Promise<number> {
   });
 }
 
+/**
+ * Create another context over the weights of the loaded model `handle`, e.g.
+ * an embedding context or one with a different context size. Returns a new
+ * handle; the weights stay loaded until every handle using them is unloaded.
+ */
+export function createContext(
+  handle: number,
+  options: ContextOptions
+): Promise<number> {
+  return new Promise((resolve, reject) => {
+    binding.createContext(handle, options, (error, contextHandle) => {
+      if (error) {
+        reject(new Error(error));
+      } else if (contextHandle !== null) {
+        resolve(contextHandle);
+      } else {
+        reject(new Error("Failed to create context: unknown error"));
+      }
+    });
+  });
+}
+
+/**
+ * Release a handle right away. The model's context is freed in the background,
+ * after its current decode step is aborted.
+ */
 export function unloadModel(handle: number): boolean {
   return binding.unloadModel(handle);
 }
 
+/**
+ * Cancel native request `requestId` once `signal` aborts. Returns a function
+ * that removes the listener after the request has completed.
+ */
+function cancelOnAbort(
+  handle: number,
+  requestId: number | undefined,
+  signal: AbortSignal | undefined
+): () => void {
+  if (!signal || requestId === undefined) {
+    return () => {};
+  }
+  const onAbort = () => {
+    binding.cancel(handle, requestId);
+  };
+  signal.addEventListener("abort", onAbort, { once: true });
+  return () => signal.removeEventListener("abort", onAbort);
+}
+
+/**
+ * Aborting `signal` cancels the request: it resolves with finish reason
+ * "cancelled" and the text generated so far.
+ */
 export function generate(
   handle: number,
-  options: GenerateOptions
+  options: GenerateOptions,
+  signal?: AbortSignal
 ): Promise<GenerateResult> {
   return new Promise((resolve, reject) => {
-    binding.generate(handle, options, (error, result) => {
+    if (signal?.aborted) {
+      reject(signal.reason);
+      return;
+    }
+    let cleanup = () => {};
+    const requestId = binding.generate(handle, options, (error, result) => {
+      cleanup();
       if (error) {
         reject(new Error(error));
       } else if (result) {
@@ -120,29 +600,127 @@ export function generate(
         reject(new Error("Failed to generate: unknown error"));
       }
     });
+    cleanup = cancelOnAbort(handle, requestId, signal);
   });
 }
 
 export function generateStream(
   handle: number,
   options: GenerateOptions,
-  onToken: (token: string) => void
+  onToken: (token: string) => void,
+  signal?: AbortSignal
 ): Promise<GenerateResult> {
   return new Promise((resolve, reject) => {
-    binding.generateStream(handle, options, onToken, (error, result) => {
+    if (signal?.aborted) {
+      reject(signal.reason);
+      return;
+    }
+    let cleanup = () => {};
+    const requestId = binding.generateStream(
+      handle,
+      options,
+      onToken,
+      (error, result) => {
+        cleanup();
+        if (error) {
+          reject(new Error(error));
+        } else if (result) {
+          resolve(result);
+        } else {
+          reject(new Error("Failed to generate stream: unknown error"));
+        }
+      }
+    );
+    cleanup = cancelOnAbort(handle, requestId, signal);
+  });
+}
+
+export function isModelLoaded(handle: number): boolean {
+  return binding.isModelLoaded(handle);
+}
+
+export function getQueueLength(handle: number): QueueLength {
+  return binding.getQueueLength(handle);
+}
+
+export function getMetrics(handle: number): ModelMetrics {
+  return binding.getMetrics(handle);
+}
+
+/**
+ * Set the memory budget for the weights of all loaded models. Idle models that
+ * no longer fit are unloaded in the background; the promise resolves once they
+ * are. Evicted models are loaded again by their next request.
+ */
+export function setMemoryBudget(budget: MemoryBudget): Promise<void> {
+  return new Promise((resolve, reject) => {
+    binding.setMemoryBudget(budget, (error) => {
+      if (error) {
+        reject(new Error(error));
+      } else {
+        resolve();
+      }
+    });
+  });
+}
+
+export function getResidentModels(): ResidentModel[] {
+  return binding.getResidentModels();
+}
+
+export function getDevices(): DeviceInfo[] {
+  return binding.getDevices();
+}
+
+export function saveSession(
+  handle: number,
+  options: SaveSessionOptions
+): Promise<SessionResult> {
+  return new Promise((resolve, reject) => {
+    binding.saveSession(handle, options, (error, result) => {
       if (error) {
         reject(new Error(error));
       } else if (result) {
         resolve(result);
       } else {
-        reject(new Error("Failed to generate stream: unknown error"));
+        reject(new Error("Failed to save session: unknown error"));
       }
     });
   });
 }
 
-export function isModelLoaded(handle: number): boolean {
-  return binding.isModelLoaded(handle);
+export function loadSession(
+  handle: number,
+  options: LoadSessionOptions
+): Promise<SessionResult> {
+  return new Promise((resolve, reject) => {
+    binding.loadSession(handle, options, (error, result) => {
+      if (error) {
+        reject(new Error(error));
+      } else if (result) {
+        resolve(result);
+      } else {
+        reject(new Error("Failed to load session: unknown error"));
+      }
+    });
+  });
+}
+
+export function loadLoraAdapter(
+  handle: number,
+  options: { name: string; path: string }
+): Promise<void> {
+  return new Promise((resolve, reject) => {
+    binding.loadLoraAdapter(handle, options, (error, result) => {
+      if (error) {
+        reject(new Error(error));
+      } else if (result) {
+        resolve();
+      } else {
+        reject(new Error("Failed to load LoRA adapter: unknown error"));
+      }
+    });
+  });
 }
 
 export function embed(
@@ -161,3 +739,41 @@ export function embed(
     });
   });
 }
+
+/**
+ * Tokenize texts; each result is a view into one shared buffer. Control tokens
+ * written in the texts (e.g. `<|im_start|>`) are parsed as such.
+ */
+export function tokenize(
+  handle: number,
+  options: TokenizeOptions
+): Promise<Int32Array[]> {
+  return new Promise((resolve, reject) => {
+    binding.tokenize(handle, options, (error, tokens) => {
+      if (error) {
+        reject(new Error(error));
+      } else if (tokens) {
+        resolve(tokens);
+      } else {
+        reject(new Error("Failed to tokenize: unknown error"));
+      }
+    });
+  });
+}
+
+export function detokenize(
+  handle: number,
+  options: DetokenizeOptions
+): Promise<string[]> {
+  return new Promise((resolve, reject) => {
+    binding.detokenize(handle, options, (error, texts) => {
+      if (error) {
+        reject(new Error(error));
+      } else if (texts) {
+        resolve(texts);
+      } else {
+        reject(new Error("Failed to detokenize: unknown error"));
+      }
+    });
+  });
+}
@@ -0,0 +1,36 @@
+import { describe, it, expect, afterAll } from "vitest";
+
+// Runs against the native binding; skipped unless TEST_MODEL_PATH points to
+// a GGUF model
+const modelPath = process.env.TEST_MODEL_PATH;
+
+describe.skipIf(!modelPath)("LlamaCppEmbeddingModel E2E", () => {
+  let dispose: (() => Promise<void>) | undefined;
+
+  afterAll(async () => {
+    await dispose?.();
+  });
+
+  it("embeds and tokenizes repeatedly on one context", async () => {
+    const { LlamaCppEmbeddingModel } = await import(
+      "../../src/llama-cpp-embedding-model.js"
+    );
+    const model = new LlamaCppEmbeddingModel({ modelPath: modelPath! });
+    dispose = () => model.dispose();
+
+    // Every call is a task on the embedding context's scheduler thread, which
+    // has no generation slots
+    for (let i = 0; i < 3; i++) {
+      const { embeddings } = await model.doEmbed({
+        values: ["hello world", "goodbye"],
+      });
+      expect(embeddings).toHaveLength(2);
+      expect(embeddings[0].length).toBeGreaterThan(0);
+    }
+
+    const [tokens] = await model.tokenize(["hello world"]);
+    expect(tokens.length).toBeGreaterThan(0);
+    const [text] = await model.detokenize([tokens]);
+    expect(text).toContain("hello");
+  });
+});
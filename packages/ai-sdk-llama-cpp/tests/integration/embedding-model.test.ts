@@ -0,0 +1,193 @@
+import { describe, it, expect, vi, beforeEach, afterEach } from "vitest";
+
+// Mock the native binding module before importing the embedding model
+vi.mock("../../src/native-binding.js", () => {
+  const data = new Float32Array([1, 0, 0, 0, 1, 0]);
+  return {
+    loadModel: vi.fn().mockResolvedValue(1),
+    unloadModel: vi.fn().mockReturnValue(true),
+    isModelLoaded: vi.fn().mockReturnValue(true),
+    embed: vi.fn().mockResolvedValue({
+      embeddings: [data.subarray(0, 3), data.subarray(3, 6)],
+      data,
+      encoding: "float32",
+      dimensions: 3,
+      totalTokens: 7,
+    }),
+    tokenize: vi.fn().mockResolvedValue([new Int32Array([101, 7592, 102])]),
+    detokenize: vi.fn().mockResolvedValue(["hello"]),
+  };
+});
+
+// Import after mocking
+import { LlamaCppEmbeddingModel } from "../../src/llama-cpp-embedding-model.js";
+import * as nativeBinding from "../../src/native-binding.js";
+
+describe("LlamaCppEmbeddingModel Integration", () => {
+  let model: LlamaCppEmbeddingModel;
+
+  beforeEach(() => {
+    vi.clearAllMocks();
+    model = new LlamaCppEmbeddingModel({
+      modelPath: "/test/embed.gguf",
+    });
+  });
+
+  afterEach(async () => {
+    await model.dispose();
+  });
+
+  describe("doEmbed", () => {
+    it("returns one number array per input value", async () => {
+      const result = await model.doEmbed({ values: ["hello", "world"] });
+
+      expect(result.embeddings).toEqual([
+        [1, 0, 0],
+        [0, 1, 0],
+      ]);
+    });
+
+    it("returns token usage", async () => {
+      const result = await model.doEmbed({ values: ["hello", "world"] });
+
+      expect(result.usage).toEqual({ tokens: 7 });
+    });
+
+    it("passes texts to the native binding", async () => {
+      await model.doEmbed({ values: ["hello", "world"] });
+
+      expect(nativeBinding.embed).toHaveBeenCalledWith(1, {
+        texts: ["hello", "world"],
+      });
+    });
+
+    it("passes the encoding from provider options", async () => {
+      vi.mocked(nativeBinding.embed).mockResolvedValueOnce({
+        embeddings: [new Int8Array([127, -64, 0])],
+        data: new Int8Array([127, -64, 0]),
+        encoding: "int8",
+        dimensions: 3,
+        scales: new Float32Array([0.5]),
+        totalTokens: 2,
+      });
+
+      const result = await model.doEmbed({
+        values: ["hello"],
+        providerOptions: { llamaCpp: { encoding: "int8" } },
+      });
+
+      expect(nativeBinding.embed).toHaveBeenCalledWith(1, {
+        texts: ["hello"],
+        encoding: "int8",
+      });
+      expect(result.embeddings).toEqual([[127, -64, 0]]);
+      expect(result.providerMetadata).toEqual({
+        llamaCpp: { scales: [0.5] },
+      });
+    });
+
+    it("retries an embedding that lost the race with an eviction", async () => {
+      await model.doEmbed({ values: ["hello", "world"] });
+
+      vi.mocked(nativeBinding.isModelLoaded)
+        .mockReturnValueOnce(true)
+        .mockReturnValueOnce(false)
+        .mockReturnValueOnce(false);
+      vi.mocked(nativeBinding.embed).mockRejectedValueOnce(
+        new Error("Failed to generate embeddings")
+      );
+      vi.mocked(nativeBinding.loadModel).mockResolvedValueOnce(2);
+      const result = await model.doEmbed({ values: ["hello", "world"] });
+
+      expect(result.embeddings).toHaveLength(2);
+      expect(nativeBinding.unloadModel).toHaveBeenCalledWith(1);
+      expect(vi.mocked(nativeBinding.embed).mock.lastCall?.[0]).toBe(2);
+    });
+  });
+
+  describe("token input", () => {
+    it("embeds tokenized texts without converting the result", async () => {
+      const tokens = await model.tokenize(["hello"]);
+      const result = await model.embedTokens(tokens, { encoding: "float32" });
+
+      expect(nativeBinding.tokenize).toHaveBeenCalledWith(1, {
+        texts: ["hello"],
+      });
+      expect(nativeBinding.embed).toHaveBeenCalledWith(1, {
+        tokens: [new Int32Array([101, 7592, 102])],
+        encoding: "float32",
+      });
+      expect(result.data).toBeInstanceOf(Float32Array);
+    });
+  });
+
+  describe("embedStream", () => {
+    it("yields batches in input order with their offsets", async () => {
+      const batches = [];
+      for await (const batch of model.embedStream(["a", "b", "c", "d", "e"], {
+        batchSize: 2,
+      })) {
+        batches.push({ offset: batch.offset, values: batch.values });
+      }
+
+      expect(batches).toEqual([
+        { offset: 0, values: ["a", "b"] },
+        { offset: 2, values: ["c", "d"] },
+        { offset: 4, values: ["e"] },
+      ]);
+      expect(nativeBinding.embed).toHaveBeenCalledTimes(3);
+    });
+
+    it("reads no further ahead than the pending batches allow", async () => {
+      let read = 0;
+      async function* corpus() {
+        for (let i = 0; i < 100; i++) {
+          read++;
+          yield `text ${i}`;
+        }
+      }
+
+      const stream = model.embedStream(corpus(), {
+        batchSize: 4,
+        maxPendingBatches: 2,
+      });
+      const first = await stream.next();
+
+      expect(first.value?.offset).toBe(0);
+      expect(read).toBe(8);
+      expect(nativeBinding.embed).toHaveBeenCalledTimes(2);
+      await stream.return(undefined);
+    });
+
+    it("passes the encoding to every batch", async () => {
+      const stream = model.embedStream(["a"], { encoding: "int8" });
+      for await (const batch of stream) {
+        expect(batch.values).toEqual(["a"]);
+      }
+
+      expect(nativeBinding.embed).toHaveBeenCalledWith(1, {
+        texts: ["a"],
+        encoding: "int8",
+      });
+    });
+  });
+
+  describe("model loading", () => {
+    it("loads an embedding context with batching", async () => {
+      await model.doEmbed({ values: ["hello"] });
+
+      expect(nativeBinding.loadModel).toHaveBeenCalledWith({
+        modelPath: "/test/embed.gguf",
+        contextSize: 2048,
+        gpuLayers: 99,
+        threads: 4,
+        batchSize: 512,
+        debug: false,
+        embedding: true,
+        parallelSequences: 32,
+        warmup: true,
+        prefetch: false,
+      });
+    });
+  });
+});
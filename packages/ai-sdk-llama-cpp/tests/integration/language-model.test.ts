@@ -25,6 +25,13 @@ vi.mock("../../src/native-binding.js", () => ({
     });
   }),
   isModelLoaded: vi.fn().mockReturnValue(true),
+  getQueueLength: vi.fn().mockReturnValue({ pending: 2, active: 1 }),
+  getMetrics: vi.fn().mockReturnValue({ promptTokens: 50, completionTokens: 10 }),
+  saveSession: vi.fn().mockResolvedValue({ tokens: 120 }),
+  loadSession: vi.fn().mockResolvedValue({ tokens: 120 }),
+  loadLoraAdapter: vi.fn().mockResolvedValue(undefined),
+  tokenize: vi.fn().mockResolvedValue([new Int32Array([1, 15043])]),
+  detokenize: vi.fn().mockResolvedValue(["Hello"]),
 }));
 
 // Import after mocking
@@ -150,7 +157,33 @@ describe("LlamaCppLanguageModel Integration", () => {
           topP: 0.8,
           topK: 30,
           stopSequences: ["END"],
-        })
+        }),
+        undefined
+      );
+    });
+
+    it("passes the seed, penalties and sampling stages", async () => {
+      await model.doGenerate({
+        prompt: testMessages,
+        seed: 7,
+        frequencyPenalty: 0.2,
+        presencePenalty: 0.1,
+        providerOptions: {
+          llamaCpp: { repeatPenalty: 1.1, minP: 0.05, typicalP: 0.9 },
+        },
+      });
+
+      expect(nativeBinding.generate).toHaveBeenCalledWith(
+        expect.any(Number),
+        expect.objectContaining({
+          seed: 7,
+          frequencyPenalty: 0.2,
+          presencePenalty: 0.1,
+          repeatPenalty: 1.1,
+          minP: 0.05,
+          typicalP: 0.9,
+        }),
+        undefined
       );
     });
 
@@ -163,7 +196,8 @@ describe("LlamaCppLanguageModel Integration", () => {
         expect.any(Number),
         expect.objectContaining({
           messages: [{ role: "user", content: "Hello, how are you?" }],
-        })
+        }),
+        undefined
       );
     });
   });
@@ -195,6 +229,28 @@ describe("LlamaCppLanguageModel Integration", () => {
       expect(result.request!.body).toHaveProperty("maxTokens", 100);
     });
 
+    it("passes the token flush budget to the native binding", async () => {
+      const coalescingModel = new LlamaCppLanguageModel({
+        modelPath: "/test/model.gguf",
+        streamFlushIntervalMs: 50,
+        streamFlushTokens: 8,
+      });
+
+      const { stream } = await coalescingModel.doStream({
+        prompt: testMessages,
+      });
+      await collectStreamParts(stream);
+
+      expect(nativeBinding.generateStream).toHaveBeenCalledWith(
+        1,
+        expect.objectContaining({ flushIntervalMs: 50, flushTokens: 8 }),
+        expect.any(Function),
+        expect.any(AbortSignal)
+      );
+
+      await coalescingModel.dispose();
+    });
+
     it("emits stream-start as first part", async () => {
       const { stream } = await model.doStream({
         prompt: testMessages,
@@ -341,9 +397,27 @@ describe("LlamaCppLanguageModel Integration", () => {
         modelPath: "/custom/path.gguf",
         contextSize: 4096,
         gpuLayers: 32,
+        splitMode: "row",
+        mainGpu: 1,
+        tensorSplit: [3, 1],
+        devices: ["CUDA0", "CUDA1"],
+        numa: "distribute",
+        useMmap: false,
+        useMlock: true,
         threads: 8,
+        batchSize: 1024,
+        ubatchSize: 256,
+        threadsBatch: 12,
+        cacheTypeK: "q8_0",
+        cacheTypeV: "q8_0",
+        flashAttention: "on",
         debug: true,
         chatTemplate: "llama3",
+        parallelSequences: 4,
+        maxQueueSize: 16,
+        draftModelPath: "/custom/draft.gguf",
+        draftTokens: 4,
+        lookupNgramSize: 3,
       });
 
       await customModel.doGenerate({
@@ -354,9 +428,29 @@ describe("LlamaCppLanguageModel Integration", () => {
         modelPath: "/custom/path.gguf",
         contextSize: 4096,
         gpuLayers: 32,
+        splitMode: "row",
+        mainGpu: 1,
+        tensorSplit: [3, 1],
+        devices: ["CUDA0", "CUDA1"],
+        numa: "distribute",
+        useMmap: false,
+        useMlock: true,
         threads: 8,
+        batchSize: 1024,
+        ubatchSize: 256,
+        threadsBatch: 12,
+        cacheTypeK: "q8_0",
+        cacheTypeV: "q8_0",
+        flashAttention: "on",
         debug: true,
         chatTemplate: "llama3",
+        parallelSequences: 4,
+        maxQueueSize: 16,
+        draftModelPath: "/custom/draft.gguf",
+        draftTokens: 4,
+        lookupNgramSize: 3,
+        warmup: true,
+        prefetch: false,
       });
 
       await customModel.dispose();
@@ -376,12 +470,558 @@ describe("LlamaCppLanguageModel Integration", () => {
         contextSize: 2048,
         gpuLayers: 99,
         threads: 4,
+        batchSize: 512,
+        cacheTypeK: "f16",
+        cacheTypeV: "f16",
+        flashAttention: "auto",
         debug: false,
         chatTemplate: "auto",
+        parallelSequences: 1,
+        maxQueueSize: 0,
+        draftTokens: 8,
+        lookupNgramSize: 0,
+        warmup: true,
+        prefetch: false,
       });
 
       await minimalModel.dispose();
     });
+
+    it("reloads a model evicted by the memory budget", async () => {
+      const prompt: LanguageModelV3Message[] = [
+        { role: "user", content: [{ type: "text", text: "test" }] },
+      ];
+      await model.doGenerate({ prompt });
+
+      vi.mocked(nativeBinding.isModelLoaded).mockReturnValueOnce(false);
+      vi.mocked(nativeBinding.loadModel).mockResolvedValueOnce(2);
+      await model.doGenerate({ prompt });
+
+      expect(nativeBinding.unloadModel).toHaveBeenCalledWith(1);
+      expect(nativeBinding.loadModel).toHaveBeenCalledTimes(2);
+      expect(vi.mocked(nativeBinding.generate).mock.lastCall?.[0]).toBe(2);
+    });
+
+    it("retries a call that lost the race with an eviction", async () => {
+      const prompt: LanguageModelV3Message[] = [
+        { role: "user", content: [{ type: "text", text: "test" }] },
+      ];
+      await model.doGenerate({ prompt });
+
+      // Loaded when checked, evicted before the request was queued
+      vi.mocked(nativeBinding.isModelLoaded)
+        .mockReturnValueOnce(true)
+        .mockReturnValueOnce(false)
+        .mockReturnValueOnce(false);
+      vi.mocked(nativeBinding.generate).mockRejectedValueOnce(
+        new Error("No generation context")
+      );
+      vi.mocked(nativeBinding.loadModel).mockResolvedValueOnce(2);
+      const result = await model.doGenerate({ prompt });
+
+      expect(result.finishReason.unified).toBe("stop");
+      expect(nativeBinding.loadModel).toHaveBeenCalledTimes(2);
+      expect(vi.mocked(nativeBinding.generate).mock.lastCall?.[0]).toBe(2);
+    });
+
+    it("does not retry failures of a loaded model", async () => {
+      vi.mocked(nativeBinding.generate).mockRejectedValueOnce(
+        new Error("Request queue is full")
+      );
+
+      await expect(
+        model.doGenerate({
+          prompt: [{ role: "user", content: [{ type: "text", text: "hi" }] }],
+        })
+      ).rejects.toThrow("Request queue is full");
+      expect(nativeBinding.generate).toHaveBeenCalledTimes(1);
+    });
+
+    it("loads eagerly with load() and passes startup options", async () => {
+      const onLoadProgress = vi.fn();
+      const eagerModel = new LlamaCppLanguageModel({
+        modelPath: "/eager.gguf",
+        warmup: false,
+        prefetch: true,
+        onLoadProgress,
+      });
+
+      await eagerModel.load();
+
+      expect(nativeBinding.loadModel).toHaveBeenCalledTimes(1);
+      expect(nativeBinding.loadModel).toHaveBeenCalledWith(
+        expect.objectContaining({
+          modelPath: "/eager.gguf",
+          warmup: false,
+          prefetch: true,
+          onProgress: onLoadProgress,
+        })
+      );
+
+      await eagerModel.doGenerate({
+        prompt: [{ role: "user", content: [{ type: "text", text: "test" }] }],
+      });
+      expect(nativeBinding.loadModel).toHaveBeenCalledTimes(1);
+
+      await eagerModel.dispose();
+    });
+  });
+
+  describe("sessions", () => {
+    it("saves the converted prompt prefix", async () => {
+      const tokens = await model.saveSession("/tmp/system.session", [
+        { role: "system", content: "You are a helpful assistant." },
+      ]);
+
+      expect(tokens).toBe(120);
+      expect(nativeBinding.saveSession).toHaveBeenCalledWith(1, {
+        path: "/tmp/system.session",
+        messages: [{ role: "system", content: "You are a helpful assistant." }],
+      });
+    });
+
+    it("loads a session file", async () => {
+      const tokens = await model.loadSession("/tmp/system.session");
+
+      expect(tokens).toBe(120);
+      expect(nativeBinding.loadSession).toHaveBeenCalledWith(1, {
+        path: "/tmp/system.session",
+      });
+    });
+
+    it("propagates session errors", async () => {
+      vi.mocked(nativeBinding.loadSession).mockRejectedValueOnce(
+        new Error("Failed to load session from: /missing.session")
+      );
+
+      await expect(model.loadSession("/missing.session")).rejects.toThrow(
+        "Failed to load session"
+      );
+    });
+  });
+
+  describe("queueing", () => {
+    const prompt: LanguageModelV3Message[] = [
+      { role: "user", content: [{ type: "text", text: "test" }] },
+    ];
+
+    it("passes the priority from provider options", async () => {
+      await model.doGenerate({
+        prompt,
+        providerOptions: { llamaCpp: { priority: 5 } },
+      });
+
+      expect(nativeBinding.generate).toHaveBeenCalledWith(
+        1,
+        expect.objectContaining({ priority: 5 }),
+        undefined
+      );
+    });
+
+    it("reports the native queue length once loaded", async () => {
+      expect(model.getQueueLength()).toEqual({ pending: 0, active: 0 });
+
+      await model.doGenerate({ prompt });
+
+      expect(model.getQueueLength()).toEqual({ pending: 2, active: 1 });
+      expect(nativeBinding.getQueueLength).toHaveBeenCalledWith(1);
+    });
+
+    it("propagates queue full errors", async () => {
+      vi.mocked(nativeBinding.generate).mockRejectedValueOnce(
+        new Error("Request queue is full")
+      );
+
+      await expect(model.doGenerate({ prompt })).rejects.toThrow(
+        "Request queue is full"
+      );
+    });
+  });
+
+  describe("speculative decoding", () => {
+    const prompt: LanguageModelV3Message[] = [
+      { role: "user", content: [{ type: "text", text: "test" }] },
+    ];
+
+    it("reports draft acceptance in provider metadata", async () => {
+      vi.mocked(nativeBinding.generate).mockResolvedValueOnce({
+        text: "Mock response text",
+        promptTokens: 50,
+        completionTokens: 10,
+        cachedPromptTokens: 0,
+        draftTokens: 8,
+        acceptedDraftTokens: 6,
+        finishReason: "stop",
+      });
+
+      const result = await model.doGenerate({ prompt });
+
+      expect(result.providerMetadata).toEqual({
+        llamaCpp: {
+          draftTokens: 8,
+          acceptedDraftTokens: 6,
+          draftAcceptanceRate: 0.75,
+        },
+      });
+    });
+
+    it("omits provider metadata without a draft model", async () => {
+      const result = await model.doGenerate({ prompt });
+
+      expect(result.providerMetadata).toBeUndefined();
+    });
+  });
+
+  describe("metrics", () => {
+    const prompt: LanguageModelV3Message[] = [
+      { role: "user", content: [{ type: "text", text: "test" }] },
+    ];
+
+    it("returns no metrics before the model is loaded", () => {
+      expect(model.getMetrics()).toBeUndefined();
+      expect(nativeBinding.getMetrics).not.toHaveBeenCalled();
+    });
+
+    it("reads the metrics of the loaded model", async () => {
+      await model.doGenerate({ prompt });
+
+      expect(model.getMetrics()).toEqual({
+        promptTokens: 50,
+        completionTokens: 10,
+      });
+      expect(nativeBinding.getMetrics).toHaveBeenCalledWith(1);
+    });
+
+    it("reports request timings in provider metadata", async () => {
+      const timings = {
+        queueMs: 1,
+        templateMs: 0.1,
+        tokenizeMs: 0.2,
+        prefillMs: 40,
+        decodeMs: 200,
+        evalMs: 230,
+        sampleMs: 5,
+        callbackMs: 0,
+        timeToFirstTokenMs: 41.3,
+        totalMs: 241.3,
+      };
+      vi.mocked(nativeBinding.generate).mockResolvedValueOnce({
+        text: "Mock response text",
+        promptTokens: 50,
+        completionTokens: 10,
+        cachedPromptTokens: 0,
+        draftTokens: 0,
+        acceptedDraftTokens: 0,
+        discardedTokens: 0,
+        finishReason: "stop",
+        timings,
+      });
+
+      const result = await model.doGenerate({ prompt });
+
+      expect(result.providerMetadata).toEqual({ llamaCpp: { timings } });
+    });
+  });
+
+  describe("context overflow", () => {
+    const prompt: LanguageModelV3Message[] = [
+      { role: "user", content: [{ type: "text", text: "test" }] },
+    ];
+
+    it("passes the overflow policy to the native binding", async () => {
+      const shiftingModel = new LlamaCppLanguageModel({
+        modelPath: "/test/shift.gguf",
+        contextOverflow: "shift",
+      });
+
+      await shiftingModel.doGenerate({ prompt });
+
+      expect(nativeBinding.generate).toHaveBeenCalledWith(
+        1,
+        expect.objectContaining({ contextOverflow: "shift" }),
+        undefined
+      );
+
+      await shiftingModel.dispose();
+    });
+
+    it("reports discarded tokens in provider metadata", async () => {
+      vi.mocked(nativeBinding.generate).mockResolvedValueOnce({
+        text: "Mock response text",
+        promptTokens: 1800,
+        completionTokens: 300,
+        cachedPromptTokens: 100,
+        draftTokens: 0,
+        acceptedDraftTokens: 0,
+        discardedTokens: 950,
+        finishReason: "stop",
+      });
+
+      const result = await model.doGenerate({ prompt });
+
+      expect(result.providerMetadata).toEqual({
+        llamaCpp: { discardedTokens: 950 },
+      });
+    });
+  });
+
+  describe("parallel sampling", () => {
+    const prompt: LanguageModelV3Message[] = [
+      { role: "user", content: [{ type: "text", text: "test" }] },
+    ];
+
+    it("passes n from provider options", async () => {
+      await model.doGenerate({
+        prompt,
+        providerOptions: { llamaCpp: { n: 3 } },
+      });
+
+      expect(nativeBinding.generate).toHaveBeenCalledWith(
+        1,
+        expect.objectContaining({ n: 3 }),
+        undefined
+      );
+    });
+
+    it("returns the first choice as content and all in provider metadata", async () => {
+      vi.mocked(nativeBinding.generate).mockResolvedValueOnce({
+        text: "first",
+        promptTokens: 10,
+        completionTokens: 5,
+        cachedPromptTokens: 0,
+        draftTokens: 0,
+        acceptedDraftTokens: 0,
+        discardedTokens: 0,
+        finishReason: "stop",
+        choices: [
+          { text: "first", completionTokens: 2, finishReason: "stop" },
+          { text: "second one", completionTokens: 3, finishReason: "length" },
+        ],
+      });
+
+      const result = await model.doGenerate({
+        prompt,
+        providerOptions: { llamaCpp: { n: 2 } },
+      });
+
+      expect(result.content).toEqual([
+        { type: "text", text: "first", providerMetadata: undefined },
+      ]);
+      expect(result.usage.outputTokens.total).toBe(5);
+      expect(result.providerMetadata).toEqual({
+        llamaCpp: {
+          choices: [
+            { text: "first", completionTokens: 2, finishReason: "stop" },
+            {
+              text: "second one",
+              completionTokens: 3,
+              finishReason: "length",
+            },
+          ],
+        },
+      });
+    });
+  });
+
+  describe("token input and output", () => {
+    const prompt: LanguageModelV3Message[] = [
+      { role: "user", content: [{ type: "text", text: "test" }] },
+    ];
+
+    it("tokenizes and detokenizes through the native binding", async () => {
+      const tokens = await model.tokenize(["Hello"], { addSpecial: false });
+      const texts = await model.detokenize(tokens, { special: true });
+
+      expect(nativeBinding.tokenize).toHaveBeenCalledWith(1, {
+        texts: ["Hello"],
+        addSpecial: false,
+      });
+      expect(nativeBinding.detokenize).toHaveBeenCalledWith(1, {
+        tokens: [new Int32Array([1, 15043])],
+        special: true,
+      });
+      expect(texts).toEqual(["Hello"]);
+    });
+
+    it("passes prompt tokens from provider options", async () => {
+      await model.doGenerate({
+        prompt,
+        providerOptions: { llamaCpp: { promptTokens: [1, 15043, 29991] } },
+      });
+
+      expect(nativeBinding.generate).toHaveBeenCalledWith(
+        1,
+        expect.objectContaining({
+          promptTokens: new Int32Array([1, 15043, 29991]),
+        }),
+        undefined
+      );
+    });
+
+    it("returns generated token ids in provider metadata", async () => {
+      vi.mocked(nativeBinding.generate).mockResolvedValueOnce({
+        text: "Hi!",
+        promptTokens: 3,
+        completionTokens: 2,
+        cachedPromptTokens: 0,
+        draftTokens: 0,
+        acceptedDraftTokens: 0,
+        discardedTokens: 0,
+        finishReason: "stop",
+        tokens: new Int32Array([6324, 29991]),
+      });
+
+      const result = await model.doGenerate({
+        prompt,
+        providerOptions: { llamaCpp: { returnTokens: true } },
+      });
+
+      expect(nativeBinding.generate).toHaveBeenCalledWith(
+        1,
+        expect.objectContaining({ returnTokens: true }),
+        undefined
+      );
+      expect(result.providerMetadata).toEqual({
+        llamaCpp: { tokens: [6324, 29991] },
+      });
+    });
+  });
+
+  describe("LoRA adapters", () => {
+    const prompt: LanguageModelV3Message[] = [
+      { role: "user", content: [{ type: "text", text: "test" }] },
+    ];
+
+    it("loads configured and added adapters with the model", async () => {
+      const loraModel = new LlamaCppLanguageModel({
+        modelPath: "/test/base.gguf",
+        loraAdapters: { "tenant-a": "/test/a.gguf" },
+      });
+
+      await loraModel.loadLoraAdapter("tenant-b", "/test/b.gguf");
+      expect(nativeBinding.loadModel).toHaveBeenCalledWith(
+        expect.objectContaining({
+          loraAdapters: [{ name: "tenant-a", path: "/test/a.gguf" }],
+        })
+      );
+      expect(nativeBinding.loadLoraAdapter).toHaveBeenCalledWith(1, {
+        name: "tenant-b",
+        path: "/test/b.gguf",
+      });
+
+      // A reload after eviction brings back both adapters
+      vi.mocked(nativeBinding.isModelLoaded).mockReturnValueOnce(false);
+      await loraModel.doGenerate({ prompt });
+      expect(nativeBinding.loadModel).toHaveBeenLastCalledWith(
+        expect.objectContaining({
+          loraAdapters: [
+            { name: "tenant-a", path: "/test/a.gguf" },
+            { name: "tenant-b", path: "/test/b.gguf" },
+          ],
+        })
+      );
+
+      await loraModel.dispose();
+    });
+
+    it("passes the adapters of a call from provider options", async () => {
+      await model.doGenerate({
+        prompt,
+        providerOptions: { llamaCpp: { lora: "tenant-a" } },
+      });
+      await model.doGenerate({
+        prompt,
+        providerOptions: { llamaCpp: { lora: { "tenant-a": 1, style: 0.5 } } },
+      });
+
+      expect(vi.mocked(nativeBinding.generate).mock.calls[0][1].lora).toEqual([
+        { name: "tenant-a" },
+      ]);
+      expect(vi.mocked(nativeBinding.generate).mock.calls[1][1].lora).toEqual([
+        { name: "tenant-a", scale: 1 },
+        { name: "style", scale: 0.5 },
+      ]);
+    });
+  });
+
+  describe("cancellation", () => {
+    const prompt: LanguageModelV3Message[] = [
+      { role: "user", content: [{ type: "text", text: "test" }] },
+    ];
+
+    it("passes the abort signal to the native binding", async () => {
+      const controller = new AbortController();
+
+      await model.doGenerate({ prompt, abortSignal: controller.signal });
+
+      expect(nativeBinding.generate).toHaveBeenCalledWith(
+        1,
+        expect.any(Object),
+        controller.signal
+      );
+    });
+
+    it("rejects with the abort reason when a generation is cancelled", async () => {
+      const controller = new AbortController();
+      const reason = new Error("client disconnected");
+      vi.mocked(nativeBinding.generate).mockImplementationOnce(async () => {
+        controller.abort(reason);
+        return {
+          text: "partial",
+          promptTokens: 5,
+          completionTokens: 1,
+          cachedPromptTokens: 0,
+          finishReason: "cancelled",
+        };
+      });
+
+      await expect(
+        model.doGenerate({ prompt, abortSignal: controller.signal })
+      ).rejects.toBe(reason);
+    });
+
+    it("emits the abort reason as a stream error", async () => {
+      const controller = new AbortController();
+      const reason = new Error("client disconnected");
+      vi.mocked(nativeBinding.generateStream).mockImplementationOnce(
+        async (handle, opts, onToken) => {
+          onToken("Hello");
+          controller.abort(reason);
+          onToken(" ignored");
+          return {
+            text: "Hello",
+            promptTokens: 5,
+            completionTokens: 2,
+            cachedPromptTokens: 0,
+            finishReason: "cancelled",
+          };
+        }
+      );
+
+      const { stream } = await model.doStream({
+        prompt,
+        abortSignal: controller.signal,
+      });
+      const parts = await collectStreamParts(stream);
+
+      const deltas = parts.filter((p) => p.type === "text-delta");
+      expect(deltas.map((p) => p.delta)).toEqual(["Hello"]);
+      expect(parts.find((p) => p.type === "error")?.error).toBe(reason);
+      expect(parts.find((p) => p.type === "finish")).toBeUndefined();
+    });
+
+    it("passes the timeout from provider options", async () => {
+      await model.doGenerate({
+        prompt,
+        providerOptions: { llamaCpp: { timeoutMs: 5000 } },
+      });
+
+      expect(nativeBinding.generate).toHaveBeenCalledWith(
+        1,
+        expect.objectContaining({ timeoutMs: 5000 }),
+        undefined
+      );
+    });
   });
 
   describe("dispose", () => {
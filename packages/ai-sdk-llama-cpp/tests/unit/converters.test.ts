@@ -92,6 +92,17 @@ describe("convertUsage", () => {
     });
   });
 
+  describe("cached prompt tokens", () => {
+    it("maps cached prompt tokens to cacheRead and noCache", () => {
+      const result = convertUsage(100, 50, 80);
+
+      expect(result.inputTokens.total).toBe(100);
+      expect(result.inputTokens.cacheRead).toBe(80);
+      expect(result.inputTokens.noCache).toBe(20);
+      expect(result.inputTokens.cacheWrite).toBeUndefined();
+    });
+  });
+
   describe("edge cases", () => {
     it("handles zero tokens", () => {
       const result = convertUsage(0, 0);
@@ -1,4 +1,4 @@
-import { describe, it, expect } from "vitest";
+import { describe, it, expect, vi } from "vitest";
 import type { JSONSchema7 } from "@ai-sdk/provider";
 import {
   convertJsonSchemaToGrammar,
@@ -809,4 +809,42 @@ describe("SchemaConverter", () => {
       expect(() => converter.resolveRefs(schema)).toThrow("Unsupported ref");
     });
   });
+
+  describe("memoization", () => {
+    it("converts each schema only once", () => {
+      const formatGrammar = vi.spyOn(
+        SchemaConverter.prototype,
+        "formatGrammar"
+      );
+      const schema: JSONSchema7 = {
+        type: "object",
+        properties: { memoized: { type: "boolean" } },
+      };
+
+      const first = convertJsonSchemaToGrammar(schema);
+      const second = convertJsonSchemaToGrammar({
+        type: "object",
+        properties: { memoized: { type: "boolean" } },
+      });
+
+      expect(second).toBe(first);
+      expect(formatGrammar).toHaveBeenCalledTimes(1);
+      formatGrammar.mockRestore();
+    });
+
+    it("keys the cache by converter options", () => {
+      const schema: JSONSchema7 = {
+        type: "object",
+        properties: { a: { type: "string" }, b: { type: "string" } },
+        required: ["a", "b"],
+      };
+
+      const defaultOrder = convertJsonSchemaToGrammar(schema);
+      const customOrder = convertJsonSchemaToGrammar(schema, {
+        propOrder: { b: 0, a: 1 },
+      });
+
+      expect(customOrder).not.toBe(defaultOrder);
+    });
+  });
 });
@@ -0,0 +1,111 @@
+import { describe, it, expect } from "vitest";
+import { formatPrometheusMetrics } from "../../src/metrics.js";
+import type {
+  MetricsHistogram,
+  ModelMetrics,
+} from "../../src/native-binding.js";
+
+function histogram(counts: number[], sum = 0): MetricsHistogram {
+  const bounds = [0.1, 1];
+  return {
+    buckets: bounds.map((le, i) => ({ le, count: counts[i] })),
+    count: counts[counts.length - 1],
+    sum,
+  };
+}
+
+function metrics(overrides: Partial<ModelMetrics> = {}): ModelMetrics {
+  return {
+    requests: { stop: 3, length: 1 },
+    promptTokens: 120,
+    cachedPromptTokens: 40,
+    completionTokens: 64,
+    draftTokens: 0,
+    acceptedDraftTokens: 0,
+    discardedTokens: 0,
+    embeddingRequests: 0,
+    embeddingTexts: 0,
+    embeddingTokens: 0,
+    decodeSteps: 70,
+    decodeTokens: 150,
+    seconds: {
+      template: 0.001,
+      tokenize: 0.002,
+      eval: 1.5,
+      draft: 0,
+      sample: 0.05,
+      callback: 0.01,
+    },
+    histograms: {
+      queueWait: histogram([4, 4, 4]),
+      timeToFirstToken: histogram([1, 3, 4], 1.25),
+      timePerOutputToken: histogram([4, 4, 4], 0.08),
+      requestDuration: histogram([0, 2, 4], 3.5),
+      embeddingDuration: histogram([0, 0, 0]),
+    },
+    ...overrides,
+  };
+}
+
+describe("formatPrometheusMetrics", () => {
+  it("formats counters with HELP and TYPE lines", () => {
+    const text = formatPrometheusMetrics(metrics());
+
+    expect(text).toContain(
+      "# HELP llamacpp_prompt_tokens_total Prompt tokens of generation requests.\n" +
+        "# TYPE llamacpp_prompt_tokens_total counter\n" +
+        "llamacpp_prompt_tokens_total 120\n"
+    );
+  });
+
+  it("labels requests by finish reason and phases by name", () => {
+    const text = formatPrometheusMetrics(metrics());
+
+    expect(text).toContain('llamacpp_requests_total{finish_reason="stop"} 3');
+    expect(text).toContain('llamacpp_requests_total{finish_reason="length"} 1');
+    expect(text).toContain('llamacpp_phase_seconds_total{phase="eval"} 1.5');
+  });
+
+  it("formats histograms as cumulative buckets with +Inf, sum and count", () => {
+    const text = formatPrometheusMetrics(metrics());
+
+    expect(text).toContain(
+      "# TYPE llamacpp_time_to_first_token_seconds histogram\n" +
+        'llamacpp_time_to_first_token_seconds_bucket{le="0.1"} 1\n' +
+        'llamacpp_time_to_first_token_seconds_bucket{le="1"} 3\n' +
+        'llamacpp_time_to_first_token_seconds_bucket{le="+Inf"} 4\n' +
+        "llamacpp_time_to_first_token_seconds_sum 1.25\n" +
+        "llamacpp_time_to_first_token_seconds_count 4\n"
+    );
+  });
+
+  it("applies the prefix and common labels to every sample", () => {
+    const text = formatPrometheusMetrics(metrics(), {
+      prefix: "app_llm_",
+      labels: { model: "llama-3.2-1b" },
+    });
+
+    expect(text).toContain('app_llm_prompt_tokens_total{model="llama-3.2-1b"} 120');
+    expect(text).toContain(
+      'app_llm_requests_total{model="llama-3.2-1b",finish_reason="stop"} 3'
+    );
+    expect(text).toContain(
+      'app_llm_queue_wait_seconds_bucket{model="llama-3.2-1b",le="+Inf"} 4'
+    );
+    expect(text).not.toContain("llamacpp_");
+  });
+
+  it("escapes label values", () => {
+    const text = formatPrometheusMetrics(metrics(), {
+      labels: { model: 'a "quoted"\\path\nname' },
+    });
+
+    expect(text).toContain(
+      'llamacpp_completion_tokens_total{model="a \\"quoted\\"\\\\path\\nname"} 64'
+    );
+  });
+
+  it("ends with a newline", () => {
+    expect(formatPrometheusMetrics(metrics()).endsWith("\n")).toBe(true);
+  });
+});